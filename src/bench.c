@@ -0,0 +1,928 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro benchmarks of the generation and I/O paths
+ *
+ * Every benchmark is run several times with the same seed and
+ * the median is reported, so the numbers are comparable across
+ * versions. Results are printed as JSON.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "errors.h"
+#include "netflow.h"
+#include "template.h"
+#include "simulation.h"
+#include "udp.h"
+#include "binaryoutput.h"
+#include "hosts.h"
+#include "pacing.h"
+#include "random.h"
+#include "wireorder.h"
+#include "meter.h"
+
+#define DEFAULT_SEED        1
+#define DEFAULT_REPETITIONS 5
+#define DEFAULT_DIRECTORY   "/dev/shm"
+#define MAX_REPETITIONS     100
+
+/* Work of one repetition at scale 1 */
+#define GENERATE_PDUS  200000
+#define SIMULATED_PDUS 4000     /* Hundreds of packets per expired flow */
+#define SEND_PDUS      100000
+#define WRITE_PDUS     100000
+#define HOSTS_LINES    1000000
+#define SERIALIZE_PDUS 2000000
+#define METER_PACKETS  2000000
+#define REALISTIC_HOSTS 65536   /* Zipf-ranked hosts of netflow_v5_realistic */
+
+#define SEND_BATCH     32
+#define BENCH_MTU_PDU  1472     /* 1500 - IP/UDP headers */
+#define BENCH_JUMBO_PDU 8972    /* 9000 - IP/UDP headers */
+#define CACHE_SIZE     100000
+#define METER_FLOWS    50000    /* Concurrent flows of the metered capture */
+#define METER_SECONDS  60       /* Time span of the metered capture */
+#define METER_SNAPLEN  64       /* Headers only, the way captures for metering are taken */
+#define METER_ACTIVE_TIMEOUT   60000  /* [ms] */
+#define METER_INACTIVE_TIMEOUT 15000  /* [ms] */
+#define OUTPUT_BUFFER  (256 << 20)
+
+struct benchOptions
+{
+    uint64_t     seed;
+    unsigned int repetitions;
+    double       scale;
+    const char*  directory;
+    const char*  outputPath;
+};
+
+/** Work done by one repetition */
+struct benchRun
+{
+    uint64_t duration;  /* [ns] */
+    uint64_t pdus;
+    uint64_t records;
+    uint64_t bytes;
+};
+
+typedef error_t (*benchFunction)(const struct benchOptions* options, struct benchRun* run);
+
+struct benchmark
+{
+    const char*   name;
+    benchFunction function;
+};
+
+static uint64_t scaled(const struct benchOptions* options, uint64_t count)
+{
+    uint64_t result = count * options->scale;
+    return result > 0 ? result : 1;
+}
+
+static void initializeBenchExporter(const struct benchOptions* options, struct netflowExporter* exporter)
+{
+    struct randomState random;
+    randomSeed(&random, options->seed);
+    initializeExporter(exporter, time(NULL), 0, &random);
+}
+
+static error_t benchV5Random(const struct benchOptions* options, struct benchRun* run)
+{
+    struct netflowExporter exporter;
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    uint64_t pdus = scaled(options, GENERATE_PDUS);
+
+    initializeBenchExporter(options, &exporter);
+    uint64_t now = wallClockTime();
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        unsigned int flows = randomNumberOfFlows(&exporter);
+        run->bytes += makeRandomNetflowPacket(buffer, &exporter, flows, now);
+        run->records += flows;
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+
+    return EOK;
+}
+
+/* Zipf hosts, Pareto flow sizes and service ports over a /16 */
+static error_t benchV5Realistic(const struct benchOptions* options, struct benchRun* run)
+{
+    struct trafficModel model = { 1.0, FLOW_SIZE_PARETO, 1.2, 1, 1 };
+    struct netflowExporter exporter;
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    uint64_t pdus = scaled(options, GENERATE_PDUS);
+    error_t status;
+
+    in_addr_t* hosts = (in_addr_t*) malloc(REALISTIC_HOSTS * sizeof(in_addr_t));
+    if (hosts == NULL)
+    {
+        return ENOMEM;
+    }
+    for (uint32_t i = 0; i < REALISTIC_HOSTS; i++)
+    {
+        hosts[i] = htonl(0x0a000000 | i);
+    }
+
+    setNetflowHosts(hosts, REALISTIC_HOSTS);
+    status = setTrafficModel(&model);
+    initializeBenchExporter(options, &exporter);
+    uint64_t now = wallClockTime();
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus && status == EOK; i++)
+    {
+        unsigned int flows = randomNumberOfFlows(&exporter);
+        run->bytes += makeRandomNetflowPacket(buffer, &exporter, flows, now);
+        run->records += flows;
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+
+    setNetflowHosts(NULL, 0);
+    setTrafficModel(NULL);
+    free(hosts);
+
+    return status;
+}
+
+static error_t benchV5Full(const struct benchOptions* options, struct benchRun* run)
+{
+    struct netflowExporter exporter;
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    uint64_t pdus = scaled(options, GENERATE_PDUS);
+
+    initializeBenchExporter(options, &exporter);
+    uint64_t now = wallClockTime();
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        run->bytes += makeRandomNetflowPacket(buffer, &exporter, MAX_NETFLOW_RECORDS, now);
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+    run->records = pdus * MAX_NETFLOW_RECORDS;
+
+    return EOK;
+}
+
+/** v5 PDUs of the same 30 records, only the header and the byte order */
+static error_t benchSerialize(const struct benchOptions* options, struct benchRun* run, enum wireOrder limit)
+{
+    struct netflowExporter exporter;
+    struct netflowRecord records[MAX_NETFLOW_RECORDS];
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    uint64_t pdus = scaled(options, SERIALIZE_PDUS);
+
+    initializeBenchExporter(options, &exporter);
+    makeRandomNetflowRecords(&exporter, records, MAX_NETFLOW_RECORDS, 1000000);
+    selectWireOrder(limit);
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        run->bytes += makeNetflowPacket(buffer, &exporter, records, MAX_NETFLOW_RECORDS, 1000000);
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+    run->records = pdus * MAX_NETFLOW_RECORDS;
+
+    selectWireOrder(NUMBER_OF_WIRE_ORDERS);
+
+    return EOK;
+}
+
+static error_t benchSerializeScalar(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchSerialize(options, run, WIRE_ORDER_SCALAR);
+}
+
+static error_t benchSerializeFastest(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchSerialize(options, run, NUMBER_OF_WIRE_ORDERS);
+}
+
+static error_t benchV5Simulated(const struct benchOptions* options, struct benchRun* run)
+{
+    struct netflowExporter exporter;
+    struct flowSimulation simulation;
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    uint64_t pdus = scaled(options, SIMULATED_PDUS);
+
+    initializeBenchExporter(options, &exporter);
+    error_t status = initializeSimulation(&simulation, &exporter, CACHE_SIZE, CACHE_SIZE / 2, 60000, 15000, 100000,
+                                          MAX_NETFLOW_RECORDS);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        unsigned int flows;
+        run->bytes += makeSimulatedNetflowPacket(buffer, &simulation, &exporter, MAX_NETFLOW_RECORDS, &flows);
+        run->records += flows;
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+
+    freeSimulation(&simulation);
+
+    return EOK;
+}
+
+static error_t benchTemplate(const struct benchOptions* options, struct benchRun* run,
+                             int protocol, const char* fields)
+{
+    struct netflowExporter exporter;
+    struct templateEncoder encoder;
+    char buffer[BENCH_MTU_PDU];
+    uint64_t pdus = scaled(options, GENERATE_PDUS);
+
+    initializeBenchExporter(options, &exporter);
+    error_t status = initializeTemplateEncoder(&encoder, protocol, fields, sizeof(buffer), 20, 60000);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    struct netflowRecord* records = (struct netflowRecord*) calloc(templateMaxCapacity(&encoder),
+                                                                   sizeof(struct netflowRecord));
+    if (records == NULL)
+    {
+        return ENOMEM;
+    }
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        /* Full PDUs without the template, so every PDU does the same work */
+        unsigned int flows = templateCapacity(&encoder, 1000);
+        makeRandomNetflowRecords(&exporter, records, flows, 1000);
+        run->bytes += makeTemplatePacket(buffer, &encoder, &exporter, records, flows, 1000);
+        run->records += flows;
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+
+    free(records);
+
+    return EOK;
+}
+
+static error_t benchV9Full(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchTemplate(options, run, NETFLOW_V9, "full");
+}
+
+static error_t benchIpfixBasic(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchTemplate(options, run, IPFIX, "basic");
+}
+
+/** Flow cache records in jumbo IPFIX PDUs, far more than 30 per PDU */
+/** Custom field list, written by the per-field writers */
+static error_t benchIpfixCustom(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchTemplate(options, run, IPFIX, "srcaddr,dstaddr,srcport,dstport,proto,tcpflags,packets,bytes,start,end");
+}
+
+static error_t benchIpfixSimulated(const struct benchOptions* options, struct benchRun* run)
+{
+    struct netflowExporter exporter;
+    struct templateEncoder encoder;
+    struct flowSimulation simulation;
+    char buffer[BENCH_JUMBO_PDU];
+    uint64_t pdus = scaled(options, SIMULATED_PDUS / 8);   /* About eight times the records per PDU */
+
+    initializeBenchExporter(options, &exporter);
+    error_t status = initializeTemplateEncoder(&encoder, IPFIX, "basic", sizeof(buffer), 20, 60000);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    unsigned int capacity = templateMaxCapacity(&encoder);
+    struct netflowRecord* records = (struct netflowRecord*) calloc(capacity, sizeof(struct netflowRecord));
+    if (records == NULL)
+    {
+        return ENOMEM;
+    }
+
+    status = initializeSimulation(&simulation, &exporter, CACHE_SIZE, CACHE_SIZE / 2, 60000, 15000, 100000,
+                                  capacity);
+    if (status != EOK)
+    {
+        free(records);
+        return status;
+    }
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i++)
+    {
+        /* Fewer records fit while the template is due */
+        uint32_t sysUpTime = simulation.now / 1000000;
+        unsigned int flows = takeSimulatedRecords(&simulation, &exporter, records,
+                                                  templateCapacity(&encoder, sysUpTime), &sysUpTime);
+        run->bytes += makeTemplatePacket(buffer, &encoder, &exporter, records, flows, sysUpTime);
+        run->records += flows;
+    }
+    run->duration = monotonicTime() - start;
+    run->pdus = pdus;
+
+    freeSimulation(&simulation);
+    free(records);
+
+    return EOK;
+}
+
+static error_t benchV9Full6(const struct benchOptions* options, struct benchRun* run)
+{
+    error_t status = setNetflowHosts6(NULL, 0);
+    if (status == EOK)
+    {
+        status = benchTemplate(options, run, NETFLOW_V9, "full6");
+    }
+
+    /* Back to the IPv4 hosts for the other benchmarks */
+    setNetflowHosts(NULL, 0);
+
+    return status;
+}
+
+/** Loopback receiver that never reads, the kernel drops what doesn't fit */
+static error_t openSink(int* sink, in_addr_t* address, in_port_t* port)
+{
+    *sink = udpInitialize();
+
+    in_addr_t local;
+    error_t status = convertAddress("127.0.0.1", address);
+    if (status == EOK)
+    {
+        status = udpLocalEndpoint(*sink, *address, 9, &local, port);
+    }
+    *port = ntohs(*port);
+
+    return status;
+}
+
+static error_t benchSend(const struct benchOptions* options, struct benchRun* run, unsigned int batchSize,
+                         int offload)
+{
+    struct netflowExporter exporter;
+    uint64_t pdus = scaled(options, SEND_PDUS);
+    int sink;
+    in_addr_t address;
+    in_port_t port;
+
+    error_t status = openSink(&sink, &address, &port);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    int udpSocket = udpInitialize();
+    struct udpBatch batch;
+    if (batchSize > 1)
+    {
+        status = udpConnect(udpSocket, address, port);
+        if (status == EOK)
+        {
+            status = udpInitializeBatch(&batch, batchSize);
+        }
+        if (status == EOK && udpEnableOffload(udpSocket, &batch, offload) != offload)
+        {
+            udpFreeBatch(&batch);
+            status = ENOTSUP;
+        }
+        if (status != EOK)
+        {
+            udpClose(udpSocket);
+            udpClose(sink);
+            return status;
+        }
+    }
+
+    /* The same full PDU over and over, only sending is measured */
+    char buffer[MAX_NETFLOW_PDU_SIZE];
+    initializeBenchExporter(options, &exporter);
+    uint64_t now = wallClockTime();
+    size_t size = makeRandomNetflowPacket(buffer, &exporter, MAX_NETFLOW_RECORDS, now);
+
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i += batchSize)
+    {
+        if (batchSize > 1)
+        {
+            for (unsigned int j = 0; j < batchSize; j++)
+            {
+                udpAddToBatch(&batch, buffer, size);
+            }
+            run->pdus += udpSendBatch(udpSocket, &batch);
+        }
+        else
+        {
+            run->pdus += udpSend(udpSocket, address, port, buffer, size) == size;
+        }
+    }
+    run->duration = monotonicTime() - start;
+    run->records = run->pdus * MAX_NETFLOW_RECORDS;
+    run->bytes = run->pdus * size;
+
+    if (batchSize > 1)
+    {
+        udpFreeBatch(&batch);
+    }
+    udpClose(udpSocket);
+    udpClose(sink);
+
+    return EOK;
+}
+
+static error_t benchSendSingle(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchSend(options, run, 1, 0);
+}
+
+static error_t benchSendBatch(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchSend(options, run, SEND_BATCH, 0);
+}
+
+static error_t benchSendGso(const struct benchOptions* options, struct benchRun* run)
+{
+    return benchSend(options, run, SEND_BATCH, UDP_OFFLOAD_GSO);
+}
+
+static char* temporaryPath(const struct benchOptions* options, const char* name)
+{
+    char* path = (char*) malloc(strlen(options->directory) + strlen(name) + 32);
+    if (path != NULL)
+    {
+        sprintf(path, "%s/nfgen-bench-%d-%s", options->directory, (int) getpid(), name);
+    }
+
+    return path;
+}
+
+static error_t benchWrite(const struct benchOptions* options, struct benchRun* run)
+{
+    struct netflowExporter exporter;
+    struct outputFile output;
+    uint64_t pdus = scaled(options, WRITE_PDUS);
+
+    char* path = temporaryPath(options, "output");
+    if (path == NULL)
+    {
+        return ENOMEM;
+    }
+
+    error_t status = openOutputFile(&output, path, OUTPUT_RAW, OUTPUT_BUFFER, 0);
+    if (status != EOK)
+    {
+        free(path);
+        return status;
+    }
+
+    char buffers[SEND_BATCH][MAX_NETFLOW_PDU_SIZE];
+    char* pduPointers[SEND_BATCH];
+    size_t sizes[SEND_BATCH];
+    initializeBenchExporter(options, &exporter);
+    uint64_t now = wallClockTime();
+    for (unsigned int i = 0; i < SEND_BATCH; i++)
+    {
+        pduPointers[i] = buffers[i];
+        sizes[i] = makeRandomNetflowPacket(buffers[i], &exporter, MAX_NETFLOW_RECORDS, now);
+    }
+
+    /* Until the data are on tmpfs, not just queued */
+    uint64_t start = monotonicTime();
+    for (uint64_t i = 0; i < pdus; i += SEND_BATCH)
+    {
+        run->pdus += writeToOutputFile(&output, NULL, pduPointers, sizes, NULL, SEND_BATCH);
+    }
+    status = closeOutputFile(&output);
+    run->duration = monotonicTime() - start;
+    run->records = run->pdus * MAX_NETFLOW_RECORDS;
+    run->bytes = run->pdus * sizes[0];
+
+    unlink(path);
+    free(path);
+
+    return status;
+}
+
+/** Hosts file shared by the repetitions of benchHosts() */
+static char* hostsPath = NULL;
+
+static error_t makeHostsFile(const struct benchOptions* options)
+{
+    hostsPath = temporaryPath(options, "hosts");
+    if (hostsPath == NULL)
+    {
+        return ENOMEM;
+    }
+
+    FILE* file = fopen(hostsPath, "w");
+    if (file == NULL)
+    {
+        return errno;
+    }
+
+    /* Mostly plain addresses, some comments and small networks */
+    struct randomState random;
+    randomSeed(&random, options->seed);
+    uint64_t lines = scaled(options, HOSTS_LINES);
+    for (uint64_t i = 0; i < lines; i++)
+    {
+        uint32_t value = randomNext(&random);
+        unsigned int kind = randomBounded(&random, 100);
+
+        if (kind == 0)
+        {
+            fprintf(file, "# comment %u\n", value);
+        }
+        else if (kind == 1)
+        {
+            fprintf(file, "%u.%u.%u.0/28\n", value >> 24, (value >> 16) & 0xff, (value >> 8) & 0xff);
+        }
+        else
+        {
+            fprintf(file, "%u.%u.%u.%u\n", value >> 24, (value >> 16) & 0xff, (value >> 8) & 0xff, value & 0xff);
+        }
+    }
+
+    return fclose(file) == 0 ? EOK : errno;
+}
+
+static error_t benchHosts(const struct benchOptions* options, struct benchRun* run)
+{
+    in_addr_t* hosts = NULL;
+    size_t numberOfHosts = 0;
+    struct stat fileStat;
+
+    if (hostsPath == NULL)
+    {
+        error_t status = makeHostsFile(options);
+        if (status != EOK)
+        {
+            return status;
+        }
+    }
+
+    uint64_t start = monotonicTime();
+    error_t status = readHostsFromFile(hostsPath, &hosts, &numberOfHosts);
+    run->duration = monotonicTime() - start;
+
+    run->records = numberOfHosts;
+    run->bytes = stat(hostsPath, &fileStat) == 0 ? fileStat.st_size : 0;
+    free(hosts);
+
+    return status;
+}
+
+/** Capture shared by the repetitions of benchMeter() */
+static char* capturePath = NULL;
+
+static error_t makeCaptureFile(const struct benchOptions* options)
+{
+    capturePath = temporaryPath(options, "capture");
+    if (capturePath == NULL)
+    {
+        return ENOMEM;
+    }
+
+    FILE* file = fopen(capturePath, "w");
+    if (file == NULL)
+    {
+        return errno;
+    }
+
+    /* Classic pcap, Ethernet, native byte order */
+    uint32_t header[6] = {0xa1b2c3d4, 2 | (4 << 16), 0, 0, METER_SNAPLEN, 1};
+    fwrite(header, sizeof(header), 1, file);
+
+    struct randomState random;
+    randomSeed(&random, options->seed);
+    uint64_t packets = scaled(options, METER_PACKETS);
+    uint64_t start = 1700000000ULL * 1000000;
+
+    for (uint64_t i = 0; i < packets; i++)
+    {
+        uint64_t time = start + i * METER_SECONDS * 1000000 / packets;
+        uint32_t flow = randomBounded(&random, METER_FLOWS);
+        uint16_t length = 40 + randomBounded(&random, 1460);
+        unsigned char frame[METER_SNAPLEN] = {0};
+
+        /* Ethernet, IPv4 and TCP headers, cut off by the snap length */
+        frame[12] = 0x08;
+        frame[14] = 0x45;
+        frame[16] = length >> 8;
+        frame[17] = length & 0xff;
+        frame[22] = 64;
+        frame[23] = IPPROTO_TCP;
+        frame[26] = 10;
+        frame[27] = flow >> 16;
+        frame[28] = (flow >> 8) & 0xff;
+        frame[29] = flow & 0xff;
+        frame[30] = 192;
+        frame[31] = 168;
+        frame[34] = (1024 + flow % 60000) >> 8;
+        frame[35] = (1024 + flow % 60000) & 0xff;
+        frame[37] = 80;
+        frame[47] = 0x10;
+
+        uint32_t record[4] = {time / 1000000, time % 1000000, METER_SNAPLEN, 14 + length};
+        fwrite(record, sizeof(record), 1, file);
+        fwrite(frame, sizeof(frame), 1, file);
+    }
+
+    return fclose(file) == 0 ? EOK : errno;
+}
+
+static error_t benchMeter(const struct benchOptions* options, struct benchRun* run)
+{
+    struct pcapMeter meter;
+    struct netflowRecord records[MAX_NETFLOW_RECORDS];
+    struct stat fileStat;
+    uint32_t sysUpTime;
+
+    if (capturePath == NULL)
+    {
+        error_t status = makeCaptureFile(options);
+        if (status != EOK)
+        {
+            return status;
+        }
+    }
+
+    /* Read through the page cache, the way a second pass over a capture is */
+    uint64_t start = monotonicTime();
+    error_t status = openMeter(&meter, capturePath, CACHE_SIZE, METER_ACTIVE_TIMEOUT, METER_INACTIVE_TIMEOUT);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    while (takeMeteredRecords(&meter, records, MAX_NETFLOW_RECORDS, &sysUpTime) > 0)
+    {
+        run->pdus++;
+    }
+    run->duration = monotonicTime() - start;
+
+    run->records = meter.statistics.packets;
+    run->bytes = stat(capturePath, &fileStat) == 0 ? fileStat.st_size : 0;
+    status = meter.error;
+    closeMeter(&meter);
+
+    return status;
+}
+
+static const struct benchmark benchmarks[] =
+{
+    { "netflow_v5_random",    benchV5Random },
+    { "netflow_v5_30_flows",  benchV5Full },
+    { "netflow_v5_realistic", benchV5Realistic },
+    { "netflow_v5_simulated", benchV5Simulated },
+    { "netflow_v5_serialize_scalar", benchSerializeScalar },
+    { "netflow_v5_serialize", benchSerializeFastest },
+    { "netflow_v9_full",      benchV9Full },
+    { "ipfix_basic",          benchIpfixBasic },
+    { "ipfix_custom",         benchIpfixCustom },
+    { "ipfix_simulated_jumbo", benchIpfixSimulated },
+    { "netflow_v9_full6",     benchV9Full6 },
+    { "udp_send",             benchSendSingle },
+    { "udp_send_batch_32",    benchSendBatch },
+    { "udp_send_gso_32",      benchSendGso },
+    { "output_write",         benchWrite },
+    { "hosts_load",           benchHosts },
+    { "pcap_meter",           benchMeter },
+};
+
+#define NUMBER_OF_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static int compareDurations(const void* a, const void* b)
+{
+    uint64_t x = ((const struct benchRun*) a)->duration;
+    uint64_t y = ((const struct benchRun*) b)->duration;
+
+    return (x > y) - (x < y);
+}
+
+static double perSecond(uint64_t count, uint64_t duration)
+{
+    return duration > 0 ? count * 1e9 / duration : 0;
+}
+
+static void printResult(FILE* file, const struct benchmark* benchmark, struct benchRun* runs,
+                        unsigned int repetitions, int last)
+{
+    /* All repetitions do the same work, order them by time */
+    qsort(runs, repetitions, sizeof(struct benchRun), compareDurations);
+    const struct benchRun* median = &runs[repetitions / 2];
+
+    fprintf(file, "    {\"name\": \"%s\", \"pdus\": %llu, \"records\": %llu, \"bytes\": %llu,\n",
+            benchmark->name, (unsigned long long) median->pdus,
+            (unsigned long long) median->records, (unsigned long long) median->bytes);
+    fprintf(file, "     \"median_ns\": %llu, \"min_ns\": %llu, \"max_ns\": %llu,\n",
+            (unsigned long long) median->duration, (unsigned long long) runs[0].duration,
+            (unsigned long long) runs[repetitions - 1].duration);
+    fprintf(file, "     \"pdus_per_second\": %.0f, \"records_per_second\": %.0f, \"mbytes_per_second\": %.1f, "
+                  "\"ns_per_record\": %.2f}%s\n",
+            perSecond(median->pdus, median->duration), perSecond(median->records, median->duration),
+            perSecond(median->bytes, median->duration) / 1e6,
+            median->records > 0 ? (double) median->duration / median->records : 0,
+            last ? "" : ",");
+}
+
+static void usage(int exitCode)
+{
+    fprintf(stderr, "Usage: nfgen-bench [-s seed] [-r repetitions] [-n scale] [-d directory] [-o path] [name ...]\n");
+    fprintf(stderr, "  -s generator seed (default %i)\n", DEFAULT_SEED);
+    fprintf(stderr, "  -r repetitions of every benchmark, the median is reported (default %i)\n", DEFAULT_REPETITIONS);
+    fprintf(stderr, "  -n work multiplier (default 1)\n");
+    fprintf(stderr, "  -d directory for temporary files, preferably tmpfs (default %s)\n", DEFAULT_DIRECTORY);
+    fprintf(stderr, "  -o JSON results file (default stdout)\n");
+    fprintf(stderr, "  name run only the named benchmarks:\n");
+    for (unsigned int i = 0; i < NUMBER_OF_BENCHMARKS; i++)
+    {
+        fprintf(stderr, "       %s\n", benchmarks[i].name);
+    }
+
+    exit(exitCode);
+}
+
+static int selected(int argc, char** argv, const char* name)
+{
+    if (optind >= argc)
+    {
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct benchOptions options;
+    options.seed        = DEFAULT_SEED;
+    options.repetitions = DEFAULT_REPETITIONS;
+    options.scale       = 1;
+    options.directory   = DEFAULT_DIRECTORY;
+    options.outputPath  = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:r:n:d:o:h")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            options.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            options.repetitions = atoi(optarg);
+            if (options.repetitions < 1 || options.repetitions > MAX_REPETITIONS)
+            {
+                printError(EINVAL, "Invalid number of repetitions");
+                usage(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            options.scale = atof(optarg);
+            if (options.scale <= 0)
+            {
+                printError(EINVAL, "Invalid scale");
+                usage(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            options.directory = optarg;
+            break;
+        case 'o':
+            options.outputPath = optarg;
+            break;
+        case 'h':
+            usage(EXIT_SUCCESS);
+            break;
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        unsigned int b = 0;
+        while (b < NUMBER_OF_BENCHMARKS && strcmp(argv[i], benchmarks[b].name) != 0)
+        {
+            b++;
+        }
+
+        if (b == NUMBER_OF_BENCHMARKS)
+        {
+            printError(EINVAL, "Unknown benchmark");
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    FILE* file = stdout;
+    if (options.outputPath != NULL && (file = fopen(options.outputPath, "w")) == NULL)
+    {
+        printError(errno, "Unable to open the results file");
+        exit(EXIT_FAILURE);
+    }
+
+    struct benchRun runs[MAX_REPETITIONS];
+    unsigned int remaining = 0;
+    for (unsigned int b = 0; b < NUMBER_OF_BENCHMARKS; b++)
+    {
+        remaining += selected(argc, argv, benchmarks[b].name);
+    }
+
+    fprintf(file, "{\n  \"seed\": %llu, \"repetitions\": %u, \"scale\": %g, \"time\": %lld,\n  \"benchmarks\": [\n",
+            (unsigned long long) options.seed, options.repetitions, options.scale, (long long) time(NULL));
+
+    int status = EXIT_SUCCESS;
+    for (unsigned int b = 0; b < NUMBER_OF_BENCHMARKS; b++)
+    {
+        if (!selected(argc, argv, benchmarks[b].name))
+        {
+            continue;
+        }
+
+        fprintf(stderr, "Running %s ...\n", benchmarks[b].name);
+        memset(runs, 0, sizeof(runs));
+
+        error_t error = EOK;
+        for (unsigned int r = 0; r < options.repetitions && error == EOK; r++)
+        {
+            error = benchmarks[b].function(&options, &runs[r]);
+        }
+
+        if (error != EOK)
+        {
+            printError(error, (char*) benchmarks[b].name);
+            status = EXIT_FAILURE;
+        }
+
+        printResult(file, &benchmarks[b], runs, options.repetitions, --remaining == 0);
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    if (hostsPath != NULL)
+    {
+        unlink(hostsPath);
+        free(hostsPath);
+    }
+
+    if (capturePath != NULL)
+    {
+        unlink(capturePath);
+        free(capturePath);
+    }
+
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+
+    return status;
+}
@@ -21,34 +21,382 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
-FILE* openOutputFile(char* path)
+#include <arpa/inet.h>
+
+#include "clock.h"
+
+/* Size of one write() [bytes] */
+#define CHUNK_SIZE (1 << 20)
+#define CHUNK_ALIGNMENT 4096
+
+/* Idle partial chunks are written after this long [s] */
+#define FLUSH_INTERVAL 1
+
+#define PCAP_MAGIC         0xa1b2c3d4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN       65535
+#define LINKTYPE_RAW       101  /* Raw IPv4/IPv6, no link layer header */
+
+#define PCAP_FILE_HEADER_SIZE   24
+#define PCAP_RECORD_HEADER_SIZE 16
+#define IP_HEADER_SIZE          20
+#define UDP_HEADER_SIZE         8
+#define ENCAPSULATION_SIZE (PCAP_RECORD_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE)
+
+#define IP_DONT_FRAGMENT 0x4000
+#define DEFAULT_TTL 64
+
+static error_t writeAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t result = write(fd, data, size);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        data += result;
+        size -= result;
+    }
+
+    return EOK;
+}
+
+error_t writePcapHeader(int fd)
 {
-    FILE* file = fopen(path, "w+b");
+    /* Host byte order, readers tell it from the magic number */
+    uint32_t header[PCAP_FILE_HEADER_SIZE / sizeof(uint32_t)];
+    uint16_t* version = (uint16_t*) &header[1];
 
-    if (file == NULL)
+    header[0]  = PCAP_MAGIC;
+    version[0] = PCAP_VERSION_MAJOR;
+    version[1] = PCAP_VERSION_MINOR;
+    header[2]  = 0;             /* GMT offset */
+    header[3]  = 0;             /* Time stamp accuracy */
+    header[4]  = PCAP_SNAPLEN;
+    header[5]  = LINKTYPE_RAW;
+
+    return writeAll(fd, (const char*) header, sizeof(header));
+}
+
+static uint16_t ipChecksum(const unsigned char* header)
+{
+    uint32_t sum = 0;
+
+    for (unsigned int i = 0; i < IP_HEADER_SIZE; i += 2)
     {
-        perror("Unable to write to output file.");
-        exit(EXIT_FAILURE);
+        sum += (header[i] << 8) | header[i + 1];
     }
 
-    return file;
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum;
 }
 
-void writeToOutputFile(FILE* file, void* datagram, size_t datagramSize)
+/** Store pcap record header and IPv4/UDP headers of a datagram */
+static void writeEncapsulation(unsigned char* p, uint64_t time, uint16_t ipId,
+                               const struct udpEndpoints* endpoints, size_t datagramSize)
 {
-    fwrite(datagram, sizeof(char), datagramSize, file);
-    fflush(file);
+    uint32_t capturedSize = IP_HEADER_SIZE + UDP_HEADER_SIZE + datagramSize;
+    uint32_t record[PCAP_RECORD_HEADER_SIZE / sizeof(uint32_t)];
+
+    record[0] = time / NSECS_PER_SEC;
+    record[1] = time % NSECS_PER_SEC / 1000;
+    record[2] = capturedSize;
+    record[3] = capturedSize;
+    memcpy(p, record, sizeof(record));
+    p += sizeof(record);
+
+    uint16_t fields16[] = {
+        htons(0x4500),                     /* Version 4, 5 words, TOS 0 */
+        htons(capturedSize),
+        htons(ipId),
+        htons(IP_DONT_FRAGMENT),
+        htons((DEFAULT_TTL << 8) | IPPROTO_UDP),
+        0                                  /* Checksum */
+    };
+    memcpy(p, fields16, sizeof(fields16));
+    memcpy(p + 12, &endpoints->source, 4);
+    memcpy(p + 16, &endpoints->destination, 4);
+
+    uint16_t checksum = htons(ipChecksum(p));
+    memcpy(p + 10, &checksum, 2);
+    p += IP_HEADER_SIZE;
+
+    uint16_t udp[] = {
+        endpoints->sourcePort,
+        endpoints->destinationPort,
+        htons(UDP_HEADER_SIZE + datagramSize),
+        0                                  /* No checksum */
+    };
+    memcpy(p, udp, sizeof(udp));
+}
 
-    if (ferror(file))
+size_t outputRecordSize(int format, size_t datagramSize)
+{
+    return datagramSize + (format == OUTPUT_PCAP ? ENCAPSULATION_SIZE : 0);
+}
+
+size_t formatOutputRecord(char* record, int format, const struct udpEndpoints* endpoints,
+                          const char* datagram, size_t size, uint64_t time, uint16_t ipId)
+{
+    size_t used = 0;
+
+    if (format == OUTPUT_PCAP)
     {
-        perror("Cannot write into output file.");
-        exit(EXIT_FAILURE);
+        writeEncapsulation((unsigned char*) record, time, ipId, endpoints, size);
+        used = ENCAPSULATION_SIZE;
     }
+    memcpy(record + used, datagram, size);
+
+    return used + size;
 }
 
-void closeOutputFile(FILE* file)
+static void queueCurrentChunk(struct outputFile* output)
 {
-    fclose(file);
+    if (output->current >= 0 && output->chunks[output->current].used > 0)
+    {
+        unsigned int tail = (output->fullHead + output->fullCount) % output->numberOfChunks;
+        output->fullChunks[tail] = output->current;
+        output->fullCount++;
+        output->current = -1;
+
+        pthread_cond_signal(&output->ready);
+    }
+}
+
+static void* runWriter(void* argument)
+{
+    struct outputFile* output = (struct outputFile*) argument;
+
+    pthread_mutex_lock(&output->lock);
+    while (1)
+    {
+        while (output->fullCount == 0 && !output->closing)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += FLUSH_INTERVAL;
+
+            if (pthread_cond_timedwait(&output->ready, &output->lock, &deadline) == ETIMEDOUT)
+            {
+                queueCurrentChunk(output);
+            }
+        }
+
+        if (output->fullCount == 0)
+        {
+            break;
+        }
+
+        unsigned int index = output->fullChunks[output->fullHead];
+        output->fullHead = (output->fullHead + 1) % output->numberOfChunks;
+        output->fullCount--;
+        pthread_mutex_unlock(&output->lock);
+
+        struct outputChunk* chunk = &output->chunks[index];
+        error_t status = EOK;
+        if (output->error == EOK)
+        {
+            status = writeAll(output->fd, chunk->data, chunk->used);
+        }
+        chunk->used = 0;
+
+        pthread_mutex_lock(&output->lock);
+        if (status != EOK && output->error == EOK)
+        {
+            output->error = status;
+            printError(status, "Cannot write into output file");
+        }
+        output->freeChunks[output->freeCount++] = index;
+        pthread_cond_broadcast(&output->freed);
+    }
+    pthread_mutex_unlock(&output->lock);
+
+    return NULL;
 }
 
+static void freeChunks(struct outputFile* output)
+{
+    if (output->chunks != NULL)
+    {
+        for (unsigned int i = 0; i < output->numberOfChunks; i++)
+        {
+            free(output->chunks[i].data);
+        }
+    }
+
+    free(output->chunks);
+    free(output->freeChunks);
+    free(output->fullChunks);
+}
+
+error_t openOutputFile(struct outputFile* output, const char* path, int format, size_t bufferSize,
+                       int lossless)
+{
+    memset(output, 0, sizeof(*output));
+
+    output->format   = format;
+    output->lossless = lossless;
+    output->current = -1;
+    output->error   = EOK;
+
+    output->numberOfChunks = bufferSize / CHUNK_SIZE;
+    if (output->numberOfChunks < 2)
+    {
+        output->numberOfChunks = 2;
+    }
+
+    output->chunks     = (struct outputChunk*) calloc(output->numberOfChunks, sizeof(struct outputChunk));
+    output->freeChunks = (unsigned int*) calloc(output->numberOfChunks, sizeof(unsigned int));
+    output->fullChunks = (unsigned int*) calloc(output->numberOfChunks, sizeof(unsigned int));
+    if (output->chunks == NULL || output->freeChunks == NULL || output->fullChunks == NULL)
+    {
+        freeChunks(output);
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < output->numberOfChunks; i++)
+    {
+        void* data;
+        if (posix_memalign(&data, CHUNK_ALIGNMENT, CHUNK_SIZE) != 0)
+        {
+            freeChunks(output);
+            return ENOMEM;
+        }
+
+        output->chunks[i].data = (char*) data;
+        output->freeChunks[output->freeCount++] = i;
+    }
+
+    output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output->fd < 0)
+    {
+        error_t status = errno;
+        freeChunks(output);
+        return status;
+    }
+
+    if (format == OUTPUT_PCAP)
+    {
+        error_t status = writePcapHeader(output->fd);
+        if (status != EOK)
+        {
+            close(output->fd);
+            freeChunks(output);
+            return status;
+        }
+    }
+
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->ready, NULL);
+    pthread_cond_init(&output->freed, NULL);
+
+    error_t status = pthread_create(&output->thread, NULL, runWriter, output);
+    if (status != 0)
+    {
+        pthread_mutex_destroy(&output->lock);
+        pthread_cond_destroy(&output->ready);
+        pthread_cond_destroy(&output->freed);
+        close(output->fd);
+        freeChunks(output);
+        return status;
+    }
+
+    return EOK;
+}
+
+unsigned int writeToOutputFile(struct outputFile* output, const struct udpEndpoints* endpoints,
+                               char* const* datagrams, const size_t* sizes, const uint64_t* times,
+                               unsigned int count)
+{
+    unsigned int queued = 0;
+    uint64_t now = 0;
+
+    if (output->format == OUTPUT_PCAP)
+    {
+        now = wallClockTime();
+    }
+
+    pthread_mutex_lock(&output->lock);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        size_t recordSize = outputRecordSize(output->format, sizes[i]);
+
+        if (output->current >= 0 && output->chunks[output->current].used + recordSize > CHUNK_SIZE)
+        {
+            queueCurrentChunk(output);
+        }
+
+        if (output->current < 0)
+        {
+            while (output->lossless && output->freeCount == 0)
+            {
+                pthread_cond_wait(&output->freed, &output->lock);
+            }
+
+            if (output->freeCount == 0)
+            {
+                /* Read by the stats reporter without the lock */
+                __atomic_store_n(&output->dropped, output->dropped + count - i, __ATOMIC_RELAXED);
+                break;
+            }
+            output->current = output->freeChunks[--output->freeCount];
+        }
+
+        struct outputChunk* chunk = &output->chunks[output->current];
+        chunk->used += formatOutputRecord(chunk->data + chunk->used, output->format, endpoints,
+                                          datagrams[i], sizes[i], times != NULL && times[i] != 0 ? times[i] : now,
+                                          output->ipId++);
+
+        queued++;
+    }
+    output->written += queued;
+    pthread_mutex_unlock(&output->lock);
+
+    return queued;
+}
+
+error_t closeOutputFile(struct outputFile* output)
+{
+    pthread_mutex_lock(&output->lock);
+    queueCurrentChunk(output);
+    output->closing = 1;
+    pthread_cond_signal(&output->ready);
+    pthread_mutex_unlock(&output->lock);
+
+    pthread_join(output->thread, NULL);
+
+    if (output->dropped > 0)
+    {
+        fprintf(stderr, "Output file: %llu of %llu datagrams dropped, the disk was too slow.\n",
+                (unsigned long long) output->dropped,
+                (unsigned long long) (output->written + output->dropped));
+    }
+
+    if (close(output->fd) != 0 && output->error == EOK)
+    {
+        output->error = errno;
+    }
+
+    pthread_mutex_destroy(&output->lock);
+    pthread_cond_destroy(&output->ready);
+    pthread_cond_destroy(&output->freed);
+    freeChunks(output);
+
+    return output->error;
+}
@@ -20,48 +20,161 @@
 #ifndef _BINARYOUTPUT__H_
 #define _BINARYOUTPUT__H_
 
-#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+
+/* Output file formats */
+#define OUTPUT_RAW  0  /* PDUs stored back to back */
+#define OUTPUT_PCAP 1  /* libpcap capture of IPv4/UDP datagrams */
+
+/** Addresses of the IP/UDP headers in pcap output (network order) */
+struct udpEndpoints
+{
+    in_addr_t source;
+    in_addr_t destination;
+    in_port_t sourcePort;
+    in_port_t destinationPort;
+};
+
+/** Part of the output buffer handed over to the writer thread */
+struct outputChunk
+{
+    char*  data;
+    size_t used;
+};
+
+/** Output file written by a background thread
+ *
+ * Senders copy datagrams into large aligned chunks. Full
+ * chunks are queued for the writer thread, which stores
+ * them with a single write(). When the writer falls
+ * behind and no chunk is free, datagrams are dropped
+ * (and counted) instead of blocking the senders, unless
+ * the file is lossless.
+ *
+ * A partially filled chunk is handed over after it sat
+ * idle for a second, so the file keeps up at low rates.
+ */
+struct outputFile
+{
+    int          fd;
+    int          format;
+    pthread_t    thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;     /* Signals the writer thread */
+    pthread_cond_t  freed;     /* Signals lossless senders */
+
+    struct outputChunk* chunks;
+    unsigned int  numberOfChunks;
+    unsigned int* freeChunks;  /* Stack of free chunk indices */
+    unsigned int  freeCount;
+    unsigned int* fullChunks;  /* Queue of chunks to be written */
+    unsigned int  fullHead;
+    unsigned int  fullCount;
+    int           current;     /* Chunk being filled, -1 if none */
+    int           closing;
+    int           lossless;    /* Wait for a free chunk instead of dropping */
+    error_t       error;       /* First write error, data after it are discarded */
+
+    uint16_t      ipId;        /* Next IP identification (pcap) */
+    uint64_t      written;     /* Datagrams queued */
+    uint64_t      dropped;     /* Datagrams dropped for lack of buffer */
+};
+
+/**
+ * Open output file and start the writer thread
+ *
+ * The file is created or truncated. For pcap output, the
+ * file header is written right away.
+ *
+ * @param[out] output     Output file to be initialized
+ * @param[in]  path       Absolute/relative file path
+ * @param[in]  format     OUTPUT_RAW or OUTPUT_PCAP
+ * @param[in]  bufferSize Total size of the chunks [bytes]
+ * @param[in]  lossless   Whether senders wait for the disk instead of dropping
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t openOutputFile(struct outputFile* output, const char* path, int format, size_t bufferSize,
+                       int lossless);
 
 /**
- * Open output file and return the handle
+ * Queue datagrams for writing
  *
- * The file is open in binary mode "w+b". It calls
- * exit() on error.
+ * Copies \c count datagrams to the output buffer. It waits
+ * for the disk only if the file is lossless. Thread safe.
  *
- * TODO
- *   Calling exit is a bad thing. Only main module should
- *   be able to control the application runtime.
+ * @param[in,out] output    Open output file (@see openOutputFile())
+ * @param[in]     endpoints IP/UDP addresses for pcap output, may be
+ *                          NULL for raw output
+ * @param[in]     datagrams Data to be stored into the file
+ * @param[in]     sizes     Number of bytes of each datagram
+ * @param[in]     times     pcap time stamp of each datagram [ns since the epoch], \
+ *                          NULL (or 0) for the current time
+ * @param[in]     count     Number of datagrams
  *
- * @param[in] path Absolute/relative file path
- * @return Open file handle
+ * @return Number of datagrams queued, the rest was dropped
  */
-FILE* openOutputFile(char* path);
+unsigned int writeToOutputFile(struct outputFile* output, const struct udpEndpoints* endpoints,
+                               char* const* datagrams, const size_t* sizes, const uint64_t* times,
+                               unsigned int count);
 
 /**
- * Write datagram into file
+ * Write out everything queued and close the file
+ *
+ * Reports the number of dropped datagrams on stderr.
+ *
+ * @param[in,out] output Open output file
  *
- * Writes \c datagramSize bytes from \c datagram buffer
- * into \c file and flushes the stream.
+ * @return EOK on success, the first write error otherwise
+ */
+error_t closeOutputFile(struct outputFile* output);
+
+/**
+ * Write the pcap file header
  *
- * It calls exit() upon error.
- * TODO Fix that.
+ * Files written without struct outputFile start with it
+ * (@see formatOutputRecord()).
  *
- * @param[in] file         Open file (@see openOutputFile())
- * @param[in] datagram     Data to be stored into the file
- * @param[in] datagramSize Number of bytes to write
+ * @param[in] fd File descriptor positioned at the start of the file
  *
- * @return void
+ * @return EOK on success, errno code otherwise
  */
-void writeToOutputFile(FILE* file, void* datagram, size_t datagramSize);
+error_t writePcapHeader(int fd);
 
 /**
- * Close open file handle
- * @param[in] file Open file
+ * Bytes taken by a datagram in a file of \c format
+ *
+ * @param[in] format       OUTPUT_RAW or OUTPUT_PCAP
+ * @param[in] datagramSize Size of the datagram
  *
- * @return void
+ * @return Size of the stored record
  */
-void closeOutputFile(FILE* file);
+size_t outputRecordSize(int format, size_t datagramSize);
 
-#endif
+/**
+ * Store a datagram as it appears in a file of \c format
+ *
+ * pcap records get the record header and the IP/UDP headers
+ * in front of the datagram.
+ *
+ * @param[out] record    Buffer of at least outputRecordSize() bytes
+ * @param[in]  format    OUTPUT_RAW or OUTPUT_PCAP
+ * @param[in]  endpoints IP/UDP addresses, may be NULL for raw output
+ * @param[in]  datagram  Data of the datagram
+ * @param[in]  size      Size of the datagram
+ * @param[in]  time      pcap time stamp [ns since the epoch]
+ * @param[in]  ipId      IP identification
+ *
+ * @return Number of bytes stored in \c record
+ */
+size_t formatOutputRecord(char* record, int format, const struct udpEndpoints* endpoints,
+                          const char* datagram, size_t size, uint64_t time, uint16_t ipId);
 
+#endif
 
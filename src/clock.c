@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <time.h>
+#include <errno.h>
+
+#include "clock.h"
+
+uint64_t monotonicTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * NSECS_PER_SEC + now.tv_nsec;
+}
+
+uint64_t wallClockTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t) now.tv_sec * NSECS_PER_SEC + now.tv_nsec;
+}
+
+void sleepUntil(uint64_t when)
+{
+    struct timespec request;
+    request.tv_sec  = when / NSECS_PER_SEC;
+    request.tv_nsec = when % NSECS_PER_SEC;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &request, NULL) == EINTR)
+    {
+        /* Interrupted by a signal, go back to sleep. */
+    }
+}
+
+void initializeClock(struct virtualClock* clock, uint64_t start, int simulated)
+{
+    uint64_t monotonic = monotonicTime();
+
+    clock->now       = start != 0 ? start : wallClockTime();
+    clock->offset    = (int64_t) (clock->now - monotonic);
+    clock->simulated = simulated;
+}
+
+void clockSleepUntil(struct virtualClock* clock, uint64_t when)
+{
+    if (clock->simulated)
+    {
+        if (when > clock->now)
+        {
+            clock->now = when;
+        }
+        return;
+    }
+
+    if (when > clock->now)
+    {
+        sleepUntil(when - clock->offset);
+    }
+    clockUpdate(clock);
+}
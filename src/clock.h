@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _CLOCK__H_
+#define _CLOCK__H_
+
+#include <stdint.h>
+
+#define NSECS_PER_SEC  1000000000ULL
+#define NSECS_PER_MSEC 1000000ULL
+
+/** Time source of the generated time stamps
+ *
+ * A real clock is CLOCK_MONOTONIC shifted to wall-clock
+ * time (or to any other start time) once, when the clock
+ * is initialized. The time is read once per clockUpdate()
+ * and cached, so generating a PDU doesn't cost a system
+ * call, and time stamps don't jump when NTP steps the
+ * system clock.
+ *
+ * A simulated clock stands still until it's moved by
+ * clockSleepUntil(), so the generator can
+ * produce hours of traffic with correct time stamps as fast
+ * as the CPU allows.
+ */
+struct virtualClock
+{
+    uint64_t now;       /* Cached time [ns since the epoch] */
+    int64_t  offset;    /* Clock time - monotonic time [ns] */
+    int      simulated;
+};
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds
+ *
+ * @return Monotonic time in nanoseconds
+ */
+uint64_t monotonicTime(void);
+
+/**
+ * Current CLOCK_REALTIME time in nanoseconds
+ *
+ * @return Nanoseconds since the epoch
+ */
+uint64_t wallClockTime(void);
+
+/**
+ * Sleep until an absolute CLOCK_MONOTONIC time
+ *
+ * Signals don't cut the sleep short.
+ *
+ * @param[in] when Deadline [ns] (@see monotonicTime())
+ *
+ * @return void
+ */
+void sleepUntil(uint64_t when);
+
+/**
+ * Initialize clock
+ *
+ * @param[out] clock     Clock to be initialized
+ * @param[in]  start     Current time of the clock [ns since the epoch], \
+ *                       0 for the wall-clock time
+ * @param[in]  simulated Whether the clock is simulated
+ *
+ * @return void
+ */
+void initializeClock(struct virtualClock* clock, uint64_t start, int simulated);
+
+/**
+ * Read the time source
+ *
+ * Simulated clocks don't change.
+ *
+ * @param[in,out] clock Initialized clock
+ *
+ * @return Current time [ns since the epoch]
+ */
+static inline uint64_t clockUpdate(struct virtualClock* clock)
+{
+    if (!clock->simulated)
+    {
+        clock->now = monotonicTime() + clock->offset;
+    }
+
+    return clock->now;
+}
+
+/**
+ * Time of the last clockUpdate()
+ *
+ * @param[in] clock Initialized clock
+ *
+ * @return Cached time [ns since the epoch]
+ */
+static inline uint64_t clockNow(const struct virtualClock* clock)
+{
+    return clock->now;
+}
+
+/**
+ * Wait until the clock shows \c when
+ *
+ * A real clock sleeps, a simulated one jumps to \c when.
+ *
+ * @param[in,out] clock Initialized clock
+ * @param[in]     when  Time [ns since the epoch]
+ *
+ * @return void
+ */
+void clockSleepUntil(struct virtualClock* clock, uint64_t when);
+
+#endif
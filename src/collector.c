@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "collector.h"
+#include "pacing.h"
+#include "template.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+#define MAX_DATAGRAM_SIZE 65536
+#define RECEIVE_BUFFER    (64 << 20)
+#define RECEIVE_TIMEOUT   100000  /* [us], how late a report may be */
+
+#define V5_HEADER_SIZE    24
+#define V5_RECORD_SIZE    48
+#define V9_HEADER_SIZE    20
+#define IPFIX_HEADER_SIZE 16
+
+/* Sequence numbers this far ahead are a restart, not a loss */
+#define RESTART_DISTANCE (1U << 30)
+
+static inline uint16_t get16(const unsigned char* p)
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohs(value);
+}
+
+static inline uint32_t get32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+error_t initializeCollector(struct collector* collector, in_addr_t address, in_port_t port,
+                            unsigned int batchSize, uint64_t interval)
+{
+    memset(collector, 0, sizeof(*collector));
+    collector->batchSize = batchSize;
+    collector->interval  = interval;
+
+    collector->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (collector->socket < 0)
+    {
+        return errno;
+    }
+
+    /* Make room for bursts, beyond rmem_max if we may */
+    int size = RECEIVE_BUFFER;
+    if (setsockopt(collector->socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0)
+    {
+        setsockopt(collector->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    int enable = 1;
+    setsockopt(collector->socket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+
+    struct timeval timeout = { 0, RECEIVE_TIMEOUT };
+    setsockopt(collector->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in localAddress;
+    memset(&localAddress, 0, sizeof(localAddress));
+    localAddress.sin_family = AF_INET;
+    localAddress.sin_addr.s_addr = address;
+    localAddress.sin_port = htons(port);
+
+    if (bind(collector->socket, (const struct sockaddr *) &localAddress, sizeof(localAddress)) != 0)
+    {
+        error_t status = errno;
+        close(collector->socket);
+        return status;
+    }
+
+    return EOK;
+}
+
+/** Stream of the exporter, NULL if there are too many exporters */
+static struct collectorStream* findStream(struct collector* collector, uint64_t key)
+{
+    unsigned int index = (key * 0x9e3779b97f4a7c15ULL) >> 52;  /* log2(COLLECTOR_STREAMS) bits */
+
+    for (unsigned int i = 0; i < COLLECTOR_STREAMS; i++)
+    {
+        struct collectorStream* stream = &collector->streams[(index + i) % COLLECTOR_STREAMS];
+
+        if (!stream->used || stream->key == key)
+        {
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+/** Account the sequence number of a PDU */
+static void checkSequence(struct collector* collector, uint64_t key, uint32_t sequence,
+                          uint32_t increment, uint32_t flows)
+{
+    struct collectorCounters* counters = &collector->counters;
+    struct collectorStream* stream = findStream(collector, key);
+
+    counters->sequenced += increment;
+
+    if (stream == NULL)
+    {
+        return;
+    }
+
+    if (!stream->used)
+    {
+        stream->used     = 1;
+        stream->key      = key;
+        stream->expected = sequence;
+    }
+
+    stream->pdus++;
+    stream->flows += flows;
+
+    uint32_t ahead = sequence - stream->expected;
+    if (ahead == 0)
+    {
+        stream->expected = sequence + increment;
+    }
+    else if (ahead < RESTART_DISTANCE)
+    {
+        stream->lost   += ahead;
+        counters->lost += ahead;
+        stream->expected = sequence + increment;
+    }
+    else if (stream->expected - sequence <= stream->lost)
+    {
+        /* Late PDU from within a gap, it was counted as lost */
+        uint32_t late = increment < stream->lost ? increment : stream->lost;
+        stream->lost   -= late;
+        counters->lost -= late;
+        stream->reordered++;
+        counters->reordered++;
+    }
+    else
+    {
+        /* Behind any gap (e.g. a new run starting at 0) or far ahead */
+        stream->expected = sequence + increment;
+        stream->restarts++;
+        counters->restarts++;
+    }
+}
+
+static void accountPdu(struct collector* collector, const unsigned char* pdu, size_t size)
+{
+    struct collectorCounters* counters = &collector->counters;
+    uint16_t version = size >= IPFIX_HEADER_SIZE ? get16(pdu) : 0;
+
+    counters->bytes += size;
+
+    if (version == NETFLOW_V5 && size >= V5_HEADER_SIZE &&
+        size >= V5_HEADER_SIZE + (size_t) get16(pdu + 2) * V5_RECORD_SIZE)
+    {
+        uint16_t count = get16(pdu + 2);
+        counters->pdus++;
+        counters->flows += count;
+        checkSequence(collector, ((uint64_t) NETFLOW_V5 << 32) | get16(pdu + 20), get32(pdu + 16), count, count);
+    }
+    else if (version == NETFLOW_V9 && size >= V9_HEADER_SIZE)
+    {
+        /* The count includes template records */
+        uint16_t count = get16(pdu + 2);
+        counters->pdus++;
+        counters->flows += count;
+        checkSequence(collector, ((uint64_t) NETFLOW_V9 << 32) | get32(pdu + 16), get32(pdu + 12), 1, count);
+    }
+    else if (version == IPFIX && get16(pdu + 2) == size)
+    {
+        /* Counting IPFIX records would need the templates */
+        counters->pdus++;
+    }
+    else
+    {
+        counters->malformed++;
+    }
+}
+
+static double lossPercentage(uint64_t lost, uint64_t sequenced)
+{
+    return lost + sequenced > 0 ? 100.0 * lost / (lost + sequenced) : 0;
+}
+
+static void printInterval(struct collector* collector, uint64_t now)
+{
+    const struct collectorCounters* counters = &collector->counters;
+    const struct collectorCounters* previous = &collector->previous;
+    double elapsed = (double) (now - collector->previousTime) / NSECS_PER_SEC;
+
+    /* Late PDUs may take back more than was lost in this interval */
+    int64_t lost = counters->lost - previous->lost;
+    uint64_t sequenced = counters->sequenced - previous->sequenced;
+
+    fprintf(stderr, "Received: %.0f PDUs/s, %.0f flows/s, %.1f Mbit/s, lost %lld (%.3f%%), "
+                    "kernel drops %llu, malformed %llu\n",
+            (counters->pdus - previous->pdus) / elapsed,
+            (counters->flows - previous->flows) / elapsed,
+            (counters->bytes - previous->bytes) * 8 / elapsed / 1e6,
+            (long long) lost, lost > 0 ? lossPercentage(lost, sequenced) : 0.0,
+            (unsigned long long) (counters->kernelDrops - previous->kernelDrops),
+            (unsigned long long) (counters->malformed - previous->malformed));
+
+    collector->previous     = *counters;
+    collector->previousTime = now;
+}
+
+error_t runCollector(struct collector* collector)
+{
+    unsigned int batchSize = collector->batchSize;
+    size_t controlSize = CMSG_SPACE(sizeof(uint32_t));
+
+    struct mmsghdr* messages = (struct mmsghdr*) calloc(batchSize, sizeof(struct mmsghdr));
+    struct iovec* vectors = (struct iovec*) calloc(batchSize, sizeof(struct iovec));
+    unsigned char* buffers = (unsigned char*) malloc((size_t) batchSize * MAX_DATAGRAM_SIZE);
+    unsigned char* controls = (unsigned char*) calloc(batchSize, controlSize);
+    if (messages == NULL || vectors == NULL || buffers == NULL || controls == NULL)
+    {
+        free(messages);
+        free(vectors);
+        free(buffers);
+        free(controls);
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        vectors[i].iov_base = buffers + (size_t) i * MAX_DATAGRAM_SIZE;
+        vectors[i].iov_len  = MAX_DATAGRAM_SIZE;
+        messages[i].msg_hdr.msg_iov    = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    collector->previousTime = monotonicTime();
+
+    error_t status = EOK;
+    while (!collector->stop)
+    {
+        for (unsigned int i = 0; i < batchSize; i++)
+        {
+            messages[i].msg_hdr.msg_control    = controls + i * controlSize;
+            messages[i].msg_hdr.msg_controllen = controlSize;
+        }
+
+        int received = recvmmsg(collector->socket, messages, batchSize, MSG_WAITFORONE, NULL);
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            status = errno;
+            break;
+        }
+
+        for (int i = 0; i < received; i++)
+        {
+            accountPdu(collector, (const unsigned char*) vectors[i].iov_base, messages[i].msg_len);
+
+            /* Total drops of the socket at the time the datagram was queued */
+            struct cmsghdr* header;
+            for (header = CMSG_FIRSTHDR(&messages[i].msg_hdr); header != NULL;
+                 header = CMSG_NXTHDR(&messages[i].msg_hdr, header))
+            {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SO_RXQ_OVFL)
+                {
+                    uint32_t drops;
+                    memcpy(&drops, CMSG_DATA(header), sizeof(drops));
+                    collector->counters.kernelDrops = drops;
+                }
+            }
+        }
+
+        if (collector->interval > 0)
+        {
+            uint64_t now = monotonicTime();
+            if (now - collector->previousTime >= collector->interval)
+            {
+                printInterval(collector, now);
+            }
+        }
+    }
+
+    free(messages);
+    free(vectors);
+    free(buffers);
+    free(controls);
+
+    return status;
+}
+
+void stopCollector(struct collector* collector)
+{
+    collector->stop = 1;
+}
+
+void collectorReport(const struct collector* collector, FILE* stream)
+{
+    const struct collectorCounters* counters = &collector->counters;
+
+    fprintf(stream, "Total: %llu PDUs, %llu flows, %llu bytes, lost %llu (%.3f%%), reordered %llu, "
+                    "restarts %llu, kernel drops %llu, malformed %llu\n",
+            (unsigned long long) counters->pdus, (unsigned long long) counters->flows,
+            (unsigned long long) counters->bytes, (unsigned long long) counters->lost,
+            lossPercentage(counters->lost, counters->sequenced), (unsigned long long) counters->reordered,
+            (unsigned long long) counters->restarts, (unsigned long long) counters->kernelDrops, (unsigned long long) counters->malformed);
+
+    for (unsigned int i = 0; i < COLLECTOR_STREAMS; i++)
+    {
+        const struct collectorStream* exporter = &collector->streams[i];
+        if (!exporter->used)
+        {
+            continue;
+        }
+
+        uint32_t version = exporter->key >> 32;
+        uint32_t id = (uint32_t) exporter->key;
+        if (version == NETFLOW_V5)
+        {
+            fprintf(stream, "  v5 engine %u/%u: ", id >> 8, id & 0xff);
+        }
+        else
+        {
+            fprintf(stream, "  v9 source %u: ", id);
+        }
+
+        fprintf(stream, "%llu PDUs, %llu flows, lost %llu %s, reordered %llu, restarts %llu\n",
+                (unsigned long long) exporter->pdus, (unsigned long long) exporter->flows,
+                (unsigned long long) exporter->lost, version == NETFLOW_V5 ? "flows" : "PDUs",
+                (unsigned long long) exporter->reordered, (unsigned long long) exporter->restarts);
+    }
+}
+
+void closeCollector(struct collector* collector)
+{
+    close(collector->socket);
+}
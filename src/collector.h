@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COLLECTOR__H_
+#define _COLLECTOR__H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+
+/* Maximum number of exporters told apart */
+#define COLLECTOR_STREAMS 4096
+
+/** Sequence tracking of one exporter
+ *
+ * NetFlow v5 sequence numbers count flows, v9 ones count
+ * PDUs. A PDU with a higher than expected number means
+ * the ones in between were lost. If they arrive later
+ * (reordering), they are taken off the loss again. A
+ * number behind by more than the loss (e.g. a new run of
+ * the exporter) or far ahead restarts the tracking.
+ */
+struct collectorStream
+{
+    uint64_t key;       /* Version, engine type and ID / source ID */
+    int      used;
+    uint32_t expected;  /* Next expected sequence number */
+    uint64_t pdus;
+    uint64_t flows;
+    uint64_t lost;      /* Flows (v5) or PDUs (v9) */
+    uint64_t reordered;
+    uint64_t restarts;
+};
+
+/** Totals of the collector */
+struct collectorCounters
+{
+    uint64_t pdus;
+    uint64_t flows;
+    uint64_t bytes;
+    uint64_t sequenced;    /* Flows (v5) and PDUs (v9) counted by sequence numbers */
+    uint64_t lost;         /* Of the same units */
+    uint64_t reordered;
+    uint64_t restarts;     /* Sequences started over */
+    uint64_t malformed;    /* Too short or unknown version */
+    uint64_t kernelDrops;  /* Dropped by the socket (full receive buffer) */
+};
+
+/** Stand-in collector
+ *
+ * Receives PDUs with recvmmsg(), parses the headers and
+ * accounts lost PDUs per exporter. Drops of the receive
+ * queue are read from SO_RXQ_OVFL.
+ */
+struct collector
+{
+    int          socket;
+    unsigned int batchSize;
+    uint64_t     interval;     /* Report interval [ns], 0 = no reports */
+    volatile sig_atomic_t stop;    /* Set by stopCollector() */
+
+    struct collectorCounters counters;
+    struct collectorCounters previous;  /* At the last report */
+    uint64_t     previousTime;
+
+    struct collectorStream streams[COLLECTOR_STREAMS];
+};
+
+/**
+ * Bind the collector socket
+ *
+ * @param[out] collector Collector to be initialized
+ * @param[in]  address   Local address to listen on
+ * @param[in]  port      Local port
+ * @param[in]  batchSize Datagrams per recvmmsg() call
+ * @param[in]  interval  Report interval [ns], 0 = no reports
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t initializeCollector(struct collector* collector, in_addr_t address, in_port_t port,
+                            unsigned int batchSize, uint64_t interval);
+
+/**
+ * Receive and account PDUs
+ *
+ * Prints the rates, losses and kernel drops of the last
+ * interval to stderr every report interval. Returns when
+ * the collector is stopped.
+ *
+ * @param[in,out] collector Initialized collector
+ *
+ * @return EOK, or errno code when receiving fails
+ */
+error_t runCollector(struct collector* collector);
+
+/**
+ * Make runCollector() return
+ *
+ * Safe to call from a signal handler, the collector
+ * notices it within the receive timeout.
+ *
+ * @param[in,out] collector Running collector
+ *
+ * @return void
+ */
+void stopCollector(struct collector* collector);
+
+/**
+ * Print the totals and the losses of every exporter
+ *
+ * @param[in] collector Collector
+ * @param[in] stream    Where to print the report
+ *
+ * @return void
+ */
+void collectorReport(const struct collector* collector, FILE* stream);
+
+/**
+ * Close the collector socket
+ *
+ * @param[in,out] collector Initialized collector
+ *
+ * @return void
+ */
+void closeCollector(struct collector* collector);
+
+#endif
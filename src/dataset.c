@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "dataset.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+
+#include "netflow.h"
+#include "random.h"
+#include "clock.h"
+#include "udp.h"
+
+/** One generator thread of the dataset */
+struct datasetThread
+{
+    struct dataset* dataset;
+    unsigned int    id;
+    pthread_t       thread;
+    error_t         status;
+};
+
+/** Size of a v5 PDU with \c numberOfFlows records */
+static inline size_t pduSize(unsigned int numberOfFlows)
+{
+    return sizeof(struct netflowHeader) + numberOfFlows * sizeof(struct netflowRecord);
+}
+
+static error_t pwriteAll(int fd, const char* data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t result = pwrite(fd, data, size, offset);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        data   += result;
+        size   -= result;
+        offset += result;
+    }
+
+    return EOK;
+}
+
+/* Thread i handles chunks i, i + threads, ..., so its stream
+   starts jumped i times ahead and moves by threads jumps. */
+static void firstStream(const struct dataset* dataset, unsigned int id, struct randomState* random)
+{
+    randomSeed(random, dataset->arguments->seed);
+    for (unsigned int i = 0; i < id; i++)
+    {
+        randomJump(random);
+    }
+}
+
+static void nextStream(const struct dataset* dataset, struct randomState* random)
+{
+    for (unsigned int i = 0; i < dataset->arguments->threads; i++)
+    {
+        randomJump(random);
+    }
+}
+
+/** The record counts are drawn first, so both passes agree on them */
+static void drawNumbersOfFlows(struct netflowExporter* exporter, unsigned int pdus, unsigned int* flows)
+{
+    for (unsigned int i = 0; i < pdus; i++)
+    {
+        flows[i] = randomNumberOfFlows(exporter);
+    }
+}
+
+static void* countChunks(void* argument)
+{
+    struct datasetThread* thread = (struct datasetThread*) argument;
+    struct dataset* dataset = thread->dataset;
+    int format = dataset->arguments->outputFormat;
+
+    unsigned int flows[DATASET_CHUNK_PDUS];
+    struct netflowExporter exporter;
+    struct randomState random;
+
+    firstStream(dataset, thread->id, &random);
+    for (uint64_t k = thread->id; k < dataset->numberOfChunks; k += dataset->arguments->threads)
+    {
+        struct datasetChunk* chunk = &dataset->chunks[k];
+
+        initializeExporter(&exporter, dataset->startTime / NSECS_PER_SEC, 0, &random);
+        drawNumbersOfFlows(&exporter, chunk->pdus, flows);
+
+        for (unsigned int i = 0; i < chunk->pdus; i++)
+        {
+            chunk->flows += flows[i];
+            chunk->size  += outputRecordSize(format, pduSize(flows[i]));
+        }
+
+        nextStream(dataset, &random);
+    }
+
+    thread->status = EOK;
+    return NULL;
+}
+
+static void* writeChunks(void* argument)
+{
+    struct datasetThread* thread = (struct datasetThread*) argument;
+    struct dataset* dataset = thread->dataset;
+    const struct cliArguments* arguments = dataset->arguments;
+
+    unsigned int flows[DATASET_CHUNK_PDUS];
+    char pdu[MAX_NETFLOW_PDU_SIZE];
+    struct netflowExporter exporter;
+    struct randomState random;
+
+    char* buffer = (char*) malloc(DATASET_CHUNK_PDUS * outputRecordSize(arguments->outputFormat,
+                                                                        MAX_NETFLOW_PDU_SIZE));
+    if (buffer == NULL)
+    {
+        thread->status = ENOMEM;
+        return NULL;
+    }
+
+    thread->status = EOK;
+    firstStream(dataset, thread->id, &random);
+    for (uint64_t k = thread->id; k < dataset->numberOfChunks && thread->status == EOK; k += arguments->threads)
+    {
+        const struct datasetChunk* chunk = &dataset->chunks[k];
+        uint64_t flowsBefore = chunk->firstFlow;
+        char* record = buffer;
+
+        initializeExporter(&exporter, dataset->startTime / NSECS_PER_SEC, 0, &random);
+        exporter.flowSequence = (uint32_t) chunk->firstFlow;
+        drawNumbersOfFlows(&exporter, chunk->pdus, flows);
+
+        for (unsigned int i = 0; i < chunk->pdus; i++)
+        {
+            uint64_t index = chunk->firstPdu + i;
+            uint64_t now = dataset->startTime +
+                           (uint64_t) ((double) (arguments->rateInFlows ? flowsBefore : index) *
+                                       NSECS_PER_SEC / arguments->rate);
+
+            size_t size = makeRandomNetflowPacket(pdu, &exporter, flows[i], now);
+            record += formatOutputRecord(record, arguments->outputFormat, &dataset->endpoints,
+                                         pdu, size, now, (uint16_t) index);
+            flowsBefore += flows[i];
+        }
+
+        thread->status = pwriteAll(dataset->fd, buffer, record - buffer, dataset->dataOffset + chunk->offset);
+
+        nextStream(dataset, &random);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/** Run \c routine in all threads, returns the first error */
+static error_t runPass(struct dataset* dataset, struct datasetThread* threads, void* (*routine)(void*))
+{
+    error_t status = EOK;
+    unsigned int started = 0;
+
+    for (; started < dataset->arguments->threads; started++)
+    {
+        threads[started].dataset = dataset;
+        threads[started].id      = started;
+        threads[started].status  = EOK;
+
+        status = pthread_create(&threads[started].thread, NULL, routine, &threads[started]);
+        if (status != 0)
+        {
+            break;
+        }
+    }
+
+    for (unsigned int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        if (status == EOK)
+        {
+            status = threads[i].status;
+        }
+    }
+
+    return status;
+}
+
+error_t generateDataset(const struct cliArguments* arguments, uint64_t startTime)
+{
+    struct dataset dataset;
+    memset(&dataset, 0, sizeof(dataset));
+
+    dataset.arguments      = arguments;
+    dataset.startTime      = startTime;
+    dataset.numberOfChunks = (arguments->generate + DATASET_CHUNK_PDUS - 1) / DATASET_CHUNK_PDUS;
+
+    /* pcap records look like datagrams sent to the first collector */
+    dataset.endpoints.destination     = arguments->address;
+    dataset.endpoints.destinationPort = htons(arguments->port);
+    dataset.endpoints.sourcePort      = htons(arguments->port);
+    error_t status = udpSourceAddress(arguments->address, arguments->port, &dataset.endpoints.source);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    dataset.chunks = (struct datasetChunk*) calloc(dataset.numberOfChunks, sizeof(struct datasetChunk));
+    struct datasetThread* threads = (struct datasetThread*) calloc(arguments->threads, sizeof(struct datasetThread));
+    if (dataset.chunks == NULL || threads == NULL)
+    {
+        free(dataset.chunks);
+        free(threads);
+        return ENOMEM;
+    }
+
+    for (uint64_t k = 0; k < dataset.numberOfChunks; k++)
+    {
+        uint64_t remaining = arguments->generate - k * DATASET_CHUNK_PDUS;
+
+        dataset.chunks[k].firstPdu = k * DATASET_CHUNK_PDUS;
+        dataset.chunks[k].pdus     = remaining < DATASET_CHUNK_PDUS ? remaining : DATASET_CHUNK_PDUS;
+    }
+
+    uint64_t generateStart = monotonicTime();
+
+    dataset.fd = open(arguments->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dataset.fd < 0)
+    {
+        status = errno;
+    }
+    else if (arguments->outputFormat == OUTPUT_PCAP)
+    {
+        status = writePcapHeader(dataset.fd);
+        dataset.dataOffset = lseek(dataset.fd, 0, SEEK_CUR);
+    }
+
+    if (status == EOK)
+    {
+        status = runPass(&dataset, threads, countChunks);
+    }
+
+    uint64_t flows = 0;
+    uint64_t size  = 0;
+    if (status == EOK)
+    {
+        for (uint64_t k = 0; k < dataset.numberOfChunks; k++)
+        {
+            dataset.chunks[k].firstFlow = flows;
+            dataset.chunks[k].offset    = size;
+            flows += dataset.chunks[k].flows;
+            size  += dataset.chunks[k].size;
+        }
+
+        /* Regions are written out of order, the file gets its final size first */
+        if (ftruncate(dataset.fd, dataset.dataOffset + size) != 0)
+        {
+            status = errno;
+        }
+    }
+
+    if (status == EOK)
+    {
+        status = runPass(&dataset, threads, writeChunks);
+    }
+
+    if (dataset.fd >= 0 && close(dataset.fd) != 0 && status == EOK)
+    {
+        status = errno;
+    }
+
+    if (status == EOK)
+    {
+        double seconds = (monotonicTime() - generateStart) / 1e9;
+        fprintf(stderr, "Generated %llu PDUs with %llu flows (%.1f MB) in %.2f s\n",
+                (unsigned long long) arguments->generate, (unsigned long long) flows,
+                (dataset.dataOffset + size) / 1e6, seconds);
+    }
+
+    free(dataset.chunks);
+    free(threads);
+
+    return status;
+}
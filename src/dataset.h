@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _DATASET__H_
+#define _DATASET__H_
+
+#include <stdint.h>
+
+#include "errors.h"
+#include "nfgen.h"
+#include "binaryoutput.h"
+
+/* PDUs generated from one generator stream */
+#define DATASET_CHUNK_PDUS 4096
+
+/** Part of the dataset generated by one thread at once
+ *
+ * Chunk k covers PDUs k * DATASET_CHUNK_PDUS and on, and
+ * uses the seeded stream jumped k times ahead (@see
+ * randomJump()). Its content depends only on the seed and
+ * k, so the file is the same for any number of threads.
+ */
+struct datasetChunk
+{
+    uint64_t     firstPdu;
+    uint64_t     firstFlow;  /* Flows in all previous chunks */
+    uint64_t     offset;     /* File offset of the first record */
+    uint64_t     size;       /* Bytes of the chunk in the file */
+    uint64_t     flows;
+    unsigned int pdus;
+};
+
+/** Dataset written by --generate
+ *
+ * Generation runs in two passes. The first one only draws
+ * the number of records of every PDU, which is cheap. A
+ * prefix sum over the chunks then gives each chunk its
+ * flow sequence, time stamps and place in the file. The
+ * second pass generates the chunks in parallel and writes
+ * each one into its own region of the file with pwrite().
+ */
+struct dataset
+{
+    const struct cliArguments* arguments;
+    struct datasetChunk* chunks;
+    uint64_t  numberOfChunks;
+    uint64_t  startTime;        /* Time stamp of the first PDU [ns since the epoch] */
+    struct udpEndpoints endpoints;
+    int       fd;
+    uint64_t  dataOffset;       /* Size of the file header */
+};
+
+/**
+ * Write the dataset of \c arguments->generate PDUs into -o
+ *
+ * The PDUs are not sent. They are time-stamped as if they
+ * were sent at the requested rate (-r/-f) from \c startTime
+ * on. Uses \c arguments->threads threads.
+ *
+ * @param[in] arguments Parsed command line arguments
+ * @param[in] startTime Time of the first PDU [ns since the epoch]
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t generateDataset(const struct cliArguments* arguments, uint64_t startTime);
+
+#endif
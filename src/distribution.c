@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "distribution.h"
+
+error_t initializeAliasTable(struct aliasTable* table, const double* weights, uint32_t size)
+{
+    double total = 0;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (!(weights[i] >= 0))
+        {
+            return EINVAL;
+        }
+        total += weights[i];
+    }
+
+    if (size == 0 || !(total > 0))
+    {
+        return EINVAL;
+    }
+
+    table->size       = size;
+    table->thresholds = (uint32_t*) malloc(size * sizeof(uint32_t));
+    table->aliases    = (uint32_t*) malloc(size * sizeof(uint32_t));
+
+    /* Scaled probabilities and a stack of columns under (small)
+       and over (large) the average, sharing one array */
+    double* probabilities = (double*) malloc(size * sizeof(double));
+    uint32_t* stack = (uint32_t*) malloc(size * sizeof(uint32_t));
+
+    if (table->thresholds == NULL || table->aliases == NULL || probabilities == NULL || stack == NULL)
+    {
+        free(probabilities);
+        free(stack);
+        freeAliasTable(table);
+        return ENOMEM;
+    }
+
+    uint32_t small = 0;      /* stack[0 .. small) */
+    uint32_t large = size;   /* stack[large .. size) */
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        probabilities[i] = weights[i] * size / total;
+        table->aliases[i] = i;
+
+        if (probabilities[i] < 1)
+        {
+            stack[small++] = i;
+        }
+        else
+        {
+            stack[--large] = i;
+        }
+    }
+
+    /* Fill every small column up with a piece of a large one */
+    while (small > 0 && large < size)
+    {
+        uint32_t less = stack[--small];
+        uint32_t more = stack[large++];
+
+        table->thresholds[less] = (uint32_t) (probabilities[less] * 4294967296.0);
+        table->aliases[less] = more;
+
+        probabilities[more] -= 1 - probabilities[less];
+        if (probabilities[more] < 1)
+        {
+            stack[small++] = more;
+        }
+        else
+        {
+            stack[--large] = more;
+        }
+    }
+
+    /* What's left is full up to rounding errors */
+    while (small > 0)
+    {
+        table->thresholds[stack[--small]] = UINT32_MAX;
+    }
+    while (large < size)
+    {
+        table->thresholds[stack[large++]] = UINT32_MAX;
+    }
+
+    free(probabilities);
+    free(stack);
+
+    return EOK;
+}
+
+error_t initializeZipfTable(struct aliasTable* table, uint32_t size, double exponent)
+{
+    double* weights = (double*) malloc(size * sizeof(double));
+    if (weights == NULL)
+    {
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        weights[i] = pow(i + 1, -exponent);
+    }
+
+    error_t status = initializeAliasTable(table, weights, size);
+    free(weights);
+
+    return status;
+}
+
+void freeAliasTable(struct aliasTable* table)
+{
+    free(table->thresholds);
+    free(table->aliases);
+
+    table->thresholds = NULL;
+    table->aliases    = NULL;
+    table->size       = 0;
+}
+
+/** Tabulate \c quantile on [start, start + width], the last point stands for the rest */
+static void tabulate(uint32_t* values, quantileFunction quantile, double a, double b,
+                     double start, double width, uint32_t minimum, uint32_t maximum)
+{
+    const uint32_t points = 1 << QUANTILE_BITS;
+
+    for (uint32_t i = 0; i <= points; i++)
+    {
+        double u = start + width * (i < points ? (double) i / points : 1 - 0.25 / points);
+        double value = quantile(u, a, b);
+
+        if (!(value >= minimum))
+        {
+            value = minimum;
+        }
+        if (!(value <= maximum))
+        {
+            value = maximum;
+        }
+
+        values[i] = (uint32_t) value;
+    }
+}
+
+void initializeQuantileTable(struct quantileTable* table, quantileFunction quantile, double a, double b,
+                             uint32_t minimum, uint32_t maximum)
+{
+    const double segment = 1.0 / (1 << QUANTILE_BITS);
+
+    tabulate(table->values, quantile, a, b, 0, 1, minimum, maximum);
+    tabulate(table->tail, quantile, a, b, 1 - segment, segment, minimum, maximum);
+}
+
+double paretoQuantile(double u, double shape, double minimum)
+{
+    return minimum / pow(1 - u, 1 / shape);
+}
+
+/** Inverse of the standard normal CDF (P. J. Acklam's approximation,
+    relative error below 1.2e-9) */
+static double normalQuantile(double u)
+{
+    static const double a[] = {-3.969683028665376e+01,  2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01,  2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01,  1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00,  4.374664141464968e+00,  2.938163982698783e+00};
+    static const double d[] = { 7.784695709041462e-03,  3.224671290700398e-01,  2.445134137142996e+00,
+                                3.754408661907416e+00};
+    const double low = 0.02425;
+
+    if (u <= 0)
+    {
+        return -INFINITY;
+    }
+
+    if (u < low)
+    {
+        double q = sqrt(-2 * log(u));
+        return (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+               ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+    }
+
+    if (u > 1 - low)
+    {
+        return -normalQuantile(1 - u);
+    }
+
+    double q = u - 0.5;
+    double r = q * q;
+    return (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q /
+           (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+}
+
+double lognormalQuantile(double u, double median, double sigma)
+{
+    return median * exp(sigma * normalQuantile(u));
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _DISTRIBUTION__H_
+#define _DISTRIBUTION__H_
+
+#include <stdint.h>
+
+#include "errors.h"
+
+/* Quantile tables have 2^QUANTILE_BITS segments */
+#define QUANTILE_BITS 14
+
+/** Discrete distribution sampled by the alias method.
+ *
+ * The outcomes 0 .. size - 1 are split into \c size columns
+ * of equal probability. A column holds its own outcome with
+ * probability threshold / 2^32 and its alias otherwise, so a
+ * sample costs one multiplication and one comparison no
+ * matter how many outcomes there are (Vose's construction).
+ */
+struct aliasTable
+{
+    uint32_t  size;
+    uint32_t* thresholds;
+    uint32_t* aliases;
+};
+
+/** Continuous distribution sampled by its inverse CDF.
+ *
+ * The inverse CDF is tabulated at 2^QUANTILE_BITS evenly
+ * spaced probabilities and linearly interpolated, so any
+ * distribution with a quantile function is sampled in
+ * constant time. The last segment, where heavy tails grow
+ * fastest, has a table of its own with the same number of
+ * points. The tail beyond 1 - 2^-(2 * QUANTILE_BITS + 2) is
+ * cut off.
+ */
+struct quantileTable
+{
+    uint32_t values[(1 << QUANTILE_BITS) + 1];
+    uint32_t tail[(1 << QUANTILE_BITS) + 1];   /* The last segment of values */
+};
+
+/** Quantile function of a distribution, \c u is in [0, 1) */
+typedef double (*quantileFunction)(double u, double a, double b);
+
+/**
+ * Build an alias table from weights
+ *
+ * @param[out] table   Table to be initialized
+ * @param[in]  weights Non-negative weights of the outcomes, at least one positive
+ * @param[in]  size    Number of outcomes
+ *
+ * @return EOK on success, EINVAL on bad weights, ENOMEM on malloc failure
+ */
+error_t initializeAliasTable(struct aliasTable* table, const double* weights, uint32_t size);
+
+/**
+ * Build an alias table of the Zipf distribution
+ *
+ * Outcome k (0-based rank) has probability proportional
+ * to 1 / (k + 1)^exponent.
+ *
+ * @param[out] table    Table to be initialized
+ * @param[in]  size     Number of outcomes
+ * @param[in]  exponent Zipf exponent (0 = uniform, 1 = classic Zipf)
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t initializeZipfTable(struct aliasTable* table, uint32_t size, double exponent);
+
+/**
+ * Draw an outcome
+ *
+ * @param[in] table  Initialized table
+ * @param[in] random Uniformly distributed 32-bit number
+ *
+ * @return Outcome 0 .. size - 1
+ */
+static inline uint32_t aliasSample(const struct aliasTable* table, uint32_t random)
+{
+    /* The high half picks the column, the low half is uniform within it */
+    uint64_t product = (uint64_t) random * table->size;
+    uint32_t column = product >> 32;
+
+    return (uint32_t) product < table->thresholds[column] ? column : table->aliases[column];
+}
+
+/**
+ * Free the memory allocated by initializeAliasTable()
+ *
+ * @param[in,out] table Table to be released
+ *
+ * @return void
+ */
+void freeAliasTable(struct aliasTable* table);
+
+/**
+ * Tabulate a quantile function
+ *
+ * @param[out] table    Table to be initialized
+ * @param[in]  quantile Quantile function
+ * @param[in]  a        First parameter of \c quantile
+ * @param[in]  b        Second parameter of \c quantile
+ * @param[in]  minimum  Smallest value of the table
+ * @param[in]  maximum  Largest value of the table
+ *
+ * @return void
+ */
+void initializeQuantileTable(struct quantileTable* table, quantileFunction quantile, double a, double b,
+                             uint32_t minimum, uint32_t maximum);
+
+/**
+ * Draw a value
+ *
+ * @param[in] table  Initialized table
+ * @param[in] random Uniformly distributed 32-bit number
+ *
+ * @return Value between the table's minimum and maximum
+ */
+static inline uint32_t quantileSample(const struct quantileTable* table, uint32_t random)
+{
+    const uint32_t last = (1U << QUANTILE_BITS) - 1;
+    const uint32_t* values = table->values;
+    uint32_t index = random >> (32 - QUANTILE_BITS);
+    int fractionBits = 32 - QUANTILE_BITS;
+
+    /* The rest of the bits pick a point of the tail table */
+    if (index == last)
+    {
+        values = table->tail;
+        random <<= QUANTILE_BITS;
+        index = random >> (32 - QUANTILE_BITS);
+        fractionBits = 32 - 2 * QUANTILE_BITS;
+    }
+
+    uint32_t fraction = (random >> (32 - QUANTILE_BITS - fractionBits)) & ((1U << fractionBits) - 1);
+    uint32_t low = values[index];
+
+    return low + (uint32_t) (((uint64_t) (values[index + 1] - low) * fraction) >> fractionBits);
+}
+
+/**
+ * Pareto quantile function
+ *
+ * @param[in] u       Probability
+ * @param[in] shape   Tail index alpha (smaller is heavier)
+ * @param[in] minimum Scale (the smallest value)
+ *
+ * @return Value x with P(X <= x) = u
+ */
+double paretoQuantile(double u, double shape, double minimum);
+
+/**
+ * Lognormal quantile function
+ *
+ * @param[in] u      Probability
+ * @param[in] median Median (e^mu)
+ * @param[in] sigma  Standard deviation of the logarithm
+ *
+ * @return Value x with P(X <= x) = u
+ */
+double lognormalQuantile(double u, double median, double sigma);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "fleet.h"
+#include "clock.h"
+
+/* Resolution of the export timers [ns] */
+#define FLEET_TICK 1000000ULL
+
+/* One revolution of the wheel covers 16 s of intervals */
+#define FLEET_WHEEL_SLOTS 16384
+
+/* The exporters were booted between an hour and 30 days ago [s] */
+#define MIN_UPTIME 3600
+#define MAX_UPTIME (30 * 86400)
+
+error_t initializeFleet(struct exporterFleet* fleet, uint32_t first, uint32_t count,
+                        const struct templateEncoder* encoder, uint64_t interval,
+                        in_addr_t sourceBase, uint64_t now, const struct randomState* random)
+{
+    struct randomState stream = *random;
+
+    memset(fleet, 0, sizeof(*fleet));
+    fleet->first = first;
+    fleet->numberOfExporters = count;
+
+    fleet->exporters = (struct netflowExporter*) calloc(count, sizeof(struct netflowExporter));
+    fleet->intervals = (uint64_t*) calloc(count, sizeof(uint64_t));
+    fleet->deadlines = (uint64_t*) calloc(count, sizeof(uint64_t));
+    if (encoder != NULL)
+    {
+        fleet->encoders = (struct templateEncoder*) calloc(count, sizeof(struct templateEncoder));
+    }
+    if (sourceBase != htonl(INADDR_ANY))
+    {
+        fleet->sources = (in_addr_t*) calloc(count, sizeof(in_addr_t));
+    }
+
+    if (fleet->exporters == NULL || fleet->intervals == NULL || fleet->deadlines == NULL ||
+        (encoder != NULL && fleet->encoders == NULL) ||
+        (sourceBase != htonl(INADDR_ANY) && fleet->sources == NULL) ||
+        initializeTimerWheel(&fleet->wheel, count, FLEET_WHEEL_SLOTS, FLEET_TICK, now) != EOK)
+    {
+        freeFleet(fleet);
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct netflowExporter* exporter = &fleet->exporters[i];
+        uint32_t index = first + i;
+
+        randomJump(&stream);
+        initializeExporter(exporter, now / NSECS_PER_SEC, index & 0xff, &stream);
+        exporter->engineType = index >> 8;
+        exporter->systemStartTime -= MIN_UPTIME + randomBounded(&exporter->random, MAX_UPTIME - MIN_UPTIME);
+
+        fleet->intervals[i] = interval / 2 + (uint64_t) (randomNext(&exporter->random) % (interval + 1));
+        fleet->deadlines[i] = now + (uint64_t) (randomNext(&exporter->random) % (fleet->intervals[i] + 1));
+        timerSchedule(&fleet->wheel, i, fleet->deadlines[i]);
+
+        if (fleet->encoders != NULL)
+        {
+            fleet->encoders[i] = *encoder;
+        }
+        if (fleet->sources != NULL)
+        {
+            fleet->sources[i] = htonl(ntohl(sourceBase) + index);
+        }
+    }
+
+    return EOK;
+}
+
+unsigned int fleetDue(struct exporterFleet* fleet, uint64_t now, uint32_t* exporters, unsigned int maxExporters)
+{
+    unsigned int count = timerExpire(&fleet->wheel, now, exporters, maxExporters);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        uint32_t exporter = exporters[i];
+        uint64_t next = fleet->deadlines[exporter] + fleet->intervals[exporter];
+
+        /* A late exporter skips the missed exports, it doesn't send them all at once */
+        if (next < now)
+        {
+            next = now + fleet->intervals[exporter];
+        }
+
+        fleet->deadlines[exporter] = next;
+        timerSchedule(&fleet->wheel, exporter, next);
+    }
+
+    return count;
+}
+
+uint64_t fleetNextCheck(const struct exporterFleet* fleet)
+{
+    return timerNextTick(&fleet->wheel);
+}
+
+void freeFleet(struct exporterFleet* fleet)
+{
+    free(fleet->exporters);
+    free(fleet->encoders);
+    free(fleet->intervals);
+    free(fleet->deadlines);
+    free(fleet->sources);
+    freeTimerWheel(&fleet->wheel);
+
+    fleet->exporters = NULL;
+    fleet->encoders  = NULL;
+    fleet->intervals = NULL;
+    fleet->deadlines = NULL;
+    fleet->sources   = NULL;
+    fleet->numberOfExporters = 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _FLEET__H_
+#define _FLEET__H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+#include "netflow.h"
+#include "template.h"
+#include "timerwheel.h"
+
+/* Engine type and engine ID together tell the exporters apart */
+#define MAX_EXPORTERS 65536
+
+/** Many simulated exporters driven by one thread
+ *
+ * Every exporter has its own engine ID (the low 8 bits of
+ * its index, the high 8 bits go to the engine type), flow
+ * sequence, boot time, generator stream, export interval
+ * and optionally source address. With v9/IPFIX it also has
+ * its own template encoder, so templates are refreshed per
+ * exporter just like on real routers.
+ *
+ * The exporters are timers on a timer wheel. Each export
+ * interval the exporter sends one PDU. Intervals differ by
+ * up to +-50 % from the mean and start at random phases,
+ * so the collector sees a steady mix of sources instead of
+ * bursts.
+ */
+struct exporterFleet
+{
+    struct netflowExporter* exporters;
+    struct templateEncoder* encoders;  /* NULL for NetFlow v5 */
+    uint64_t*  intervals;              /* Export interval of every exporter [ns] */
+    uint64_t*  deadlines;              /* Next export of every exporter [ns] */
+    in_addr_t* sources;                /* Source addresses, NULL for the socket's */
+    uint32_t   first;                  /* Global index of the first exporter */
+    uint32_t   numberOfExporters;
+    struct timerWheel wheel;
+};
+
+/**
+ * Create the exporters
+ *
+ * Exporter \c i gets the global index \c first + \c i, which
+ * determines its engine ID and source address. The generator
+ * streams are \c random jumped ahead once for every exporter
+ * (@see randomJump()), so give every fleet a stream separated
+ * by randomLongJump().
+ *
+ * @param[out] fleet      Fleet to be initialized
+ * @param[in]  first      Global index of the first exporter
+ * @param[in]  count      Number of exporters
+ * @param[in]  encoder    Initialized template encoder copied to every exporter, \
+ *                        NULL for NetFlow v5
+ * @param[in]  interval   Mean export interval [ns]
+ * @param[in]  sourceBase Source address of global exporter 0 (network order), \
+ *                        INADDR_ANY to send from the socket's address
+ * @param[in]  now        Current time [ns since the epoch] (@see clockNow()), \
+ *                        the exporters were booted up to 30 days before
+ * @param[in]  random     Generator stream of the fleet
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t initializeFleet(struct exporterFleet* fleet, uint32_t first, uint32_t count,
+                        const struct templateEncoder* encoder, uint64_t interval,
+                        in_addr_t sourceBase, uint64_t now, const struct randomState* random);
+
+/**
+ * Collect the exporters due to send a PDU
+ *
+ * The returned exporters are scheduled for their next
+ * export interval right away.
+ *
+ * @param[in,out] fleet        Initialized fleet
+ * @param[in]     now          Current time [ns since the epoch]
+ * @param[out]    exporters    Indexes of the due exporters
+ * @param[in]     maxExporters Capacity of \c exporters
+ *
+ * @return Number of exporters stored in \c exporters
+ */
+unsigned int fleetDue(struct exporterFleet* fleet, uint64_t now, uint32_t* exporters, unsigned int maxExporters);
+
+/**
+ * When should fleetDue() be called next
+ *
+ * @param[in] fleet Initialized fleet
+ *
+ * @return Time [ns since the epoch]
+ */
+uint64_t fleetNextCheck(const struct exporterFleet* fleet);
+
+/**
+ * Free the memory allocated by initializeFleet()
+ *
+ * @param[in,out] fleet Fleet to be released
+ *
+ * @return void
+ */
+void freeFleet(struct exporterFleet* fleet);
+
+#endif
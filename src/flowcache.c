@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "flowcache.h"
+#include "random.h"
+
+/* Load factor is kept under 3/4 */
+#define MIN_EMPTY_SLOTS(flows) ((flows) / 3 + 1)
+
+static inline bool isEmpty(const struct flowEntry* entry)
+{
+    return entry->dPkts == 0;
+}
+
+static inline uint64_t hashFlow(const struct flowEntry* flow)
+{
+    uint64_t addresses = ((uint64_t) flow->srcAddr << 32) | flow->dstAddr;
+    uint64_t ports = ((uint64_t) flow->srcPort << 24) | ((uint64_t) flow->dstPort << 8) | flow->prot;
+
+    return mixBits(addresses ^ mixBits(ports));
+}
+
+static inline bool sameFlow(const struct flowEntry* a, const struct flowEntry* b)
+{
+    return a->srcAddr == b->srcAddr && a->dstAddr == b->dstAddr &&
+           a->srcPort == b->srcPort && a->dstPort == b->dstPort &&
+           a->prot == b->prot;
+}
+
+/** Remove the entry at \c hole (backward shift deletion). */
+static void removeEntry(struct flowCache* cache, size_t hole)
+{
+    struct flowEntry* entries = cache->entries;
+    size_t mask = cache->mask;
+    size_t i = hole;
+
+    while (1)
+    {
+        i = (i + 1) & mask;
+        if (isEmpty(&entries[i]))
+        {
+            break;
+        }
+
+        /* The entry can fill the hole unless its home slot
+           lies cyclically between the hole and the entry. */
+        size_t home = hashFlow(&entries[i]) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            entries[hole] = entries[i];
+            hole = i;
+        }
+    }
+
+    entries[hole].dPkts = 0;
+    cache->count--;
+}
+
+/** Export the flow at \c index and remove it from the cache. */
+static void exportEntry(struct flowCache* cache, size_t index)
+{
+    cache->export(cache->context, &cache->entries[index]);
+    removeEntry(cache, index);
+}
+
+/** Make room for a new flow. */
+static void evictFlow(struct flowCache* cache)
+{
+    while (isEmpty(&cache->entries[cache->sweepPosition]))
+    {
+        cache->sweepPosition = (cache->sweepPosition + 1) & cache->mask;
+    }
+
+    exportEntry(cache, cache->sweepPosition);
+    cache->statistics.evicted++;
+}
+
+error_t initializeFlowCache(struct flowCache* cache, size_t maxFlows,
+                            uint32_t activeTimeout, uint32_t inactiveTimeout,
+                            flowExportCallback export, void* context)
+{
+    size_t slots = 16;
+    while (slots < maxFlows + MIN_EMPTY_SLOTS(maxFlows))
+    {
+        slots *= 2;
+    }
+
+    cache->entries = (struct flowEntry*) calloc(slots, sizeof(struct flowEntry));
+    if (cache->entries == NULL)
+    {
+        return ENOMEM;
+    }
+
+    cache->mask            = slots - 1;
+    cache->count           = 0;
+    cache->maxFlows        = maxFlows > 0 ? maxFlows : 1;
+    cache->sweepPosition   = 0;
+    cache->activeTimeout   = activeTimeout;
+    cache->inactiveTimeout = inactiveTimeout;
+    cache->export          = export;
+    cache->context         = context;
+
+    memset(&cache->statistics, 0, sizeof(cache->statistics));
+
+    return EOK;
+}
+
+void updateFlow(struct flowCache* cache, const struct flowEntry* packet, uint32_t now)
+{
+    struct flowEntry* entries = cache->entries;
+    size_t home = hashFlow(packet) & cache->mask;
+    size_t i = home;
+
+    while (!isEmpty(&entries[i]))
+    {
+        if (sameFlow(&entries[i], packet))
+        {
+            struct flowEntry* flow = &entries[i];
+
+            flow->dPkts++;
+            flow->dOctets  += packet->dOctets;
+            flow->tcpFlags |= packet->tcpFlags;
+            flow->last      = now;
+            return;
+        }
+
+        i = (i + 1) & cache->mask;
+    }
+
+    if (cache->count >= cache->maxFlows)
+    {
+        evictFlow(cache);
+
+        /* Entries might have been shifted, look for a free slot again */
+        for (i = home; !isEmpty(&entries[i]); i = (i + 1) & cache->mask)
+        {
+        }
+    }
+
+    struct flowEntry* flow = &entries[i];
+
+    *flow = *packet;
+    flow->dPkts = 1;
+    flow->first = now;
+    flow->last  = now;
+
+    cache->count++;
+    cache->statistics.created++;
+}
+
+void expireFlows(struct flowCache* cache, uint32_t now, size_t slots)
+{
+    struct flowEntry* entries = cache->entries;
+    size_t position = cache->sweepPosition;
+
+    for (size_t checked = 0; checked < slots && cache->count > 0; checked++)
+    {
+        struct flowEntry* flow = &entries[position];
+
+        if (!isEmpty(flow))
+        {
+            if (now - flow->last >= cache->inactiveTimeout)
+            {
+                cache->statistics.expiredInactive++;
+                exportEntry(cache, position);
+                continue;  /* Another flow might have been shifted here */
+            }
+
+            if (now - flow->first >= cache->activeTimeout)
+            {
+                cache->statistics.expiredActive++;
+                exportEntry(cache, position);
+                continue;
+            }
+        }
+
+        position = (position + 1) & cache->mask;
+    }
+
+    cache->sweepPosition = position;
+}
+
+void flushFlowCache(struct flowCache* cache)
+{
+    for (size_t i = 0; i <= cache->mask; i++)
+    {
+        if (!isEmpty(&cache->entries[i]))
+        {
+            cache->export(cache->context, &cache->entries[i]);
+            cache->entries[i].dPkts = 0;
+        }
+    }
+
+    cache->count = 0;
+}
+
+void flowToRecord(const struct flowEntry* flow, struct netflowRecord* record)
+{
+    memset(record, 0, sizeof(struct netflowRecord));
+
+    record->srcAddr  = flow->srcAddr;
+    record->dstAddr  = flow->dstAddr;
+    record->srcPort  = flow->srcPort;
+    record->dstPort  = flow->dstPort;
+    record->prot     = flow->prot;
+    record->tcpFlags = flow->tcpFlags;
+    record->tos      = flow->tos;
+    record->dPkts    = flow->dPkts;
+    record->dOctets  = flow->dOctets;
+    record->first    = flow->first;
+    record->last     = flow->last;
+}
+
+void freeFlowCache(struct flowCache* cache)
+{
+    free(cache->entries);
+
+    cache->entries = NULL;
+    cache->mask    = 0;
+    cache->count   = 0;
+}
+
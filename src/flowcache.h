@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FLOWCACHE__H_
+#define _FLOWCACHE__H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+#include "netflow.h"
+
+/** Flow cache entry (32 bytes)
+ *
+ * The 5-tuple is the key. Addresses are kept in network
+ * byte order, everything else in host byte order. Slots
+ * with zero \c dPkts are empty.
+ */
+struct flowEntry
+{
+    uint32_t srcAddr;
+    uint32_t dstAddr;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t  prot;
+    uint8_t  tcpFlags;   /* Cumulative OR of tcp flags */
+    uint8_t  tos;
+    uint8_t  pad;
+    uint32_t dPkts;
+    uint32_t dOctets;
+    uint32_t first;      /* sysUpTime of the first packet [ms] */
+    uint32_t last;       /* sysUpTime of the last packet [ms] */
+};
+
+/** Called for every flow that leaves the cache. */
+typedef void (*flowExportCallback)(void* context, const struct flowEntry* flow);
+
+/** Flow statistics of the cache */
+struct flowCacheStatistics
+{
+    uint64_t created;
+    uint64_t expiredInactive;
+    uint64_t expiredActive;
+    uint64_t evicted;       /* Exported early because the cache was full */
+};
+
+/** Router flow cache.
+ *
+ * Open addressing hash table with linear probing, keyed
+ * on the 5-tuple. Removed entries are back-shifted, so
+ * there are no tombstones and lookups stay short even
+ * under heavy churn. The table has at least 25% of empty
+ * slots, which is ~43 bytes of memory per cached flow.
+ *
+ * Flows are expired by an incremental sweep of the table
+ * (@see expireFlows()) once they are idle for the inactive
+ * timeout or live longer than the active timeout. When
+ * the cache is full, a flow at the sweep position is
+ * evicted to make room for the new one.
+ */
+struct flowCache
+{
+    struct flowEntry* entries;
+    size_t   mask;           /* Number of slots - 1 */
+    size_t   count;          /* Flows in the cache */
+    size_t   maxFlows;
+    size_t   sweepPosition;
+
+    uint32_t activeTimeout;   /* [ms] */
+    uint32_t inactiveTimeout; /* [ms] */
+
+    flowExportCallback export;
+    void*    context;
+
+    struct flowCacheStatistics statistics;
+};
+
+/**
+ * Allocate the flow cache
+ *
+ * @param[out] cache           Cache to be initialized
+ * @param[in]  maxFlows        Maximum number of flows in the cache
+ * @param[in]  activeTimeout   Active timeout [ms]
+ * @param[in]  inactiveTimeout Inactive timeout [ms]
+ * @param[in]  export          Callback for flows leaving the cache
+ * @param[in]  context         First argument of \c export
+ *
+ * @return EOK on success, ENOMEM on failure
+ */
+error_t initializeFlowCache(struct flowCache* cache, size_t maxFlows,
+                            uint32_t activeTimeout, uint32_t inactiveTimeout,
+                            flowExportCallback export, void* context);
+
+/**
+ * Account a packet
+ *
+ * Looks up the flow of \c packet (its 5-tuple) and adds the
+ * packet to it, or creates a new flow. \c packet carries the
+ * packet's size in \c dOctets and its \c tcpFlags, \c dPkts
+ * and timestamps are ignored.
+ *
+ * @param[in,out] cache  Initialized cache
+ * @param[in]     packet Packet description
+ * @param[in]     now    Current sysUpTime [ms]
+ *
+ * @return void
+ */
+void updateFlow(struct flowCache* cache, const struct flowEntry* packet, uint32_t now);
+
+/**
+ * Expire timed out flows
+ *
+ * Checks the next \c slots slots of the table and exports
+ * flows that reached the active or inactive timeout.
+ *
+ * @param[in,out] cache Initialized cache
+ * @param[in]     now   Current sysUpTime [ms]
+ * @param[in]     slots Number of slots to check
+ *
+ * @return void
+ */
+void expireFlows(struct flowCache* cache, uint32_t now, size_t slots);
+
+/**
+ * Number of slots of the table
+ *
+ * @param[in] cache Initialized cache
+ *
+ * @return Table size
+ */
+static inline size_t flowCacheSlots(const struct flowCache* cache)
+{
+    return cache->mask + 1;
+}
+
+/**
+ * Export all flows and empty the cache
+ *
+ * @param[in,out] cache Initialized cache
+ *
+ * @return void
+ */
+void flushFlowCache(struct flowCache* cache);
+
+/**
+ * Convert an exported flow into a v5 record
+ *
+ * Interfaces, next hop, AS numbers and masks are left 0.
+ *
+ * @param[in]  flow   Flow leaving the cache
+ * @param[out] record Record in host byte order (@see makeNetflowPacket())
+ *
+ * @return void
+ */
+void flowToRecord(const struct flowEntry* flow, struct netflowRecord* record);
+
+/**
+ * Free the memory allocated by initializeFlowCache()
+ *
+ * @param[in,out] cache Cache to be released
+ *
+ * @return void
+ */
+void freeFlowCache(struct flowCache* cache);
+
+#endif
+
@@ -22,6 +22,7 @@
 
 #include "errors.h"
 
+#include <stddef.h>
 #include <arpa/inet.h>
 
 /**
@@ -34,6 +35,16 @@
  */
 error_t convertAddress(const char *addressInDotNotation, in_addr_t* address);
 
+/**
+ * Convert IPv6 address from string to in6_addr
+ *
+ * @param[in]  address Address in the usual text form ("2001:db8::1")
+ * @param[out] result  Resulting address
+ *
+ * @return EOK on success, EINVAL if it isn't an IPv6 address
+ */
+error_t convertAddress6(const char* address, struct in6_addr* result);
+
 /**
  * Load hosts from file
  *
@@ -45,22 +56,46 @@ error_t convertAddress(const char *addressInDotNotation, in_addr_t* address);
  *     192.168.0.1 # Also a comment
  *
  *     10.0.0.1
+ *     10.1.0.0/16
  *
  * That means one address per line, blank lines, spaces and
  * everything after '#' up to the end of the line is ignored.
- * 
- * TODO Test with Windows CR-LF line endings.
+ * Both LF and CR-LF line endings are accepted.
+ *
+ * A CIDR range is expanded into all its addresses, so it's
+ * picked proportionally to its size. Prefixes shorter than
+ * /8 are rejected.
  *
  * Badly formed addresses are ignored with a warning on stderr.
  *
+ * The file is memory-mapped and parsed in place, without
+ * any per-address string copies, so it can be used for
+ * files with millions of entries.
+ *
  * Returned array is allocated within the function and is not
  * free'd. Your responsibility is to correctly release the
  * memory.
  *
- * @param[in] filePath Location of the file
- * @param[out] hosts Pointer to an array of in_addr_t
+ * @param[in]  filePath      Location of the file
+ * @param[out] hosts         Pointer to an array of in_addr_t (network byte order)
+ * @param[out] numberOfHosts Number of addresses in \c hosts
  *
- * @return Number of addresses read or -1 on error
+ * @return EOK on success, errno code on failure
  */
-error_t readHostsFromFile(char* filePath, in_addr_t** hosts);
+error_t readHostsFromFile(const char* filePath, in_addr_t** hosts, size_t* numberOfHosts);
+
+/**
+ * Load IPv6 hosts from file
+ *
+ * The same format as readHostsFromFile(), with IPv6
+ * addresses. Ranges are limited to /104 (16M addresses).
+ *
+ * @param[in]  filePath      Location of the file
+ * @param[out] hosts         Pointer to an array of addresses
+ * @param[out] numberOfHosts Number of addresses in \c hosts
+ *
+ * @return EOK on success, errno code on failure
+ */
+error_t readHosts6FromFile(const char* filePath, struct in6_addr** hosts, size_t* numberOfHosts);
+
 #endif
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "meter.h"
+#include "pacing.h"
+
+#define NSECS_PER_SEC  1000000000ULL
+#define NSECS_PER_MSEC 1000000ULL
+
+/* How often is the rate report printed [ns] */
+#define RATE_REPORT_INTERVAL 1000000000ULL
+
+/* Read buffer, larger than any captured frame */
+#define METER_BUFFER_SIZE (4 << 20)
+
+/* The whole cache is checked for timed out flows once per captured second */
+#define SWEEP_PERIOD 1000 /* [ms] */
+
+/* Slots checked at once, bounds the flows exported at once */
+#define SWEEP_CHUNK 1024
+
+#define IP_OFFSET_MASK 0x1fff  /* Fragment offset, the first fragment has 0 */
+
+/** Move an expired flow to the export queue. */
+static void queueFlow(void* context, const struct flowEntry* flow)
+{
+    struct pcapMeter* meter = (struct pcapMeter*) context;
+
+    flowToRecord(flow, &meter->pending[meter->pendingCount++]);
+}
+
+/** Make \c size bytes from the read position on available, returns 0 at the end of the file */
+static int fill(struct pcapMeter* meter, size_t size)
+{
+    if (meter->end - meter->position >= size)
+    {
+        return 1;
+    }
+
+    if (size > METER_BUFFER_SIZE)
+    {
+        meter->error = EINVAL;
+        return 0;
+    }
+
+    /* Only the rest of one frame is moved */
+    memmove(meter->buffer, meter->buffer + meter->position, meter->end - meter->position);
+    meter->end -= meter->position;
+    meter->position = 0;
+
+    while (meter->end < size)
+    {
+        ssize_t count = read(meter->file, meter->buffer + meter->end, METER_BUFFER_SIZE - meter->end);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            meter->error = count < 0 ? errno : EOK;
+            return 0;
+        }
+
+        meter->end += count;
+    }
+
+    return 1;
+}
+
+/** Account one captured frame in the flow cache, returns 0 if it isn't IPv4 */
+static int meterFrame(struct pcapMeter* meter, const unsigned char* frame, size_t size)
+{
+    struct capturedPacket headers;
+    if (!pcapFindPacket(&meter->format, frame, size, &headers) || headers.version != 4)
+    {
+        return 0;
+    }
+
+    const unsigned char* ip = headers.ip;
+    const unsigned char* end = headers.end;
+    const unsigned char* transport = headers.transport;
+    struct flowEntry packet;
+
+    /* Addresses stay in network byte order */
+    memcpy(&packet.srcAddr, ip + 12, sizeof(packet.srcAddr));
+    memcpy(&packet.dstAddr, ip + 16, sizeof(packet.dstAddr));
+    packet.srcPort  = 0;
+    packet.dstPort  = 0;
+    packet.prot     = headers.protocol;
+    packet.tcpFlags = 0;
+    packet.tos      = ip[1];
+    packet.pad      = 0;
+    packet.dOctets  = headers.length;   /* Layer 3 bytes, whatever the snap length */
+
+    /* Only the first fragment has the transport header, cut
+       off headers leave the ports 0 */
+    if ((headers.fragment & IP_OFFSET_MASK) == 0)
+    {
+        switch (packet.prot)
+        {
+        case IPPROTO_TCP:
+            if (transport + 14 <= end)
+            {
+                packet.tcpFlags = transport[13];
+            }
+            /* Fall through */
+        case IPPROTO_UDP:
+            if (transport + 4 <= end)
+            {
+                packet.srcPort = getNet16(transport);
+                packet.dstPort = getNet16(transport + 2);
+            }
+            break;
+        case IPPROTO_ICMP:
+            /* v5 carries ICMP type and code in the destination port */
+            if (transport + 2 <= end)
+            {
+                packet.dstPort = getNet16(transport);
+            }
+            break;
+        }
+    }
+
+    updateFlow(&meter->cache, &packet, meter->now);
+
+    return 1;
+}
+
+/** Advance the capture clock, the sweep falls behind by the elapsed time */
+static void advanceClock(struct pcapMeter* meter, uint64_t time)
+{
+    if (!meter->started)
+    {
+        meter->started   = 1;
+        meter->startTime = time / NSECS_PER_SEC * NSECS_PER_SEC;
+    }
+
+    /* Time going backwards (e.g. merged captures) stops the clock */
+    uint32_t now = time > meter->startTime ? (time - meter->startTime) / NSECS_PER_MSEC : 0;
+    if ((int32_t) (now - meter->now) <= 0)
+    {
+        return;
+    }
+    meter->now = now;
+
+    size_t slots = flowCacheSlots(&meter->cache);
+    meter->sweepCredit += (uint64_t) (now - meter->sweepTime) * slots;
+    meter->sweepTime = now;
+
+    /* More than one pass over the table is pointless */
+    meter->sweepSlots += meter->sweepCredit / SWEEP_PERIOD;
+    meter->sweepCredit %= SWEEP_PERIOD;
+    if (meter->sweepSlots > slots)
+    {
+        meter->sweepSlots = slots;
+    }
+}
+
+/** Read and account the next frame, returns 0 at the end of the capture */
+static int readFrame(struct pcapMeter* meter)
+{
+    if (meter->ended || !fill(meter, PCAP_RECORD_HEADER_SIZE))
+    {
+        meter->ended = 1;
+        return 0;
+    }
+
+    uint64_t time;
+    size_t captured = pcapReadRecord(&meter->format, meter->buffer + meter->position, &time);
+
+    if (!fill(meter, PCAP_RECORD_HEADER_SIZE + captured))
+    {
+        if (meter->error == EOK)
+        {
+            fprintf(stderr, "Meter: the capture is truncated.\n");
+        }
+        meter->ended = 1;
+        return 0;
+    }
+    const unsigned char* record = meter->buffer + meter->position;
+    meter->position += PCAP_RECORD_HEADER_SIZE + captured;
+
+    advanceClock(meter, time);
+
+    if (meterFrame(meter, record + PCAP_RECORD_HEADER_SIZE, captured))
+    {
+        meter->statistics.packets++;
+    }
+    else
+    {
+        meter->statistics.skipped++;
+    }
+
+    return 1;
+}
+
+error_t openMeter(struct pcapMeter* meter, const char* path, size_t cacheSize,
+                  uint32_t activeTimeout, uint32_t inactiveTimeout)
+{
+    memset(meter, 0, sizeof(*meter));
+
+    meter->file = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (meter->file < 0)
+    {
+        return errno;
+    }
+    posix_fadvise(meter->file, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    error_t status = initializeFlowCache(&meter->cache, cacheSize, activeTimeout, inactiveTimeout,
+                                         queueFlow, meter);
+    if (status != EOK)
+    {
+        closeMeter(meter);
+        return status;
+    }
+
+    /* One frame can evict one flow, one sweep chunk expire SWEEP_CHUNK flows */
+    meter->buffer  = (unsigned char*) malloc(METER_BUFFER_SIZE);
+    meter->pending = (struct netflowRecord*) calloc(MAX_NETFLOW_RECORDS + SWEEP_CHUNK,
+                                                    sizeof(struct netflowRecord));
+    if (meter->buffer == NULL || meter->pending == NULL)
+    {
+        closeMeter(meter);
+        return ENOMEM;
+    }
+
+    if (!fill(meter, PCAP_FILE_HEADER_SIZE))
+    {
+        status = meter->error != EOK ? meter->error : EINVAL;
+        closeMeter(meter);
+        return status;
+    }
+
+    status = pcapReadHeader(meter->buffer, meter->end, &meter->format);
+    if (status != EOK)
+    {
+        closeMeter(meter);
+        return status;
+    }
+    meter->position = PCAP_FILE_HEADER_SIZE;
+
+    return EOK;
+}
+
+unsigned int takeMeteredRecords(struct pcapMeter* meter, struct netflowRecord* records,
+                                unsigned int numberOfFlows, uint32_t* sysUpTime)
+{
+    while (meter->pendingCount < numberOfFlows)
+    {
+        if (meter->sweepSlots > 0)
+        {
+            size_t slots = meter->sweepSlots < SWEEP_CHUNK ? meter->sweepSlots : SWEEP_CHUNK;
+            expireFlows(&meter->cache, meter->now, slots);
+            meter->sweepSlots -= slots;
+        }
+        else if (!readFrame(meter))
+        {
+            if (meter->cache.count == 0)
+            {
+                break;
+            }
+
+            /* End of the capture, every flow is past its inactive timeout */
+            expireFlows(&meter->cache, meter->now + meter->cache.inactiveTimeout, SWEEP_CHUNK);
+        }
+    }
+
+    unsigned int count = meter->pendingCount < numberOfFlows ? meter->pendingCount : numberOfFlows;
+    memcpy(records, meter->pending, count * sizeof(struct netflowRecord));
+
+    meter->pendingCount -= count;
+    memmove(meter->pending, meter->pending + count, meter->pendingCount * sizeof(struct netflowRecord));
+
+    meter->statistics.exported += count;
+    *sysUpTime = meter->now;
+
+    return count;
+}
+
+error_t runMeter(struct pcapMeter* meter, struct worker* worker)
+{
+    const struct cliArguments* arguments = worker->arguments;
+    unsigned int batchSize = arguments->batchSize;
+
+    struct pacer pacer;
+    pacerInitialize(&pacer, worker->rate > 0 ? worker->rate : 0, (uint64_t) (worker->rate / 100) + 1);
+
+    struct runBudget budget;
+    initializeBudget(&budget, worker);
+
+    char* pdus = (char*) malloc((size_t) batchSize * MAX_NETFLOW_PDU_SIZE);
+    if (pdus == NULL)
+    {
+        return ENOMEM;
+    }
+
+    int more = 1;
+    while (more && budgetLeft(&budget))
+    {
+        struct netflowRecord records[MAX_NETFLOW_RECORDS];
+        unsigned int count = 0;
+        unsigned int flows = 0;
+
+        uint64_t generateStart = monotonicTime();
+        while (count < batchSize && count < budget.pdus && flows < budget.flows)
+        {
+            unsigned int wanted = budget.flows - flows < arguments->maxV5Records ? budget.flows - flows
+                                                                                : arguments->maxV5Records;
+            uint32_t sysUpTime;
+
+            unsigned int taken = takeMeteredRecords(meter, records, wanted, &sysUpTime);
+            if (taken == 0)
+            {
+                more = 0;
+                break;
+            }
+
+            /* The exporter booted at the first captured second */
+            worker->exporter.systemStartTime = meter->startTime / NSECS_PER_SEC;
+
+            char* pdu = pdus + (size_t) count * MAX_NETFLOW_PDU_SIZE;
+            size_t size = makeNetflowPacket(pdu, &worker->exporter, records, taken, sysUpTime);
+            senderAddFrom(&worker->sender, pdu, size, taken, htonl(INADDR_ANY),
+                          meter->startTime + (uint64_t) sysUpTime * NSECS_PER_MSEC);
+
+            count++;
+            flows += taken;
+        }
+        statsLatency(&worker->stats, STAGE_GENERATE, monotonicTime() - generateStart);
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        budgetSpend(&budget, count, flows);
+        pacerWait(&pacer, arguments->rateInFlows ? flows : count);
+
+        flushBatch(worker);
+
+        if (pacerWindowElapsed(&pacer) >= RATE_REPORT_INTERVAL)
+        {
+            pacerReport(&pacer, stderr, arguments->rateInFlows ? "flows" : "PDUs");
+        }
+    }
+
+    free(pdus);
+
+    const struct flowCacheStatistics* cache = &meter->cache.statistics;
+    fprintf(stderr, "Meter: %llu IPv4 packets, %llu other frames skipped; %llu flows exported, "
+                    "%llu by the inactive timeout, %llu by the active timeout, %llu evicted\n",
+            (unsigned long long) meter->statistics.packets, (unsigned long long) meter->statistics.skipped,
+            (unsigned long long) meter->statistics.exported, (unsigned long long) cache->expiredInactive,
+            (unsigned long long) cache->expiredActive, (unsigned long long) cache->evicted);
+
+    return meter->error;
+}
+
+void closeMeter(struct pcapMeter* meter)
+{
+    if (meter->file > STDIN_FILENO)
+    {
+        close(meter->file);
+    }
+
+    freeFlowCache(&meter->cache);
+    free(meter->buffer);
+    free(meter->pending);
+
+    meter->file    = -1;
+    meter->buffer  = NULL;
+    meter->pending = NULL;
+}
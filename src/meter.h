@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _METER__H_
+#define _METER__H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "errors.h"
+#include "netflow.h"
+#include "flowcache.h"
+#include "pcap.h"
+#include "worker.h"
+
+/** Packet and flow counts of a metered capture */
+struct meterStatistics
+{
+    uint64_t packets;     /* IPv4 packets accounted in the flow cache */
+    uint64_t skipped;     /* Other frames (IPv6, ARP, ...) */
+    uint64_t exported;    /* Flow records taken */
+};
+
+/** Flow meter fed by a pcap capture
+ *
+ * The capture is read sequentially through a fixed buffer,
+ * so the file can be a pipe and its size doesn't matter.
+ * IPv4 packets are accounted in a flow cache keyed on the
+ * 5-tuple (@see struct flowCache), the way a router meters
+ * a link. The capture time stamps are the clock: the cache
+ * is swept once per captured second and flows expire by
+ * the active and inactive timeouts or get evicted when the
+ * cache is full. What's left is exported at the end of the
+ * capture. The memory use is bounded by the cache size.
+ */
+struct pcapMeter
+{
+    int            file;
+    unsigned char* buffer;
+    size_t         position;      /* Next unread byte in the buffer */
+    size_t         end;           /* End of the data in the buffer */
+    error_t        error;         /* Read error, EOK at the end of file */
+    int            ended;         /* No more frames to read */
+
+    struct pcapFormat format;
+
+    struct flowCache      cache;
+    struct netflowRecord* pending;      /* Expired flows waiting for export */
+    unsigned int          pendingCount;
+
+    int      started;
+    uint64_t startTime;     /* Second of the first packet [ns since the epoch] */
+    uint32_t now;           /* Uptime of the last packet [ms] */
+    uint32_t sweepTime;     /* Uptime the sweep has caught up with [ms] */
+    uint64_t sweepCredit;   /* Slot fractions not swept yet [slots * ms] */
+    size_t   sweepSlots;    /* Slots due to be checked */
+
+    struct meterStatistics statistics;
+};
+
+/**
+ * Open a capture for metering
+ *
+ * Accepts classic pcap files (us or ns time stamps, either
+ * byte order) with Ethernet, Linux cooked or raw IP frames.
+ *
+ * @param[out] meter           Meter to be initialized
+ * @param[in]  path            Capture file, "-" for stdin
+ * @param[in]  cacheSize       Maximum number of flows in the cache
+ * @param[in]  activeTimeout   Active timeout [ms]
+ * @param[in]  inactiveTimeout Inactive timeout [ms]
+ *
+ * @return EOK on success, EINVAL if it's not a pcap file, \
+ *         errno code otherwise
+ */
+error_t openMeter(struct pcapMeter* meter, const char* path, size_t cacheSize,
+                  uint32_t activeTimeout, uint32_t inactiveTimeout);
+
+/**
+ * Read packets until \c numberOfFlows flows are exported
+ *
+ * @param[in,out] meter         Open meter
+ * @param[out]    records       Exported flows (host byte order, @see makeNetflowPacket())
+ * @param[in]     numberOfFlows Maximum number of flows to take
+ * @param[out]    sysUpTime     Capture time of the export [ms since \c startTime]
+ *
+ * @return Number of records stored in \c records, less than \
+ *         \c numberOfFlows only at the end of the capture
+ */
+unsigned int takeMeteredRecords(struct pcapMeter* meter, struct netflowRecord* records,
+                                unsigned int numberOfFlows, uint32_t* sysUpTime);
+
+/**
+ * Export the flows of the capture as NetFlow v5
+ *
+ * Uses the sender, batch size, output file, rate and run
+ * limits of the worker. Without a rate (-r/-f) the capture
+ * is processed as fast as it can be read. The PDU headers
+ * carry the capture time, with the first captured second
+ * as the exporter's boot time. Returns at the end of the
+ * capture.
+ *
+ * @param[in,out] meter  Open meter
+ * @param[in,out] worker Initialized worker
+ *
+ * @return EOK on success, errno code of a read error
+ */
+error_t runMeter(struct pcapMeter* meter, struct worker* worker);
+
+/**
+ * Close the capture and free the flow cache
+ *
+ * @param[in,out] meter Open meter
+ *
+ * @return void
+ */
+void closeMeter(struct pcapMeter* meter);
+
+#endif
@@ -21,15 +21,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "netflow.h"
 #include "hosts.h"
+#include "distribution.h"
+#include "wireorder.h"
 
 #define MIN_FLOW_DURATION 1
 #define MAX_FLOW_DURATION 60
 
-/* Here goes some addresses that will be used as source and destination in netflow records. */
-/* TODO Maybe load them from a file? */
+/* Limits of the modeled flow sizes and packet sizes */
+#define MAX_FLOW_PACKETS 100000000
+#define MIN_PACKET_SIZE 40
+#define MAX_PACKET_SIZE 1500
+
+/* Ephemeral (client) ports, Linux defaults */
+#define MIN_EPHEMERAL_PORT 32768
+#define MAX_EPHEMERAL_PORT 60999
+
+/* Service port "anything else", drawn uniformly above 1023 */
+#define OTHER_PORT 0
+
+/* Here goes some addresses that will be used as source and destination in netflow records,
+   unless they are loaded from a hosts file (@see setNetflowHosts()). */
 #define NUMBER_OF_ADDRESSES 4
 const char *addresses[NUMBER_OF_ADDRESSES] =
 {
@@ -39,99 +54,456 @@ const char *addresses[NUMBER_OF_ADDRESSES] =
   "192.168.1.102"
 };
 
-/* TODO This could be more sophisticated */
-/* Is 'generate' really the right name? */
-in_addr_t generateRandomAddress()
+/* The same for IPv6 records (@see setNetflowHosts6()) */
+#define NUMBER_OF_ADDRESSES6 4
+const char *addresses6[NUMBER_OF_ADDRESSES6] =
+{
+  "::1",
+  "2001:db8::100",
+  "2001:db8::101",
+  "2001:db8::102"
+};
+
+/* Random attributes of a record. All of them are drawn at once
+   for the whole PDU by randomizeRecords(), one column per field. */
+enum randomField
+{
+  SRC_ADDRESS,
+  DST_ADDRESS,
+  PACKETS,
+  PACKET_SIZE,
+  FLOW_AGE,
+  FLOW_DURATION,
+  SRC_PORT,
+  DST_PORT,
+  PROTOCOL,
+  TCP_FLAGS,
+  NUMBER_OF_RANDOM_FIELDS
+};
+
+/* Each field is uniformly distributed in [0, range) */
+static uint32_t fieldRanges[NUMBER_OF_RANDOM_FIELDS] =
+{
+  [SRC_ADDRESS]   = NUMBER_OF_ADDRESSES,
+  [DST_ADDRESS]   = NUMBER_OF_ADDRESSES,
+  [PACKETS]       = 100000,
+  [PACKET_SIZE]   = 300,
+  [FLOW_AGE]      = MAX_FLOW_DURATION,
+  [FLOW_DURATION] = MAX_FLOW_DURATION,
+  [SRC_PORT]      = 65536,
+  [DST_PORT]      = 65536,
+  [PROTOCOL]      = 2,
+  [TCP_FLAGS]     = 255
+};
+
+/** Outcome of a weighted field */
+struct weightedValue
+{
+  uint32_t value;
+  double   weight;
+};
+
+/* Roughly the mix seen on an enterprise uplink */
+static const struct weightedValue protocolWeights[] =
+{
+  {IPPROTO_TCP, 80}, {IPPROTO_UDP, 17}, {IPPROTO_ICMP, 2}, {IPPROTO_GRE, 0.5}, {IPPROTO_ESP, 0.5}
+};
+
+static const struct weightedValue tcpPortWeights[] =
+{
+  {443, 45}, {80, 20}, {8080, 3}, {22, 3}, {25, 2}, {993, 2}, {3389, 1}, {3306, 1},
+  {445, 1}, {5223, 1}, {OTHER_PORT, 21}
+};
+
+static const struct weightedValue udpPortWeights[] =
 {
-  in_addr_t address;
+  {53, 35}, {443, 25}, {123, 10}, {4500, 3}, {161, 3}, {514, 2}, {500, 2}, {1900, 2},
+  {OTHER_PORT, 18}
+};
+
+/* Cumulative flags of complete, established, refused and scanning flows */
+static const struct weightedValue tcpFlagWeights[] =
+{
+  {0x1b, 40}, {0x1a, 15}, {0x18, 15}, {0x10, 12}, {0x1f, 5}, {0x02, 5}, {0x12, 3},
+  {0x14, 3}, {0x04, 2}
+};
 
-  convertAddress(addresses[(1 + rand()) % NUMBER_OF_ADDRESSES], &address);
-  return address;
+#define NUMBER_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+/* Sampling tables of the traffic model, read-only while PDUs are generated */
+static struct trafficModel trafficModel;
+static struct aliasTable hostPopularity;
+static struct quantileTable flowSizes;
+static struct aliasTable protocols;
+static struct aliasTable tcpPorts;
+static struct aliasTable udpPorts;
+static struct aliasTable tcpFlags;
+
+/* Addresses in network byte order, converted once. The table
+   is read-only while PDUs are being generated. */
+static in_addr_t defaultHosts[NUMBER_OF_ADDRESSES];
+static const in_addr_t* hostTable = defaultHosts;
+static uint32_t numberOfHostsInTable = NUMBER_OF_ADDRESSES;
+static pthread_once_t defaultHostsOnce = PTHREAD_ONCE_INIT;
+
+static void convertDefaultHosts(void)
+{
+  for (int i = 0; i < NUMBER_OF_ADDRESSES; i++)
+  {
+    convertAddress(addresses[i], &defaultHosts[i]);
+  }
 }
 
-in_port_t generateRandomPortNumber()
+void setNetflowHosts(const in_addr_t* hosts, size_t numberOfHosts)
 {
-  return rand() % 65536;
+  if (hosts == NULL)
+  {
+    hosts = defaultHosts;
+    numberOfHosts = NUMBER_OF_ADDRESSES;
+  }
+
+  hostTable = hosts;
+  numberOfHostsInTable = numberOfHosts;
+  fieldRanges[SRC_ADDRESS] = numberOfHosts;
+  fieldRanges[DST_ADDRESS] = numberOfHosts;
 }
 
-char generateRandomTCPFlags()
+/* IPv6 records hold indexes into hostTable6, hostTable maps every index to itself */
+static struct in6_addr defaultHosts6[NUMBER_OF_ADDRESSES6];
+static const struct in6_addr* hostTable6 = NULL;
+static in_addr_t* hostIndexes = NULL;
+
+error_t setNetflowHosts6(const struct in6_addr* hosts, size_t numberOfHosts)
 {
-  return rand() % 255;
+  if (hosts == NULL)
+  {
+    for (int i = 0; i < NUMBER_OF_ADDRESSES6; i++)
+    {
+      convertAddress6(addresses6[i], &defaultHosts6[i]);
+    }
+    hosts = defaultHosts6;
+    numberOfHosts = NUMBER_OF_ADDRESSES6;
+  }
+
+  in_addr_t* indexes = (in_addr_t*) malloc(numberOfHosts * sizeof(in_addr_t));
+  if (indexes == NULL)
+  {
+    return ENOMEM;
+  }
+  for (size_t i = 0; i < numberOfHosts; i++)
+  {
+    indexes[i] = i;
+  }
+
+  free(hostIndexes);
+  hostIndexes = indexes;
+  hostTable6 = hosts;
+  setNetflowHosts(indexes, numberOfHosts);
+
+  return EOK;
 }
 
-/* Returns size of the packet in buffer.
-   Size of buffer must be greater then 24 + 30*48 = 1464,
-   otherwise expect some segfaults. */
-size_t makeRandomNetflowPacket(char *buffer, time_t systemStartTime, unsigned int numberOfFlows, unsigned int totalFlowsSent)
+const struct in6_addr* netflowHosts6(void)
 {
-  time_t currentTime = time(0);
-  time_t systemUptime = currentTime - systemStartTime;
+  return hostTable6;
+}
 
-  struct netflowRecord record;
-  struct netflowHeader header;
+static error_t initializeWeightedTable(struct aliasTable* table, const struct weightedValue* values, uint32_t size)
+{
+  double weights[size];
 
-  for (int flow = 0;flow < numberOfFlows; flow++)
+  for (uint32_t i = 0; i < size; i++)
   {
-    // Addresses are already in network byte order
-    record.srcAddr = generateRandomAddress();
-    record.dstAddr = generateRandomAddress();
-
-    // NIY
-    record.nextHop = 0;
-    record.input = 0;
-    record.output = 0;
-
-    // Some random flow lengths
-    record.dPkts = rand() % 100000;
-    record.dOctets = record.dPkts * (rand() % 300);
-    record.dPkts = htonl(record.dPkts);
-    record.dOctets = htonl(record.dOctets);
-
-    // Flow duration
-    if (systemUptime < MAX_FLOW_DURATION)
+    weights[i] = values[i].weight;
+  }
+
+  return initializeAliasTable(table, weights, size);
+}
+
+static void freeTrafficModel(void)
+{
+  freeAliasTable(&hostPopularity);
+  freeAliasTable(&protocols);
+  freeAliasTable(&tcpPorts);
+  freeAliasTable(&udpPorts);
+  freeAliasTable(&tcpFlags);
+}
+
+error_t setTrafficModel(const struct trafficModel* model)
+{
+  error_t status = EOK;
+  uint32_t numberOfHosts = numberOfHostsInTable;
+
+  freeTrafficModel();
+  memset(&trafficModel, 0, sizeof(trafficModel));
+  fieldRanges[SRC_ADDRESS]  = numberOfHosts;
+  fieldRanges[DST_ADDRESS]  = numberOfHosts;
+  fieldRanges[PACKETS]      = 100000;
+  fieldRanges[PACKET_SIZE]  = 300;
+  fieldRanges[SRC_PORT]     = 65536;
+  fieldRanges[DST_PORT]     = 65536;
+  fieldRanges[PROTOCOL]     = 2;
+  fieldRanges[TCP_FLAGS]    = 255;
+
+  if (model == NULL)
+  {
+    return EOK;
+  }
+
+  /* Modeled fields are left as raw 32-bit numbers for the samplers */
+  if (model->hostZipf > 0)
+  {
+    status = initializeZipfTable(&hostPopularity, numberOfHosts, model->hostZipf);
+    fieldRanges[SRC_ADDRESS] = 0;
+    fieldRanges[DST_ADDRESS] = 0;
+  }
+
+  if (status == EOK && model->flowSize != FLOW_SIZE_UNIFORM)
+  {
+    if (model->flowSize == FLOW_SIZE_PARETO && model->flowSizeA > 0 && model->flowSizeB >= 1)
     {
-      record.first = 0;
+      initializeQuantileTable(&flowSizes, paretoQuantile, model->flowSizeA, model->flowSizeB, 1, MAX_FLOW_PACKETS);
+    }
+    else if (model->flowSize == FLOW_SIZE_LOGNORMAL && model->flowSizeA >= 1 && model->flowSizeB > 0)
+    {
+      initializeQuantileTable(&flowSizes, lognormalQuantile, model->flowSizeA, model->flowSizeB, 1, MAX_FLOW_PACKETS);
     }
     else
     {
-      record.first = (systemUptime - (MIN_FLOW_DURATION + rand()) % MAX_FLOW_DURATION)*1000;
+      status = EINVAL;
+    }
+    fieldRanges[PACKETS]     = 0;
+    fieldRanges[PACKET_SIZE] = MAX_PACKET_SIZE - MIN_PACKET_SIZE + 1;
+  }
+
+  if (status == EOK && model->wellKnownPorts)
+  {
+    status = initializeWeightedTable(&protocols, protocolWeights, NUMBER_OF(protocolWeights));
+    if (status == EOK)
+    {
+      status = initializeWeightedTable(&tcpPorts, tcpPortWeights, NUMBER_OF(tcpPortWeights));
+    }
+    if (status == EOK)
+    {
+      status = initializeWeightedTable(&udpPorts, udpPortWeights, NUMBER_OF(udpPortWeights));
+    }
+    if (status == EOK)
+    {
+      status = initializeWeightedTable(&tcpFlags, tcpFlagWeights, NUMBER_OF(tcpFlagWeights));
+    }
+    fieldRanges[SRC_PORT]  = 0;
+    fieldRanges[DST_PORT]  = 0;
+    fieldRanges[PROTOCOL]  = 0;
+    fieldRanges[TCP_FLAGS] = 0;
+  }
+
+  if (status != EOK)
+  {
+    setTrafficModel(NULL);
+    return status;
+  }
+
+  trafficModel = *model;
+  return EOK;
+}
+
+/* Random fields of a PDU as a structure of arrays: fields[field][flow] */
+typedef uint32_t randomColumns[NUMBER_OF_RANDOM_FIELDS][MAX_NETFLOW_RECORDS];
+
+/* Draw random fields of \c numberOfFlows records in one pass.
+   The raw numbers come from the generator. Every column is
+   scaled by one range, so the loop is a plain vectorized
+   multiply and shift. Fields with zero range are sampled
+   from the traffic model later. */
+static void randomizeRecords(struct randomState* random, randomColumns fields, unsigned int numberOfFlows)
+{
+  for (int field = 0; field < NUMBER_OF_RANDOM_FIELDS; field++)
+  {
+    uint32_t* column = fields[field];
+    uint32_t range = fieldRanges[field];
+
+    randomFill(random, column, numberOfFlows);
+    if (range == 0)
+    {
+      continue;
     }
-    record.last = record.first + (rand() % MAX_FLOW_DURATION)*1000;
-    record.first = htonl(record.first);
-    record.last = htonl(record.last);
 
-    record.srcPort = htons(generateRandomPortNumber());
-    record.dstPort = htons(generateRandomPortNumber());
+    for (unsigned int flow = 0; flow < numberOfFlows; flow++)
+    {
+      column[flow] = randomScale(column[flow], range);
+    }
+  }
+}
 
-    record.pad = 0;
+/* Host of the record address table, \c random is scaled unless hosts follow Zipf */
+static inline in_addr_t pickHost(uint32_t random)
+{
+  return hostTable[trafficModel.hostZipf > 0 ? aliasSample(&hostPopularity, random) : random];
+}
 
-    // Transport protocol (TCP|UDP)
-    record.prot = rand() % 2 ? IPPROTO_TCP : IPPROTO_UDP;
-    record.tcpFlags = record.prot == IPPROTO_TCP ? generateRandomTCPFlags() : 0;
+/* Protocol, ports and flags of a flow between a client and a well-known
+   service. Bit 0 of the source port number picks the direction. */
+static void pickService(struct netflowRecord* record, randomColumns fields, unsigned int flow)
+{
+  uint32_t dstPort = fields[DST_PORT][flow];
+  uint16_t service = 0;
+  uint16_t client = MIN_EPHEMERAL_PORT + randomScale(fields[SRC_PORT][flow], MAX_EPHEMERAL_PORT - MIN_EPHEMERAL_PORT + 1);
+  int reply = fields[SRC_PORT][flow] & 1;
 
-    // NIY
-    record.tos = 0;
-    record.srcAs = 0;
-    record.dstAs = 0;
-    record.srcMask = 0;
-    record.dstMask = 0;
+  record->prot = protocolWeights[aliasSample(&protocols, fields[PROTOCOL][flow])].value;
+  record->tcpFlags = 0;
 
-    record.drops = 0;
+  switch (record->prot)
+  {
+  case IPPROTO_TCP:
+    service = tcpPortWeights[aliasSample(&tcpPorts, dstPort)].value;
+    record->tcpFlags = tcpFlagWeights[aliasSample(&tcpFlags, fields[TCP_FLAGS][flow])].value;
+    break;
+  case IPPROTO_UDP:
+    service = udpPortWeights[aliasSample(&udpPorts, dstPort)].value;
+    break;
+  case IPPROTO_ICMP:
+    /* v5 carries ICMP type and code in the destination port: echo request or reply */
+    record->srcPort = 0;
+    record->dstPort = reply ? 0x0000 : 0x0800;
+    return;
+  default:
+    record->srcPort = 0;
+    record->dstPort = 0;
+    return;
+  }
 
-    memcpy(buffer + sizeof(struct netflowHeader) + flow*sizeof(struct netflowRecord), &record, sizeof(struct netflowRecord));
+  if (service == OTHER_PORT)
+  {
+    service = 1024 + randomScale((uint32_t) mixBits(dstPort), 65536 - 1024);
   }
 
+  record->srcPort = reply ? service : client;
+  record->dstPort = reply ? client : service;
+}
+
+void initializeExporter(struct netflowExporter* exporter, time_t systemStartTime,
+                        uint8_t engineId, const struct randomState* random)
+{
+  exporter->systemStartTime = systemStartTime;
+  exporter->flowSequence    = 0;
+  exporter->engineType      = 0;
+  exporter->engineId        = engineId;
+  exporter->random          = *random;
+
+  pthread_once(&defaultHostsOnce, convertDefaultHosts);
+}
+
+unsigned int randomNumberOfFlows(struct netflowExporter* exporter)
+{
+  return randomBounded(&exporter->random, MAX_NETFLOW_RECORDS);
+}
+
+void makeRandomNetflowRecords(struct netflowExporter* exporter, struct netflowRecord* records,
+                              unsigned int numberOfFlows, uint32_t sysUpTime)
+{
+  randomColumns fields;
+
+  for (unsigned int chunk = 0; chunk < numberOfFlows; chunk += MAX_NETFLOW_RECORDS)
+  {
+    unsigned int chunkFlows = numberOfFlows - chunk < MAX_NETFLOW_RECORDS ? numberOfFlows - chunk : MAX_NETFLOW_RECORDS;
+    randomizeRecords(&exporter->random, fields, chunkFlows);
+
+    for (unsigned int flow = 0; flow < chunkFlows; flow++)
+    {
+      struct netflowRecord* record = &records[chunk + flow];
+
+      // Addresses are already in network byte order
+      record->srcAddr = pickHost(fields[SRC_ADDRESS][flow]);
+      record->dstAddr = pickHost(fields[DST_ADDRESS][flow]);
+
+      // NIY
+      record->nextHop = 0;
+      record->input = 0;
+      record->output = 0;
+
+      // Some random flow lengths
+      if (trafficModel.flowSize != FLOW_SIZE_UNIFORM)
+      {
+        record->dPkts = quantileSample(&flowSizes, fields[PACKETS][flow]);
+
+        uint64_t octets = (uint64_t) record->dPkts * (MIN_PACKET_SIZE + fields[PACKET_SIZE][flow]);
+        record->dOctets = octets > UINT32_MAX ? UINT32_MAX : octets;
+      }
+      else
+      {
+        record->dPkts = fields[PACKETS][flow];
+        record->dOctets = record->dPkts * fields[PACKET_SIZE][flow];
+      }
+
+      // Flow duration
+      if (sysUpTime < MAX_FLOW_DURATION*1000)
+      {
+        record->first = 0;
+      }
+      else
+      {
+        record->first = sysUpTime - ((MIN_FLOW_DURATION + fields[FLOW_AGE][flow]) % MAX_FLOW_DURATION)*1000;
+      }
+      record->last = record->first + fields[FLOW_DURATION][flow]*1000;
+
+      record->pad = 0;
+
+      if (trafficModel.wellKnownPorts)
+      {
+        pickService(record, fields, flow);
+      }
+      else
+      {
+        record->srcPort = fields[SRC_PORT][flow];
+        record->dstPort = fields[DST_PORT][flow];
+
+        // Transport protocol (TCP|UDP)
+        record->prot = fields[PROTOCOL][flow] ? IPPROTO_TCP : IPPROTO_UDP;
+        record->tcpFlags = record->prot == IPPROTO_TCP ? fields[TCP_FLAGS][flow] : 0;
+      }
+
+      // NIY
+      record->tos = 0;
+      record->srcAs = 0;
+      record->dstAs = 0;
+      record->srcMask = 0;
+      record->dstMask = 0;
+
+      record->drops = 0;
+    }
+  }
+}
+
+/* Returns size of the packet in buffer.
+   Size of buffer must be greater then 24 + 30*48 = 1464,
+   otherwise expect some segfaults. */
+size_t makeRandomNetflowPacket(char *buffer, struct netflowExporter* exporter, unsigned int numberOfFlows,
+                               uint64_t now)
+{
+  uint32_t sysUpTime = netflowUptime(exporter, now);
+
+  struct netflowRecord records[MAX_NETFLOW_RECORDS];
+  struct netflowHeader header;
+
+  makeRandomNetflowRecords(exporter, records, numberOfFlows, sysUpTime);
+  writeWireRecords(buffer + sizeof(struct netflowHeader), records, numberOfFlows);
+
   /* Setup header */
   header.version      = htons(5);
   header.count        = htons(numberOfFlows);
 
-  header.sysUpTime    = htonl((currentTime - systemStartTime) * 1000); // Time since the program was run is used
-  header.unixSecs     = htonl(currentTime);
+  header.sysUpTime    = htonl(sysUpTime);
+  header.unixSecs     = htonl(now / 1000000000);
+  header.unixNsecs    = htonl(now % 1000000000);
 
-  // Random amount of residual nanoseconds is generated for testing purposes
-  header.unixNsecs    = htonl(rand() % (1000000000 - 1));
+  // Sequence number of the first flow in this PDU
+  header.flowSequence = htonl(exporter->flowSequence);
+  header.engineType   = exporter->engineType;
+  header.engineId     = exporter->engineId;
+  header.reserved     = 0;
 
-  header.flowSequence = htonl(totalFlowsSent);
+  exporter->flowSequence += numberOfFlows;
 
   memcpy(buffer, &header, sizeof(struct netflowHeader));
 
@@ -139,4 +511,44 @@ size_t makeRandomNetflowPacket(char *buffer, time_t systemStartTime, unsigned in
   return sizeof(struct netflowHeader) + numberOfFlows*sizeof(struct netflowRecord);
 }
 
+in_addr_t netflowHost(uint32_t random)
+{
+  return pickHost(fieldRanges[SRC_ADDRESS] ? randomScale(random, fieldRanges[SRC_ADDRESS]) : random);
+}
+
+size_t makeNetflowPacket(char *buffer, struct netflowExporter* exporter,
+                         const struct netflowRecord* records, unsigned int numberOfFlows,
+                         uint32_t sysUpTime)
+{
+  struct netflowHeader header;
+
+  writeWireRecords(buffer + sizeof(struct netflowHeader), records, numberOfFlows);
+
+  header.version      = htons(5);
+  header.count        = htons(numberOfFlows);
+  header.sysUpTime    = htonl(sysUpTime);
+  header.unixSecs     = htonl(exporter->systemStartTime + sysUpTime / 1000);
+  header.unixNsecs    = htonl((sysUpTime % 1000) * 1000000);
+  header.flowSequence = htonl(exporter->flowSequence);
+  header.engineType   = exporter->engineType;
+  header.engineId     = exporter->engineId;
+  header.reserved     = 0;
+
+  exporter->flowSequence += numberOfFlows;
 
+  memcpy(buffer, &header, sizeof(struct netflowHeader));
+
+  return sizeof(struct netflowHeader) + numberOfFlows*sizeof(struct netflowRecord);
+}
+
+void patchNetflowHeader(char *buffer, struct netflowExporter* exporter, uint64_t now)
+{
+  struct netflowHeader* header = (struct netflowHeader*) buffer;
+
+  header->sysUpTime    = htonl(netflowUptime(exporter, now));
+  header->unixSecs     = htonl(now / 1000000000);
+  header->unixNsecs    = htonl(now % 1000000000);
+  header->flowSequence = htonl(exporter->flowSequence);
+
+  exporter->flowSequence += ntohs(header->count);
+}
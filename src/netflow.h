@@ -20,8 +20,13 @@
 #ifndef _NETFLOW__H_
 #define _NETFLOW__H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+#include "random.h"
 
 #define MAX_NETFLOW_PDU_SIZE 1464
 #define MAX_NETFLOW_RECORDS 30
@@ -65,6 +70,123 @@ struct netflowRecord
     uint16_t drops;
 };
 
+/** State of one simulated NetFlow exporter
+ *
+ * Every exporter produces an independent v5 stream. The
+ * state is private to the thread that generates the stream,
+ * so there is no shared state in the generator.
+ */
+struct netflowExporter
+{
+    time_t       systemStartTime; /* When the exporter was "booted" */
+    uint32_t     flowSequence;    /* Number of flows exported so far */
+    uint8_t      engineType;
+    uint8_t      engineId;
+    struct randomState random;    /* Private generator of the exporter */
+};
+
+/**
+ * Initialize exporter state
+ *
+ * @param[out] exporter        Exporter to be initialized
+ * @param[in]  systemStartTime Start of the exporter
+ * @param[in]  engineId        Engine ID reported in PDU headers
+ * @param[in]  random          Initial state of the exporter's generator \
+ *                             (copied into the exporter)
+ *
+ * @return void
+ */
+void initializeExporter(struct netflowExporter* exporter, time_t systemStartTime,
+                        uint8_t engineId, const struct randomState* random);
+
+/**
+ * Set addresses used in generated records
+ *
+ * Source and destination addresses of the records are
+ * picked uniformly from \c hosts. The table is not copied
+ * and must not change while PDUs are being generated.
+ * A few built-in addresses are used by default.
+ *
+ * @param[in] hosts         Addresses in network byte order (@see readHostsFromFile()), \
+ *                          NULL for the built-in ones
+ * @param[in] numberOfHosts Number of addresses in the table (at most 2^32)
+ *
+ * @return void
+ */
+void setNetflowHosts(const in_addr_t* hosts, size_t numberOfHosts);
+
+/**
+ * Set IPv6 addresses used in generated records
+ *
+ * Records can't hold IPv6 addresses, so from now on their
+ * source and destination addresses are indexes into \c hosts
+ * and only templates with IPv6 address fields can encode
+ * them (@see netflowHosts6()). Host popularity, flow keys
+ * and the rest work on the indexes unchanged. The table is
+ * not copied.
+ *
+ * @param[in] hosts         IPv6 addresses, NULL for a few built-in ones
+ * @param[in] numberOfHosts Number of addresses in the table (at most 2^32)
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t setNetflowHosts6(const struct in6_addr* hosts, size_t numberOfHosts);
+
+/**
+ * IPv6 address table of the records
+ *
+ * @return Table indexed by the record addresses, NULL \
+ *         unless setNetflowHosts6() was called
+ */
+const struct in6_addr* netflowHosts6(void);
+
+/* Distributions of packets per flow */
+#define FLOW_SIZE_UNIFORM   0  /* 0 .. 99999 packets */
+#define FLOW_SIZE_PARETO    1
+#define FLOW_SIZE_LOGNORMAL 2
+
+/** Distributions of the random record fields
+ *
+ * The default (all zeros) draws every field uniformly.
+ */
+struct trafficModel
+{
+    double hostZipf;       /* Zipf exponent of host popularity, 0 = uniform */
+    int    flowSize;       /* FLOW_SIZE_UNIFORM, FLOW_SIZE_PARETO or FLOW_SIZE_LOGNORMAL */
+    double flowSizeA;      /* Pareto shape, lognormal median */
+    double flowSizeB;      /* Pareto minimum, lognormal sigma */
+    int    wellKnownPorts; /* Weighted protocols, service ports and TCP flags */
+};
+
+/**
+ * Set distributions of the generated records
+ *
+ * Builds the sampling tables, so sampling a field costs the
+ * same constant time whatever the distribution. Hosts are
+ * ranked by their order in the host table, the first one is
+ * the most popular. Call it after setNetflowHosts() and
+ * before any records are generated.
+ *
+ * With a flow size distribution, the average packet size
+ * of a flow is uniform between 40 and 1500 bytes. Well-known
+ * ports put a weighted service port (by protocol) on one side
+ * of the flow and an ephemeral port on the other.
+ *
+ * @param[in] model Distributions, NULL for uniform ones
+ *
+ * @return EOK on success, EINVAL on bad parameters, ENOMEM on malloc failure
+ */
+error_t setTrafficModel(const struct trafficModel* model);
+
+/**
+ * Random number of records for the next PDU
+ *
+ * @param[in,out] exporter Initialized exporter
+ *
+ * @return Number of records between 0 and MAX_NETFLOW_RECORDS - 1
+ */
+unsigned int randomNumberOfFlows(struct netflowExporter* exporter);
+
 /**
  * Make pseudo-random NetFlow PDU
  *
@@ -78,16 +200,95 @@ struct netflowRecord
  * The buffer size must be greater or equal, otherwise
  * expect some segfaults.
  *
- * @param[out] buffer Buffer for NetFlow PDU
- * @param[in]  systemStartTime Start of NetFlow exporter (this program) \
- *                             This value is later used to determine flow durations.
- * @param[in]  numberOfFLows How many records should be generated into the PDU
- * @param[in]  totalFlowsSent Total number of flows sent from \c systemStartTime \
- *                            by this exporter including \c current numberOfFlows
+ * The header carries the exporter's flow sequence number
+ * before this PDU, which is then advanced by \c numberOfFlows.
+ *
+ * @param[out]    buffer Buffer for NetFlow PDU
+ * @param[in,out] exporter Exporter that sends the PDU. Its start time \
+ *                         is used to determine flow durations.
+ * @param[in]     numberOfFLows How many records should be generated into the PDU
+ * @param[in]     now    Time of the export [ns since the epoch] (@see clockNow())
  *
  * @return Final PDU size stored in \c buffer
  */
-size_t makeRandomNetflowPacket(char *buffer, time_t systemStartTime, unsigned int numberOfFlows, unsigned int totalFlowsSent);
+size_t makeRandomNetflowPacket(char *buffer, struct netflowExporter* exporter, unsigned int numberOfFlows,
+                               uint64_t now);
 
+/**
+ * Make pseudo-random records
+ *
+ * The same records as in makeRandomNetflowPacket(), but in
+ * host byte order (addresses are in_addr_t), so they can be
+ * encoded into any export format.
+ *
+ * @param[in,out] exporter      Exporter generating the records
+ * @param[out]    records       Array of at least \c numberOfFlows records
+ * @param[in]     numberOfFlows Number of records to generate
+ * @param[in]     sysUpTime     Exporter's uptime [ms]
+ *
+ * @return void
+ */
+void makeRandomNetflowRecords(struct netflowExporter* exporter, struct netflowRecord* records,
+                              unsigned int numberOfFlows, uint32_t sysUpTime);
+
+/**
+ * Make NetFlow PDU from given records
+ *
+ * Encodes \c records into a v5 PDU sent by \c exporter.
+ * The records are in host byte order, except for the
+ * addresses, which are in network byte order (in_addr_t).
+ * Header time stamps are derived from \c sysUpTime and the
+ * exporter's start time.
+ *
+ * @param[out]    buffer        Buffer for NetFlow PDU (>= MAX_NETFLOW_PDU_SIZE)
+ * @param[in,out] exporter      Exporter that sends the PDU
+ * @param[in]     records       Records to be encoded
+ * @param[in]     numberOfFlows Number of records (<= MAX_NETFLOW_RECORDS)
+ * @param[in]     sysUpTime     Exporter's uptime at the time of export [ms]
+ *
+ * @return Final PDU size stored in \c buffer
+ */
+size_t makeNetflowPacket(char *buffer, struct netflowExporter* exporter,
+                         const struct netflowRecord* records, unsigned int numberOfFlows,
+                         uint32_t sysUpTime);
+
+/**
+ * Pick an address from the record address table
+ *
+ * @param[in] random Uniformly distributed 32-bit number
+ *
+ * @return Address in network byte order (@see setNetflowHosts())
+ */
+in_addr_t netflowHost(uint32_t random);
+
+/**
+ * Update per-packet header fields of a PDU
+ *
+ * Rewrites \c sysUpTime, \c unixSecs, \c unixNsecs and
+ * \c flowSequence of a PDU made by makeRandomNetflowPacket()
+ * so it can be sent again by \c exporter. The exporter's
+ * flow sequence is advanced by the record count of the PDU.
+ * Records are left intact.
+ *
+ * @param[in,out] buffer   NetFlow PDU
+ * @param[in,out] exporter Exporter that sends the PDU
+ * @param[in]     now      Time of the export [ns since the epoch]
+ *
+ * @return void
+ */
+void patchNetflowHeader(char *buffer, struct netflowExporter* exporter, uint64_t now);
+
+/**
+ * Uptime of an exporter
+ *
+ * @param[in] exporter Initialized exporter
+ * @param[in] now      Current time [ns since the epoch]
+ *
+ * @return sysUpTime at \c now [ms]
+ */
+static inline uint32_t netflowUptime(const struct netflowExporter* exporter, uint64_t now)
+{
+  return now / 1000000 - (uint64_t) exporter->systemStartTime * 1000;
+}
 
 #endif
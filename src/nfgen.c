@@ -24,6 +24,8 @@
 
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -36,6 +38,16 @@
 #include "udp.h"
 #include "hosts.h"
 #include "binaryoutput.h"
+#include "worker.h"
+#include "template.h"
+#include "replay.h"
+#include "meter.h"
+#include "stats.h"
+#include "collector.h"
+#include "fleet.h"
+#include "clock.h"
+#include "dataset.h"
+#include "profile.h"
 
 /* Local port number */
 #define SRC_PORT 10000
@@ -44,19 +56,327 @@
 #define DEFAULT_ADDRESS "127.0.0.1"
 #define DEFAULT_PORT 2055
 #define DEFAULT_SEED time(NULL)
+#define DEFAULT_RATE -1 /* Legacy random 0-2 s interval */
+#define DEFAULT_BATCH_SIZE 1
+#define MAX_BATCH_SIZE 1024
+#define DEFAULT_THREADS 1
+#define MAX_THREADS 256 /* Workers are told apart by the 8-bit engine ID */
+#define DEFAULT_POOL_SIZE 0 /* Fresh records in every PDU */
+#define DEFAULT_CACHE_SIZE 0 /* No flow cache simulation */
+#define DEFAULT_METER_CACHE_SIZE 262144 /* Flow cache of --meter */
+#define DEFAULT_ACTIVE_TIMEOUT 60 /* [s] */
+#define DEFAULT_INACTIVE_TIMEOUT 15 /* [s] */
+#define DEFAULT_PACKET_RATE 100000
+#define DEFAULT_LISTEN_BATCH_SIZE 64
+#define DEFAULT_STATS_INTERVAL 1 /* [s] */
+#define DEFAULT_OUTPUT_BUFFER 64 /* [MiB] */
+#define DEFAULT_PROTOCOL NETFLOW_V5
+#define DEFAULT_MTU 1500
+#define MIN_MTU 576
+#define MAX_MTU 65535
+#define IP_UDP_HEADERS_SIZE 28
+#define IPV6_EXTRA_HEADER_SIZE 20 /* IPv6 header is 40 bytes, not 20 */
+#define DEFAULT_TEMPLATE_REFRESH 20 /* [PDUs] */
+#define DEFAULT_TEMPLATE_TIMEOUT 60 /* [s] */
+#define DEFAULT_EXPORT_INTERVAL 1 /* [s] */
+#define DEFAULT_PARETO_SHAPE 1.2
+#define DEFAULT_PARETO_MINIMUM 1 /* [packets] */
+#define DEFAULT_LOGNORMAL_MEDIAN 10 /* [packets] */
+#define DEFAULT_LOGNORMAL_SIGMA 2
+
+/* Options without a short form */
+enum longOptions
+{
+  OPTION_CACHE_SIZE = 256,
+  OPTION_CONCURRENT_FLOWS,
+  OPTION_ACTIVE_TIMEOUT,
+  OPTION_INACTIVE_TIMEOUT,
+  OPTION_PACKET_RATE,
+  OPTION_PROTOCOL,
+  OPTION_FIELDS,
+  OPTION_MTU,
+  OPTION_TEMPLATE_REFRESH,
+  OPTION_TEMPLATE_TIMEOUT,
+  OPTION_OUTPUT_FORMAT,
+  OPTION_OUTPUT_BUFFER,
+  OPTION_REPLAY,
+  OPTION_REPLAY_SPEED,
+  OPTION_REPLAY_LOOP,
+  OPTION_REPLAY_REWRITE,
+  OPTION_STATS_INTERVAL,
+  OPTION_STATS_FILE,
+  OPTION_LISTEN,
+  OPTION_FANOUT,
+  OPTION_EXPORTERS,
+  OPTION_EXPORT_INTERVAL,
+  OPTION_EXPORTER_SOURCE,
+  OPTION_HOST_ZIPF,
+  OPTION_FLOW_SIZE,
+  OPTION_WELL_KNOWN_PORTS,
+  OPTION_START_TIME,
+  OPTION_FAST_FORWARD,
+  OPTION_GENERATE,
+  OPTION_GSO,
+  OPTION_ZEROCOPY,
+  OPTION_TX_RING,
+  OPTION_PROFILE,
+  OPTION_CONTROL,
+  OPTION_COUNT,
+  OPTION_FLOW_COUNT,
+  OPTION_DURATION,
+  OPTION_METER
+};
+
+static const struct option longOptions[] =
+{
+  {"cache-size",       required_argument, NULL, OPTION_CACHE_SIZE},
+  {"concurrent-flows", required_argument, NULL, OPTION_CONCURRENT_FLOWS},
+  {"active-timeout",   required_argument, NULL, OPTION_ACTIVE_TIMEOUT},
+  {"inactive-timeout", required_argument, NULL, OPTION_INACTIVE_TIMEOUT},
+  {"packet-rate",      required_argument, NULL, OPTION_PACKET_RATE},
+  {"protocol",         required_argument, NULL, OPTION_PROTOCOL},
+  {"fields",           required_argument, NULL, OPTION_FIELDS},
+  {"mtu",              required_argument, NULL, OPTION_MTU},
+  {"template-refresh", required_argument, NULL, OPTION_TEMPLATE_REFRESH},
+  {"template-timeout", required_argument, NULL, OPTION_TEMPLATE_TIMEOUT},
+  {"output-format",    required_argument, NULL, OPTION_OUTPUT_FORMAT},
+  {"output-buffer",    required_argument, NULL, OPTION_OUTPUT_BUFFER},
+  {"replay",           required_argument, NULL, OPTION_REPLAY},
+  {"replay-speed",     required_argument, NULL, OPTION_REPLAY_SPEED},
+  {"replay-loop",      required_argument, NULL, OPTION_REPLAY_LOOP},
+  {"replay-rewrite",   no_argument,       NULL, OPTION_REPLAY_REWRITE},
+  {"stats-interval",   required_argument, NULL, OPTION_STATS_INTERVAL},
+  {"stats-file",       required_argument, NULL, OPTION_STATS_FILE},
+  {"listen",           no_argument,       NULL, OPTION_LISTEN},
+  {"fanout",           required_argument, NULL, OPTION_FANOUT},
+  {"exporters",        required_argument, NULL, OPTION_EXPORTERS},
+  {"export-interval",  required_argument, NULL, OPTION_EXPORT_INTERVAL},
+  {"exporter-source",  required_argument, NULL, OPTION_EXPORTER_SOURCE},
+  {"host-zipf",        required_argument, NULL, OPTION_HOST_ZIPF},
+  {"flow-size",        required_argument, NULL, OPTION_FLOW_SIZE},
+  {"well-known-ports", no_argument,       NULL, OPTION_WELL_KNOWN_PORTS},
+  {"start-time",       required_argument, NULL, OPTION_START_TIME},
+  {"fast-forward",     required_argument, NULL, OPTION_FAST_FORWARD},
+  {"generate",         required_argument, NULL, OPTION_GENERATE},
+  {"gso",              no_argument,       NULL, OPTION_GSO},
+  {"zerocopy",         no_argument,       NULL, OPTION_ZEROCOPY},
+  {"tx-ring",          required_argument, NULL, OPTION_TX_RING},
+  {"profile",          required_argument, NULL, OPTION_PROFILE},
+  {"control",          required_argument, NULL, OPTION_CONTROL},
+  {"count",            required_argument, NULL, OPTION_COUNT},
+  {"flow-count",       required_argument, NULL, OPTION_FLOW_COUNT},
+  {"duration",         required_argument, NULL, OPTION_DURATION},
+  {"meter",            required_argument, NULL, OPTION_METER},
+  {"help",             no_argument,       NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
 
 /* TODO A helpful help could be more useful. */
 void usage(int exitCode)
 {
-  fprintf(stderr, "Usage: nfgen [-a address] [-p port] [-s seed] [-o path]\n");
-  fprintf(stderr, "  -a collector addres (default %s)\n", DEFAULT_ADDRESS);
-  fprintf(stderr, "  -p dest port (default %i)\n", DEFAULT_PORT);
+  fprintf(stderr, "Usage: nfgen [-a address[:port][,...] [--fanout mirror|shard]] [-p port] [-s seed] [-o path] [-r rate | -f rate] [-b batch] [-T threads] [-P pool] [-H hosts]\n"
+                  "             [--gso] [--zerocopy] [--tx-ring interface] [--profile file] [--control socket]\n"
+                  "             [--host-zipf s] [--flow-size uniform|pareto[:shape[:min]]|lognormal[:median[:sigma]]]\n"
+                  "             [--well-known-ports]\n"
+                  "             [--cache-size flows [--concurrent-flows flows] [--active-timeout s]\n"
+                  "              [--inactive-timeout s] [--packet-rate pps]]\n"
+                  "             [--protocol v5|v9|ipfix [--fields list] [--mtu bytes]\n"
+                  "              [--template-refresh pdus] [--template-timeout s]]\n"
+                  "             [--output-format raw|pcap] [--output-buffer MiB]\n"
+                  "             [--replay file [--replay-speed x] [--replay-loop n] [--replay-rewrite]]\n"
+                  "             [--meter capture [--cache-size flows] [--active-timeout s] [--inactive-timeout s]]\n"
+                  "             [--exporters n [--export-interval s] [--exporter-source address]]\n"
+                  "             [--start-time unix-time] [--fast-forward s]\n"
+                  "             [--count pdus] [--flow-count flows] [--duration s]\n"
+                  "       nfgen --generate pdus -o path (-r rate | -f rate) [-s seed] [-T threads] [-H hosts]\n"
+                  "             [--output-format raw|pcap] [--start-time unix-time] [traffic model options]\n"
+                  "             [--stats-interval s] [--stats-file path]\n"
+                  "       nfgen --listen [-a address] [-p port] [-b batch] [--stats-interval s]\n");
+  fprintf(stderr, "  -a collector addres, or a comma separated list of address[:port] (default %s),\n"
+                  "     IPv6 collectors as [address]:port\n", DEFAULT_ADDRESS);
+  fprintf(stderr, "  -p dest port, unless given with the address (default %i)\n", DEFAULT_PORT);
+  fprintf(stderr, "  --fanout with more collectors, send every PDU to all of them (mirror) or\n"
+                  "           spread the PDUs round robin (shard) (default mirror)\n");
   fprintf(stderr, "  -s generator seed (default randomized)\n");
   fprintf(stderr, "  -o output file\n");
+  fprintf(stderr, "  -r send rate in PDUs per second (0 = as fast as possible)\n");
+  fprintf(stderr, "  -f send rate in flows per second\n");
+  fprintf(stderr, "  -b PDUs per sendmmsg() call (default %i, max %i)\n", DEFAULT_BATCH_SIZE, MAX_BATCH_SIZE);
+  fprintf(stderr, "  --gso send runs of equally sized PDUs of a batch as UDP_SEGMENT super-buffers,\n"
+                  "        random v5 PDUs are full (%i records, one less to IPv6 collectors)\n", MAX_NETFLOW_RECORDS);
+  fprintf(stderr, "  --zerocopy send with MSG_ZEROCOPY, pays off with --gso on a real NIC\n");
+  fprintf(stderr, "  --tx-ring send through an AF_PACKET TX ring of this interface with crafted\n"
+                  "            IP/UDP headers, any --exporter-source works (needs CAP_NET_RAW)\n");
+  fprintf(stderr, "  --profile file with the rate over time, as factors of -r/-f: one segment per line,\n"
+                  "            seconds and constant f, ramp from to, steps from to n,\n"
+                  "            sine mean amplitude period or burst base peak length period\n");
+  fprintf(stderr, "  --control change the rate at run time through this unix socket: rate r, pause,\n"
+                  "            resume, status\n");
+  fprintf(stderr, "  -T number of generator threads, each one is a separate exporter (default %i, max %i)\n", DEFAULT_THREADS, MAX_THREADS);
+  fprintf(stderr, "  -H file with addresses (or CIDR ranges) used in the records, IPv6 ones with IPv6 fields\n");
+  fprintf(stderr, "  -P pre-generate this many PDUs per thread and resend them with updated headers\n");
+  fprintf(stderr, "  --host-zipf host popularity follows Zipf's law with this exponent, the first host is the most popular\n");
+  fprintf(stderr, "  --flow-size distribution of packets per flow: uniform, pareto (default shape %.1f, min %i)\n"
+                  "              or lognormal (default median %i, sigma %i)\n",
+          DEFAULT_PARETO_SHAPE, DEFAULT_PARETO_MINIMUM, DEFAULT_LOGNORMAL_MEDIAN, DEFAULT_LOGNORMAL_SIGMA);
+  fprintf(stderr, "  --well-known-ports weighted protocols, service ports and TCP flags instead of uniform ones\n");
+  fprintf(stderr, "  --cache-size simulate a router flow cache of this size, records are made of expired flows\n");
+  fprintf(stderr, "  --concurrent-flows number of flows receiving packets at once (default half of the cache)\n");
+  fprintf(stderr, "  --active-timeout active flow timeout in seconds (default %i)\n", DEFAULT_ACTIVE_TIMEOUT);
+  fprintf(stderr, "  --inactive-timeout inactive flow timeout in seconds (default %i)\n", DEFAULT_INACTIVE_TIMEOUT);
+  fprintf(stderr, "  --packet-rate simulated packets per second per exporter (default %i)\n", DEFAULT_PACKET_RATE);
+  fprintf(stderr, "  --protocol export protocol v5, v9 or ipfix (default v5)\n");
+  fprintf(stderr, "  --fields v9/IPFIX template fields: full, basic or a comma separated list of\n"
+                  "           srcaddr, dstaddr, nexthop, input, output, packets, bytes, first, last,\n"
+                  "           start, end, srcport, dstport, tcpflags, proto, tos, srcas, dstas,\n"
+                  "           srcmask, dstmask, or their IPv6 counterparts full6, basic6, srcaddr6,\n"
+                  "           dstaddr6, nexthop6, srcmask6, dstmask6 (default full)\n");
+  fprintf(stderr, "  --mtu v9/IPFIX PDUs are packed up to this MTU (default %i)\n", DEFAULT_MTU);
+  fprintf(stderr, "  --template-refresh resend the template every this many PDUs (default %i)\n", DEFAULT_TEMPLATE_REFRESH);
+  fprintf(stderr, "  --template-timeout resend the template every this many seconds (default %i)\n", DEFAULT_TEMPLATE_TIMEOUT);
+  fprintf(stderr, "  --exporters simulate this many exporters spread over the threads, each one sends a PDU\n"
+                  "              every export interval (max %i)\n", MAX_EXPORTERS);
+  fprintf(stderr, "  --export-interval mean interval between two PDUs of one exporter in seconds (default %i)\n", DEFAULT_EXPORT_INTERVAL);
+  fprintf(stderr, "  --exporter-source exporters send from consecutive local addresses starting at this one\n");
+  fprintf(stderr, "  --start-time time stamps start at this unix time instead of now\n");
+  fprintf(stderr, "  --fast-forward generate this many seconds of traffic as fast as possible and exit,\n"
+                  "                 the time stamps follow -r/-f or --export-interval\n");
+  fprintf(stderr, "  --count stop after this many PDUs, --flow-count after this many flows (the last\n"
+                  "          PDU is cut short), --duration after this many seconds of wall clock time\n");
+  fprintf(stderr, "  --generate write this many PDUs into -o as fast as possible and exit without sending,\n"
+                  "             the file is the same for any -T\n");
+  fprintf(stderr, "  --output-format raw PDUs or pcap capture with IP/UDP headers (default raw)\n");
+  fprintf(stderr, "  --output-buffer output file buffer, PDUs are dropped from the file when it's full (default %i)\n", DEFAULT_OUTPUT_BUFFER);
+  fprintf(stderr, "  --listen receive PDUs on -a/-p and report rates and lost PDUs (-b sets the recvmmsg() batch, default %i)\n", DEFAULT_LISTEN_BATCH_SIZE);
+  fprintf(stderr, "  --stats-interval print a summary line and update the stats file this often, 0 = never (default %i)\n", DEFAULT_STATS_INTERVAL);
+  fprintf(stderr, "  --stats-file store a JSON snapshot of the statistics into this file\n");
+  fprintf(stderr, "  --replay send PDUs from a file recorded by -o or a pcap capture instead of generating them\n");
+  fprintf(stderr, "  --replay-speed multiplier of the recorded timing, 0 = as fast as possible (default 1)\n");
+  fprintf(stderr, "  --replay-loop send the file this many times, 0 = forever (default 1)\n");
+  fprintf(stderr, "  --replay-rewrite set header time stamps to now and renumber the sequences\n");
+  fprintf(stderr, "  --meter meter the IPv4 packets of a pcap capture (- for stdin) into flows and send them\n"
+                  "          as NetFlow v5, the flow cache holds --cache-size flows (default %i)\n", DEFAULT_METER_CACHE_SIZE);
 
   exit(exitCode);
 }
 
+/** Parse comma separated address[:port] list, IPv6 as [address][:port], port 0 means -p */
+static error_t parseDestinations(const char* list, struct destination** destinations,
+                                 unsigned int* numberOfDestinations)
+{
+  error_t status = EOK;
+  char* copy = strdup(list);
+  char* context = NULL;
+
+  *destinations = (struct destination*) calloc(MAX_DESTINATIONS, sizeof(struct destination));
+  *numberOfDestinations = 0;
+  if (copy == NULL || *destinations == NULL)
+  {
+    free(copy);
+    return ENOMEM;
+  }
+
+  for (char* item = strtok_r(copy, ",", &context); item != NULL && status == EOK;
+       item = strtok_r(NULL, ",", &context))
+  {
+    if (*numberOfDestinations == MAX_DESTINATIONS)
+    {
+      status = E2BIG;
+      break;
+    }
+
+    struct destination* destination = &(*destinations)[*numberOfDestinations];
+    char* port = strchr(item, ':');
+
+    /* A bare IPv6 address has no port, a bracketed one may have */
+    destination->family = AF_INET;
+    if (item[0] == '[')
+    {
+      char* bracket = strchr(item, ']');
+      if (bracket == NULL || (bracket[1] != '\0' && bracket[1] != ':'))
+      {
+        status = EINVAL;
+        break;
+      }
+      *bracket = '\0';
+      port = bracket[1] == ':' ? bracket + 1 : NULL;
+      item++;
+      destination->family = AF_INET6;
+    }
+    else if (port != NULL && strchr(port + 1, ':') != NULL)
+    {
+      port = NULL;
+      destination->family = AF_INET6;
+    }
+
+    destination->port = 0;
+    if (port != NULL)
+    {
+      *port++ = '\0';
+      long value = strtol(port, NULL, 10);
+      if (value <= 0 || value > UINT16_MAX)
+      {
+        status = EINVAL;
+        break;
+      }
+      destination->port = value;
+    }
+
+    status = destination->family == AF_INET6 ? convertAddress6(item, &destination->address6) :
+                                               convertAddress(item, &destination->address);
+    (*numberOfDestinations)++;
+  }
+
+  if (status == EOK && *numberOfDestinations == 0)
+  {
+    status = EINVAL;
+  }
+
+  free(copy);
+  return status;
+}
+
+/** Parse uniform, pareto[:shape[:min]] or lognormal[:median[:sigma]] */
+static error_t parseFlowSize(const char* specification, struct trafficModel* model)
+{
+  const char* parameters = strchr(specification, ':');
+  size_t length = parameters != NULL ? (size_t) (parameters - specification) : strlen(specification);
+  double a, b;
+
+  if (strncmp(specification, "uniform", length) == 0 && length == strlen("uniform"))
+  {
+    model->flowSize = FLOW_SIZE_UNIFORM;
+    return parameters == NULL ? EOK : EINVAL;
+  }
+
+  if (strncmp(specification, "pareto", length) == 0 && length == strlen("pareto"))
+  {
+    model->flowSize = FLOW_SIZE_PARETO;
+    a = DEFAULT_PARETO_SHAPE;
+    b = DEFAULT_PARETO_MINIMUM;
+  }
+  else if (strncmp(specification, "lognormal", length) == 0 && length == strlen("lognormal"))
+  {
+    model->flowSize = FLOW_SIZE_LOGNORMAL;
+    a = DEFAULT_LOGNORMAL_MEDIAN;
+    b = DEFAULT_LOGNORMAL_SIGMA;
+  }
+  else
+  {
+    return EINVAL;
+  }
+
+  if (parameters != NULL && sscanf(parameters, ":%lf:%lf", &a, &b) < 1)
+  {
+    return EINVAL;
+  }
+
+  model->flowSizeA = a;
+  model->flowSizeB = b;
+
+  return EOK;
+}
+
 struct cliArguments parseCliArguments(int argc, char **argv)
 {
   error_t status = EOK;
@@ -64,18 +384,63 @@ struct cliArguments parseCliArguments(int argc, char **argv)
   struct cliArguments arguments;
   convertAddress(DEFAULT_ADDRESS, &arguments.address);
   arguments.port       = DEFAULT_PORT;
+  arguments.destinations = NULL;
+  arguments.numberOfDestinations = 0;
+  arguments.fanout     = FANOUT_MIRROR;
   arguments.seed       = DEFAULT_SEED;
   arguments.outputFile = NULL;
+  arguments.outputFormat = OUTPUT_RAW;
+  arguments.exporters      = 0;
+  arguments.exportInterval = DEFAULT_EXPORT_INTERVAL;
+  arguments.exporterSource = htonl(INADDR_ANY);
+  arguments.listen        = 0;
+  arguments.startTime     = 0;
+  arguments.fastForward   = 0;
+  arguments.generate      = 0;
+  arguments.pduLimit      = 0;
+  arguments.flowLimit     = 0;
+  arguments.duration      = 0;
+  arguments.statsInterval = DEFAULT_STATS_INTERVAL;
+  arguments.statsFile     = NULL;
+  arguments.replayFile    = NULL;
+  arguments.replaySpeed   = 1;
+  arguments.replayLoops   = 1;
+  arguments.replayRewrite = 0;
+  arguments.meterFile     = NULL;
+  arguments.outputBuffer = (size_t) DEFAULT_OUTPUT_BUFFER << 20;
   arguments.help       = 0;
+  arguments.rate       = DEFAULT_RATE;
+  arguments.rateInFlows = 0;
+  arguments.batchSize  = DEFAULT_BATCH_SIZE;
+  arguments.offload    = 0;
+  arguments.txRing     = NULL;
+  arguments.profileFile = NULL;
+  arguments.controlSocket = NULL;
+  arguments.threads    = DEFAULT_THREADS;
+  arguments.poolSize   = DEFAULT_POOL_SIZE;
+  arguments.hostsFile  = NULL;
+  memset(&arguments.traffic, 0, sizeof(arguments.traffic));
+  arguments.cacheSize  = DEFAULT_CACHE_SIZE;
+  arguments.concurrentFlows = 0;
+  arguments.activeTimeout   = DEFAULT_ACTIVE_TIMEOUT;
+  arguments.inactiveTimeout = DEFAULT_INACTIVE_TIMEOUT;
+  arguments.packetRate      = DEFAULT_PACKET_RATE;
+  arguments.protocol        = DEFAULT_PROTOCOL;
+  arguments.fields          = NULL;
+  arguments.maxPduSize      = DEFAULT_MTU - IP_UDP_HEADERS_SIZE;
+  arguments.maxV5Records    = MAX_NETFLOW_RECORDS;
+  arguments.templateRefresh = DEFAULT_TEMPLATE_REFRESH;
+  arguments.templateTimeout = DEFAULT_TEMPLATE_TIMEOUT;
 
   int option;
   /* TODO Some validation would be nice ... */
-  while ((option = getopt(argc, argv, "a:p:s:o:h")) != -1)
+  while ((option = getopt_long(argc, argv, "a:p:s:o:r:f:b:T:P:H:h", longOptions, NULL)) != -1)
   {
     switch (option)
     {
     case 'a':
-      status = convertAddress(optarg, &arguments.address);
+      free(arguments.destinations);
+      status = parseDestinations(optarg, &arguments.destinations, &arguments.numberOfDestinations);
       if (status != EOK)
       {
         printError(status, "Invalid 'a' option argument");
@@ -92,6 +457,281 @@ struct cliArguments parseCliArguments(int argc, char **argv)
       arguments.outputFile = (char*) malloc((strlen(optarg) + 1)*sizeof(char));
       strcpy(arguments.outputFile, optarg);
       break;
+    case 'r':
+    case 'f':
+      arguments.rate = atof(optarg);
+      arguments.rateInFlows = option == 'f';
+      if (arguments.rate < 0)
+      {
+        printError(EINVAL, "Invalid rate");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case 'b':
+      arguments.batchSize = atoi(optarg);
+      if (arguments.batchSize < 1 || arguments.batchSize > MAX_BATCH_SIZE)
+      {
+        printError(EINVAL, "Invalid batch size");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case 'T':
+      arguments.threads = atoi(optarg);
+      if (arguments.threads < 1 || arguments.threads > MAX_THREADS)
+      {
+        printError(EINVAL, "Invalid number of threads");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case 'P':
+      arguments.poolSize = strtoul(optarg, NULL, 10);
+      break;
+    case 'H':
+      arguments.hostsFile = optarg;
+      break;
+    case OPTION_HOST_ZIPF:
+      arguments.traffic.hostZipf = atof(optarg);
+      if (arguments.traffic.hostZipf < 0)
+      {
+        printError(EINVAL, "Invalid Zipf exponent");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_FLOW_SIZE:
+      status = parseFlowSize(optarg, &arguments.traffic);
+      if (status != EOK)
+      {
+        printError(status, "Invalid flow size distribution");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_WELL_KNOWN_PORTS:
+      arguments.traffic.wellKnownPorts = 1;
+      break;
+    case OPTION_CACHE_SIZE:
+      arguments.cacheSize = strtoul(optarg, NULL, 10);
+      break;
+    case OPTION_CONCURRENT_FLOWS:
+      arguments.concurrentFlows = strtoul(optarg, NULL, 10);
+      break;
+    case OPTION_ACTIVE_TIMEOUT:
+      arguments.activeTimeout = atoi(optarg);
+      break;
+    case OPTION_INACTIVE_TIMEOUT:
+      arguments.inactiveTimeout = atoi(optarg);
+      break;
+    case OPTION_PACKET_RATE:
+      arguments.packetRate = atof(optarg);
+      if (arguments.packetRate <= 0)
+      {
+        printError(EINVAL, "Invalid packet rate");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_PROTOCOL:
+      if (strcmp(optarg, "v5") == 0 || strcmp(optarg, "5") == 0)
+      {
+        arguments.protocol = NETFLOW_V5;
+      }
+      else if (strcmp(optarg, "v9") == 0 || strcmp(optarg, "9") == 0)
+      {
+        arguments.protocol = NETFLOW_V9;
+      }
+      else if (strcmp(optarg, "ipfix") == 0 || strcmp(optarg, "10") == 0)
+      {
+        arguments.protocol = IPFIX;
+      }
+      else
+      {
+        printError(EINVAL, "Unknown protocol");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_OUTPUT_FORMAT:
+      if (strcmp(optarg, "raw") == 0)
+      {
+        arguments.outputFormat = OUTPUT_RAW;
+      }
+      else if (strcmp(optarg, "pcap") == 0)
+      {
+        arguments.outputFormat = OUTPUT_PCAP;
+      }
+      else
+      {
+        printError(EINVAL, "Unknown output format");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_OUTPUT_BUFFER:
+      {
+        long megabytes = atol(optarg);
+        if (megabytes <= 0)
+        {
+          printError(EINVAL, "Invalid output buffer size");
+          usage(EXIT_FAILURE);
+        }
+        arguments.outputBuffer = (size_t) megabytes << 20;
+      }
+      break;
+    case OPTION_FANOUT:
+      if (strcmp(optarg, "mirror") == 0)
+      {
+        arguments.fanout = FANOUT_MIRROR;
+      }
+      else if (strcmp(optarg, "shard") == 0)
+      {
+        arguments.fanout = FANOUT_SHARD;
+      }
+      else
+      {
+        printError(EINVAL, "Unknown fanout");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_LISTEN:
+      arguments.listen = 1;
+      break;
+    case OPTION_EXPORTERS:
+      arguments.exporters = strtoul(optarg, NULL, 10);
+      if (arguments.exporters < 1 || arguments.exporters > MAX_EXPORTERS)
+      {
+        printError(EINVAL, "Invalid number of exporters");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_EXPORT_INTERVAL:
+      arguments.exportInterval = atof(optarg);
+      if (arguments.exportInterval <= 0)
+      {
+        printError(EINVAL, "Invalid export interval");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_EXPORTER_SOURCE:
+      status = convertAddress(optarg, &arguments.exporterSource);
+      if (status != EOK)
+      {
+        printError(status, "Invalid exporter source address");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_START_TIME:
+      {
+        double startTime = atof(optarg);
+        if (startTime <= 0 || startTime >= UINT32_MAX)
+        {
+          printError(EINVAL, "Invalid start time");
+          usage(EXIT_FAILURE);
+        }
+        arguments.startTime = (uint64_t) (startTime * NSECS_PER_SEC);
+      }
+      break;
+    case OPTION_FAST_FORWARD:
+      arguments.fastForward = atof(optarg);
+      if (arguments.fastForward <= 0)
+      {
+        printError(EINVAL, "Invalid fast forward time");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_GENERATE:
+      arguments.generate = strtoull(optarg, NULL, 10);
+      if (arguments.generate == 0)
+      {
+        printError(EINVAL, "Invalid number of generated PDUs");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_COUNT:
+      arguments.pduLimit = strtoull(optarg, NULL, 10);
+      if (arguments.pduLimit == 0)
+      {
+        printError(EINVAL, "Invalid number of PDUs");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_FLOW_COUNT:
+      arguments.flowLimit = strtoull(optarg, NULL, 10);
+      if (arguments.flowLimit == 0)
+      {
+        printError(EINVAL, "Invalid number of flows");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_DURATION:
+      arguments.duration = atof(optarg);
+      if (arguments.duration <= 0)
+      {
+        printError(EINVAL, "Invalid run duration");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_GSO:
+      arguments.offload |= UDP_OFFLOAD_GSO;
+      break;
+    case OPTION_ZEROCOPY:
+      arguments.offload |= UDP_OFFLOAD_ZEROCOPY;
+      break;
+    case OPTION_TX_RING:
+      arguments.txRing = optarg;
+      break;
+    case OPTION_PROFILE:
+      arguments.profileFile = optarg;
+      break;
+    case OPTION_CONTROL:
+      arguments.controlSocket = optarg;
+      break;
+    case OPTION_STATS_INTERVAL:
+      arguments.statsInterval = atof(optarg);
+      if (arguments.statsInterval < 0)
+      {
+        printError(EINVAL, "Invalid stats interval");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_STATS_FILE:
+      arguments.statsFile = optarg;
+      break;
+    case OPTION_REPLAY:
+      arguments.replayFile = optarg;
+      break;
+    case OPTION_REPLAY_SPEED:
+      arguments.replaySpeed = atof(optarg);
+      if (arguments.replaySpeed < 0)
+      {
+        printError(EINVAL, "Invalid replay speed");
+        usage(EXIT_FAILURE);
+      }
+      break;
+    case OPTION_REPLAY_LOOP:
+      arguments.replayLoops = strtoul(optarg, NULL, 10);
+      break;
+    case OPTION_REPLAY_REWRITE:
+      arguments.replayRewrite = 1;
+      break;
+    case OPTION_METER:
+      arguments.meterFile = optarg;
+      break;
+    case OPTION_FIELDS:
+      arguments.fields = optarg;
+      break;
+    case OPTION_MTU:
+      {
+        int mtu = atoi(optarg);
+        if (mtu < MIN_MTU || mtu > MAX_MTU)
+        {
+          printError(EINVAL, "Invalid MTU");
+          usage(EXIT_FAILURE);
+        }
+        arguments.maxPduSize = mtu - IP_UDP_HEADERS_SIZE;
+      }
+      break;
+    case OPTION_TEMPLATE_REFRESH:
+      arguments.templateRefresh = strtoul(optarg, NULL, 10);
+      break;
+    case OPTION_TEMPLATE_TIMEOUT:
+      arguments.templateTimeout = strtoul(optarg, NULL, 10);
+      break;
     case 'h':
         usage(EXIT_SUCCESS);
         break;
@@ -101,6 +741,177 @@ struct cliArguments parseCliArguments(int argc, char **argv)
     }
   }
 
+  if (arguments.destinations == NULL)
+  {
+    arguments.destinations = (struct destination*) calloc(1, sizeof(struct destination));
+    if (arguments.destinations == NULL)
+    {
+      printError(ENOMEM, "Unable to allocate collectors");
+      exit(EXIT_FAILURE);
+    }
+    arguments.destinations[0].family  = AF_INET;
+    arguments.destinations[0].address = arguments.address;
+    arguments.numberOfDestinations = 1;
+  }
+
+  for (unsigned int i = 0; i < arguments.numberOfDestinations; i++)
+  {
+    if (arguments.destinations[i].port == 0)
+    {
+      arguments.destinations[i].port = arguments.port;
+    }
+  }
+  arguments.address = arguments.destinations[0].address;
+  arguments.port    = arguments.destinations[0].port;
+
+  int ipv6Collectors = 0;
+  for (unsigned int i = 0; i < arguments.numberOfDestinations; i++)
+  {
+    ipv6Collectors |= arguments.destinations[i].family == AF_INET6;
+  }
+
+  /* These build IPv4 headers themselves */
+  if (ipv6Collectors && (arguments.listen || arguments.txRing != NULL ||
+                         arguments.exporterSource != htonl(INADDR_ANY) || arguments.outputFormat == OUTPUT_PCAP))
+  {
+    printError(EINVAL, "IPv6 collectors don't work with --listen, --tx-ring, --exporter-source or pcap output");
+    usage(EXIT_FAILURE);
+  }
+
+  /* The same PDUs go to all collectors, so all get the smaller size.
+     A full v5 PDU would exceed a 1500 byte MTU over IPv6, so v5 PDUs
+     carry one record less (29 records, 1416 bytes). */
+  if (ipv6Collectors)
+  {
+    arguments.maxPduSize -= IPV6_EXTRA_HEADER_SIZE;
+    arguments.maxV5Records = (MAX_NETFLOW_PDU_SIZE - IPV6_EXTRA_HEADER_SIZE - sizeof(struct netflowHeader)) /
+                             sizeof(struct netflowRecord);
+  }
+
+  if (arguments.replayFile != NULL && arguments.threads > 1)
+  {
+    printError(EINVAL, "Replay runs in a single thread");
+    usage(EXIT_FAILURE);
+  }
+
+  if (arguments.meterFile != NULL)
+  {
+    if (arguments.threads > 1 || arguments.protocol != NETFLOW_V5)
+    {
+      printError(EINVAL, "Metering (--meter) runs in a single thread and exports NetFlow v5");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.replayFile != NULL || arguments.poolSize > 0 || arguments.exporters > 0 ||
+        arguments.fastForward > 0 || arguments.generate > 0 ||
+        arguments.profileFile != NULL || arguments.controlSocket != NULL)
+    {
+      printError(EINVAL, "Metering (--meter) exports the flows of the capture, no replay, pool, exporters, "
+                         "fast forward, dataset or load profile");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.cacheSize == 0)
+    {
+      arguments.cacheSize = DEFAULT_METER_CACHE_SIZE;
+    }
+  }
+
+  if (arguments.poolSize > 0 && arguments.protocol != NETFLOW_V5)
+  {
+    printError(EINVAL, "PDU pool (-P) works only with NetFlow v5");
+    usage(EXIT_FAILURE);
+  }
+
+  if (arguments.exporters > 0)
+  {
+    if (arguments.replayFile != NULL || arguments.cacheSize > 0 || arguments.poolSize > 0)
+    {
+      printError(EINVAL, "Exporters (--exporters) generate random records, no replay, pool or flow cache");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.rate >= 0)
+    {
+      printError(EINVAL, "The rate of exporters is set by --export-interval, not -r/-f");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.exporters < arguments.threads)
+    {
+      printError(EINVAL, "Every thread needs at least one exporter");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.exporterSource != htonl(INADDR_ANY) &&
+        ntohl(arguments.exporterSource) > UINT32_MAX - (arguments.exporters - 1))
+    {
+      printError(EINVAL, "Exporter source addresses run out of the address space");
+      usage(EXIT_FAILURE);
+    }
+  }
+  else if (arguments.exporterSource != htonl(INADDR_ANY))
+  {
+    printError(EINVAL, "--exporter-source works only with --exporters");
+    usage(EXIT_FAILURE);
+  }
+
+  if (arguments.txRing != NULL && arguments.offload != 0)
+  {
+    printError(EINVAL, "The TX ring (--tx-ring) bypasses the UDP socket, no --gso or --zerocopy");
+    usage(EXIT_FAILURE);
+  }
+
+  if (arguments.profileFile != NULL || arguments.controlSocket != NULL)
+  {
+    if (arguments.rate <= 0)
+    {
+      printError(EINVAL, "A load profile (--profile) or rate control (--control) needs a rate (-r/-f)");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.replayFile != NULL || arguments.exporters > 0)
+    {
+      printError(EINVAL, "A load profile (--profile) or rate control (--control) works only without replay or --exporters");
+      usage(EXIT_FAILURE);
+    }
+  }
+
+  if (arguments.fastForward > 0)
+  {
+    if (arguments.replayFile != NULL || arguments.cacheSize > 0)
+    {
+      printError(EINVAL, "Fast forward (--fast-forward) works only with generated records, no replay or flow cache");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.exporters == 0 && arguments.rate <= 0)
+    {
+      printError(EINVAL, "Fast forward (--fast-forward) needs a rate (-r/-f) or --exporters");
+      usage(EXIT_FAILURE);
+    }
+  }
+
+  if (arguments.generate > 0)
+  {
+    if (arguments.outputFile == NULL || arguments.rate <= 0)
+    {
+      printError(EINVAL, "Generating a dataset (--generate) needs an output file (-o) and a rate (-r/-f)");
+      usage(EXIT_FAILURE);
+    }
+    if (arguments.replayFile != NULL || arguments.cacheSize > 0 || arguments.poolSize > 0 ||
+        arguments.exporters > 0 || arguments.fastForward > 0 || arguments.protocol != NETFLOW_V5 ||
+        arguments.profileFile != NULL || arguments.controlSocket != NULL)
+    {
+      printError(EINVAL, "Generating a dataset (--generate) works only with random NetFlow v5 records");
+      usage(EXIT_FAILURE);
+    }
+  }
+
+  if (arguments.generate > 0 && (arguments.pduLimit > 0 || arguments.flowLimit > 0 || arguments.duration > 0))
+  {
+    printError(EINVAL, "Generating a dataset (--generate) is limited by its own count, no --count, --flow-count or --duration");
+    usage(EXIT_FAILURE);
+  }
+
+  if (arguments.concurrentFlows == 0)
+  {
+    arguments.concurrentFlows = arguments.cacheSize / 2 + 1;
+  }
+
   return arguments;
 }
 
@@ -110,6 +921,36 @@ void freeCliArguments(struct cliArguments arguments)
     {
         free(arguments.outputFile);
     }
+
+    free(arguments.destinations);
+}
+
+/* Collector stopped by SIGINT/SIGTERM, NULL when generating */
+static struct collector* runningCollector = NULL;
+
+/** SIGINT/SIGTERM: send the batches in flight, flush the output and report */
+static void handleStop(int signalNumber)
+{
+  (void) signalNumber;
+
+  stopWorkers();
+  if (runningCollector != NULL)
+  {
+    stopCollector(runningCollector);
+  }
+}
+
+static void installStopHandler(void)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = handleStop;
+  /* A second signal kills nfgen right away */
+  action.sa_flags = SA_RESTART | SA_RESETHAND;
+
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
 }
 
 int main(int argc, char **argv)
@@ -118,53 +959,284 @@ int main(int argc, char **argv)
   
   struct cliArguments arguments = parseCliArguments(argc, argv);
 
-  time_t systemStartTime = time(0);
-  unsigned int numberOfFlows = 0;
-  unsigned int totalFlowsSent = 0;
+  if (arguments.listen)
+  {
+    struct collector collector;
+    status = initializeCollector(&collector, arguments.address, arguments.port,
+                                 arguments.batchSize > 1 ? arguments.batchSize : DEFAULT_LISTEN_BATCH_SIZE,
+                                 (uint64_t) (arguments.statsInterval * 1e9));
+    if (status != EOK)
+    {
+      printError(status, "Unable to listen");
+      exit(EXIT_FAILURE);
+    }
+
+    runningCollector = &collector;
+    installStopHandler();
 
-  /* Initialize generator */
-  srand(arguments.seed);
+    status = runCollector(&collector);
+    if (status != EOK)
+    {
+      printError(status, "Receiving failed");
+    }
 
-  char buffer[MAX_NETFLOW_PDU_SIZE];
-  memset(buffer, 0, MAX_NETFLOW_PDU_SIZE);
-  size_t pduSize;
+    collectorReport(&collector, stderr);
+    closeCollector(&collector);
+    freeCliArguments(arguments);
 
-  int udpSocket = udpInitialize();
-  FILE* outputFile = (arguments.outputFile != NULL) ? openOutputFile(arguments.outputFile) : NULL;
+    return status == EOK ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-  while(1)
+  uint64_t startTime = arguments.startTime != 0 ? arguments.startTime : wallClockTime();
+
+  in_addr_t* hosts = NULL;
+  struct in6_addr* hosts6 = NULL;
+  size_t numberOfHosts = 0;
+  if (arguments.protocol != NETFLOW_V5 && templateFieldsIpv6(arguments.fields))
   {
-    numberOfFlows = (1 + rand()) % MAX_NETFLOW_RECORDS;
-    totalFlowsSent += numberOfFlows;
-    pduSize = makeRandomNetflowPacket(buffer, systemStartTime, numberOfFlows, totalFlowsSent);
+    if (arguments.hostsFile != NULL)
+    {
+      status = readHosts6FromFile(arguments.hostsFile, &hosts6, &numberOfHosts);
+      if (status == EOK && (numberOfHosts == 0 || numberOfHosts > UINT32_MAX))
+      {
+        status = EINVAL;
+      }
 
-    /* FIXME Some more information would be nice */
-    if (udpSend(udpSocket, arguments.address, arguments.port, buffer, pduSize) == pduSize)
+      if (status != EOK)
+      {
+        printError(status, "Unable to load hosts file (IPv6 records need IPv6 hosts)");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    status = setNetflowHosts6(hosts6, numberOfHosts);
+    if (status != EOK)
+    {
+      printError(status, "Unable to set IPv6 hosts");
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if (arguments.hostsFile != NULL)
+  {
+    status = readHostsFromFile(arguments.hostsFile, &hosts, &numberOfHosts);
+    if (status == EOK && (numberOfHosts == 0 || numberOfHosts > UINT32_MAX))
+    {
+      status = EINVAL;
+    }
+
+    if (status != EOK)
+    {
+      printError(status, "Unable to load hosts file");
+      exit(EXIT_FAILURE);
+    }
+
+    setNetflowHosts(hosts, numberOfHosts);
+  }
+
+  status = setTrafficModel(&arguments.traffic);
+  if (status != EOK)
+  {
+    printError(status, "Invalid traffic model");
+    exit(EXIT_FAILURE);
+  }
+
+  if (arguments.generate > 0)
+  {
+    status = generateDataset(&arguments, startTime);
+    if (status != EOK)
+    {
+      printError(status, "Unable to generate the dataset");
+    }
+
+    free(hosts);
+    free(hosts6);
+    freeCliArguments(arguments);
+
+    return status == EOK ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  struct replay replay;
+  if (arguments.replayFile != NULL)
+  {
+    status = openReplay(&replay, arguments.replayFile, arguments.replaySpeed,
+                        arguments.replayLoops, arguments.replayRewrite);
+    if (status != EOK)
+    {
+      printError(status, "Unable to load the replayed file");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct pcapMeter meter;
+  if (arguments.meterFile != NULL)
+  {
+    status = openMeter(&meter, arguments.meterFile, arguments.cacheSize,
+                       arguments.activeTimeout * 1000, arguments.inactiveTimeout * 1000);
+    if (status != EOK)
     {
-      if (arguments.outputFile != NULL)
+      printError(status, "Unable to open the metered capture");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct outputFile output;
+  struct outputFile* outputFile = NULL;
+  if (arguments.outputFile != NULL)
+  {
+    /* Simulated time can wait for the disk */
+    status = openOutputFile(&output, arguments.outputFile, arguments.outputFormat, arguments.outputBuffer,
+                            arguments.fastForward > 0);
+    if (status != EOK)
+    {
+      printError(status, "Unable to open output file");
+      exit(EXIT_FAILURE);
+    }
+    outputFile = &output;
+  }
+
+  struct loadProfile profile;
+  struct rateControl control;
+  struct rateControl* rateControl = NULL;
+  if (arguments.profileFile != NULL || arguments.controlSocket != NULL)
+  {
+    if (arguments.profileFile != NULL)
+    {
+      unsigned int line;
+      status = loadProfile(&profile, arguments.profileFile, &line);
+      if (status != EOK)
       {
-        writeToOutputFile(outputFile, buffer, pduSize);
+        if (status == EINVAL)
+        {
+          fprintf(stderr, "%s:%u: invalid segment\n", arguments.profileFile, line);
+        }
+        printError(status, "Unable to load the profile");
+        exit(EXIT_FAILURE);
       }
+    }
+
+    status = startRateControl(&control, arguments.rate, arguments.rateInFlows ? "flows" : "PDUs",
+                              arguments.profileFile != NULL ? &profile : NULL, arguments.controlSocket);
+    if (status != EOK)
+    {
+      printError(status, "Unable to open the control socket");
+      exit(EXIT_FAILURE);
+    }
+    rateControl = &control;
+  }
+
+  struct worker* workers = (struct worker*) calloc(arguments.threads, sizeof(struct worker));
+  if (workers == NULL)
+  {
+    printError(ENOMEM, "Unable to allocate workers");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Worker i gets the seeded stream jumped i times ahead, so its
+     output depends only on the seed and i. Workers with many
+     exporters jump once more per exporter, they are a long jump
+     apart. */
+  struct randomState random;
+  randomSeed(&random, arguments.seed);
 
-      fprintf(stderr, "Packet of size %i with %i flows sent.\n", pduSize, numberOfFlows);
+  for (unsigned int i = 0; i < arguments.threads; i++)
+  {
+    initializeWorker(&workers[i], i, &arguments, outputFile, rateControl, startTime, &random);
+    if (arguments.exporters > 0)
+    {
+      randomLongJump(&random);
     }
     else
     {
-      fprintf(stderr, "Sending failed.\n");
+      randomJump(&random);
+    }
+  }
+
+  struct statsReporter reporter;
+  if (arguments.statsInterval > 0)
+  {
+    status = startStatsReporter(&reporter, workers, arguments.threads, outputFile,
+                                (uint64_t) (arguments.statsInterval * 1e9), arguments.statsFile);
+    if (status != EOK)
+    {
+      printError(status, "Unable to start the stats reporter");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  installStopHandler();
+  uint64_t runStart = monotonicTime();
+  error_t meterStatus = EOK;
+
+  if (arguments.replayFile != NULL)
+  {
+    runReplay(&replay, &workers[0]);
+    closeReplay(&replay);
+  }
+  else if (arguments.meterFile != NULL)
+  {
+    meterStatus = runMeter(&meter, &workers[0]);
+    closeMeter(&meter);
+    if (meterStatus != EOK)
+    {
+      printError(meterStatus, "Unable to read the metered capture");
+    }
+  }
+  else if (arguments.threads == 1)
+  {
+    runWorker(&workers[0]);
+  }
+  else
+  {
+    for (unsigned int i = 0; i < arguments.threads; i++)
+    {
+      status = pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+      if (status != 0)
+      {
+        printError(status, "Unable to start worker thread");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    for (unsigned int i = 0; i < arguments.threads; i++)
+    {
+      pthread_join(workers[i].thread, NULL);
     }
+  }
 
-    /* TODO Interval ought to be more versatile */
-    sleep(rand() % 3);
+  if (arguments.statsInterval > 0)
+  {
+    stopStatsReporter(&reporter);
+  }
+
+  if (rateControl != NULL)
+  {
+    stopRateControl(rateControl);
+    if (arguments.profileFile != NULL)
+    {
+      freeProfile(&profile);
+    }
   }
 
   if (outputFile != NULL)
   {
-    closeOutputFile(outputFile);
+    status = closeOutputFile(outputFile);
+    if (status != EOK)
+    {
+      printError(status, "Output file may be incomplete");
+    }
   }
 
-  udpClose(udpSocket);
+  printTotals(workers, arguments.threads, monotonicTime() - runStart, stderr);
+
+  for (unsigned int i = 0; i < arguments.threads; i++)
+  {
+    freeSender(&workers[i].sender);
+  }
+
+  free(workers);
+  free(hosts);
+  free(hosts6);
   freeCliArguments(arguments);
 
-  return EXIT_SUCCESS;
+  return meterStatus == EOK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-
@@ -20,13 +20,79 @@
 #ifndef _NFGEN__H_
 #define _NFGEN__H_
 
+#include <netinet/in.h>
+
+#include "sender.h"
+#include "netflow.h"
+
 struct cliArguments
 {
-    in_addr_t address;
+    in_addr_t address;            /* First collector, or where to listen */
     in_port_t port;
+    struct destination* destinations;   /* All collectors */
+    unsigned int numberOfDestinations;
+    int fanout;                   /* FANOUT_MIRROR or FANOUT_SHARD */
     char* outputFile;
+    int outputFormat;             /* OUTPUT_RAW or OUTPUT_PCAP */
+    size_t outputBuffer;          /* [bytes] */
     int seed;
     int help;
+    double rate;       /* PDUs (or flows) per second, negative for random interval */
+    int rateInFlows;   /* Whether the rate counts flows instead of PDUs */
+    char* profileFile; /* Rate factors over time, NULL for a constant rate */
+    char* controlSocket; /* Unix socket changing the rate at run time, may be NULL */
+    unsigned int batchSize; /* PDUs sent by one sendmmsg() call */
+    int offload;            /* UDP_OFFLOAD_* flags */
+    char* txRing;           /* Interface of the AF_PACKET TX ring, NULL for UDP sockets */
+    unsigned int threads;   /* Number of generator threads (exporters) */
+    unsigned int poolSize;  /* Pre-generated PDUs per thread, 0 to disable */
+    char* hostsFile;        /* Addresses used in records, NULL for built-in ones */
+    struct trafficModel traffic; /* Distributions of the record fields */
+
+    /* Flow cache simulation */
+    unsigned int cacheSize;       /* Maximum flows in the cache, 0 to disable */
+    unsigned int concurrentFlows; /* Flows receiving packets at once */
+    unsigned int activeTimeout;   /* [s] */
+    unsigned int inactiveTimeout; /* [s] */
+    double packetRate;            /* Simulated packets per second */
+
+    /* Fleet of simulated exporters */
+    unsigned int exporters;       /* Exporters simulated by all threads, 0 = one per thread */
+    double exportInterval;        /* Mean interval between PDUs of one exporter [s] */
+    in_addr_t exporterSource;     /* Source address of the first exporter, INADDR_ANY = socket's */
+
+    int listen;                   /* Receive PDUs instead of sending them */
+
+    /* Time stamps */
+    uint64_t startTime;           /* Clock start [ns since the epoch], 0 = now */
+    double fastForward;           /* Simulated time to generate as fast as possible [s], 0 = real time */
+    uint64_t generate;            /* PDUs written into the output file without sending, 0 = send */
+
+    /* Run limits, all workers together */
+    uint64_t pduLimit;            /* 0 = unlimited */
+    uint64_t flowLimit;           /* 0 = unlimited */
+    double duration;              /* Wall clock time [s], 0 = unlimited */
+
+    /* Statistics */
+    double statsInterval;         /* [s], 0 = no reports */
+    char* statsFile;              /* JSON snapshot, may be NULL */
+
+    /* Replay of a recorded file */
+    char* replayFile;
+    double replaySpeed;           /* 0 = as fast as possible */
+    unsigned int replayLoops;     /* 0 = forever */
+    int replayRewrite;
+
+    /* Flows metered from a pcap capture */
+    char* meterFile;
+
+    /* Export format */
+    int protocol;                 /* NETFLOW_V5, NETFLOW_V9 or IPFIX */
+    char* fields;                 /* v9/IPFIX template fields, NULL for the default */
+    size_t maxPduSize;            /* v9/IPFIX PDU size limit (MTU - IP/UDP headers) */
+    unsigned int maxV5Records;    /* Records of a full v5 PDU, fewer for IPv6 collectors */
+    unsigned int templateRefresh; /* [PDUs] */
+    unsigned int templateTimeout; /* [s] */
 };
 
 #endif
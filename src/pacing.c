@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "pacing.h"
+
+/* Deadlines closer than this are busy-polled instead of slept on */
+#define SPIN_THRESHOLD 50000ULL
+
+/** Absolute deadline of the token number \c scheduled. */
+static uint64_t deadline(const struct pacer* pacer)
+{
+    return pacer->start + (uint64_t) (pacer->scheduled * (NSECS_PER_SEC / pacer->rate));
+}
+
+/** Add lateness sample (Welford's online variance). */
+static void addSample(struct pacer* pacer, uint64_t lateness)
+{
+    double delta = lateness - pacer->latenessMean;
+
+    pacer->samples++;
+    pacer->latenessMean += delta / pacer->samples;
+    pacer->latenessM2   += delta * (lateness - pacer->latenessMean);
+
+    if (lateness > pacer->latenessMax)
+    {
+        pacer->latenessMax = lateness;
+    }
+}
+
+static void resetWindow(struct pacer* pacer, uint64_t now)
+{
+    pacer->windowStart  = now;
+    pacer->windowTokens = 0;
+    pacer->samples      = 0;
+    pacer->latenessMean = 0;
+    pacer->latenessM2   = 0;
+    pacer->latenessMax  = 0;
+}
+
+/** Sleep and spin until \c when, account the lateness. */
+static void waitUntil(struct pacer* pacer, uint64_t when, uint64_t now)
+{
+    if (when - now > SPIN_THRESHOLD)
+    {
+        sleepUntil(when - SPIN_THRESHOLD);
+    }
+
+    do
+    {
+        now = monotonicTime();
+    } while (now < when);
+
+    addSample(pacer, now - when);
+}
+
+void pacerInitialize(struct pacer* pacer, double rate, uint64_t burst)
+{
+    uint64_t now = monotonicTime();
+
+    pacer->rate      = rate;
+    pacer->burst     = burst > 0 ? burst : 1;
+    pacer->start     = now;
+    pacer->scheduled = 0;
+
+    resetWindow(pacer, now);
+}
+
+void pacerSetRate(struct pacer* pacer, double rate, uint64_t burst)
+{
+    pacer->start     = pacer->rate > 0 ? deadline(pacer) : monotonicTime();
+    pacer->scheduled = 0;
+    pacer->rate      = rate;
+    pacer->burst     = burst > 0 ? burst : 1;
+}
+
+void pacerWait(struct pacer* pacer, unsigned int tokens)
+{
+    pacer->windowTokens += tokens;
+
+    if (pacer->rate <= 0)
+    {
+        return;
+    }
+
+    uint64_t when = deadline(pacer);
+    uint64_t now  = monotonicTime();
+
+    if (now > when)
+    {
+        /* Behind the schedule. The lateness counts as jitter, then
+           catch up, but only up to the bucket depth. */
+        addSample(pacer, now - when);
+        if ((now - when) * pacer->rate > pacer->burst * (double) NSECS_PER_SEC)
+        {
+            pacer->start     = now;
+            pacer->scheduled = 0;
+        }
+    }
+    else
+    {
+        waitUntil(pacer, when, now);
+    }
+
+    pacer->scheduled += tokens;
+}
+
+void pacerWaitUntil(struct pacer* pacer, uint64_t when, unsigned int tokens)
+{
+    uint64_t now = monotonicTime();
+
+    pacer->windowTokens += tokens;
+
+    if (now < when)
+    {
+        waitUntil(pacer, when, now);
+    }
+    else
+    {
+        addSample(pacer, now - when);
+    }
+}
+
+uint64_t pacerWindowElapsed(const struct pacer* pacer)
+{
+    return monotonicTime() - pacer->windowStart;
+}
+
+void pacerReport(struct pacer* pacer, FILE* stream, const char* unit)
+{
+    uint64_t now     = monotonicTime();
+    double   elapsed = (double) (now - pacer->windowStart) / NSECS_PER_SEC;
+    double   achieved = elapsed > 0 ? pacer->windowTokens / elapsed : 0;
+    double   deviation = pacer->samples > 1 ? sqrt(pacer->latenessM2 / (pacer->samples - 1)) : 0;
+
+    if (pacer->rate > 0)
+    {
+        fprintf(stream, "Rate: requested %.0f %s/s, achieved %.0f %s/s (%.2f%%), "
+                        "jitter mean %.1f us, stddev %.1f us, max %.1f us\n",
+                pacer->rate, unit, achieved, unit, 100.0 * achieved / pacer->rate,
+                pacer->latenessMean / 1000, deviation / 1000, pacer->latenessMax / 1000.0);
+    }
+    else if (pacer->samples > 0)
+    {
+        fprintf(stream, "Rate: scheduled, achieved %.0f %s/s, "
+                        "jitter mean %.1f us, stddev %.1f us, max %.1f us\n",
+                achieved, unit, pacer->latenessMean / 1000, deviation / 1000, pacer->latenessMax / 1000.0);
+    }
+    else
+    {
+        fprintf(stream, "Rate: unlimited, achieved %.0f %s/s\n", achieved, unit);
+    }
+
+    resetWindow(pacer, now);
+}
+
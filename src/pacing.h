@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PACING__H_
+#define _PACING__H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "clock.h"
+
+/** Rate controller state.
+ *
+ * The pacer is a token bucket driven by an absolute
+ * schedule. Every consumed token moves the deadline of
+ * the next send by 1/rate seconds. The deadline is always
+ * computed from the start of the schedule, so rounding
+ * errors don't accumulate even at very high rates.
+ *
+ * Long waits are done with clock_nanosleep(), the last
+ * few microseconds are busy-polled, because the scheduler
+ * wakes us up too late for rates above ~10k per second.
+ *
+ * If the sender falls behind (e.g. it was preempted), it
+ * is allowed to catch up by at most \c burst tokens. The
+ * schedule is restarted after that so it doesn't flood
+ * the collector.
+ */
+struct pacer
+{
+    double   rate;        /* Requested tokens per second, 0 means unlimited */
+    uint64_t burst;       /* Bucket depth in tokens */
+    uint64_t start;       /* Start of the current schedule [ns] */
+    uint64_t scheduled;   /* Tokens scheduled since start */
+
+    /* Statistics of the current report window */
+    uint64_t windowStart;
+    uint64_t windowTokens;
+    uint64_t samples;
+    double   latenessMean;
+    double   latenessM2;
+    uint64_t latenessMax;
+};
+
+/**
+ * Initialize the pacer
+ *
+ * @param[out] pacer Pacer to be initialized
+ * @param[in]  rate  Tokens per second (0 disables pacing)
+ * @param[in]  burst Maximum number of tokens the pacer may \
+ *                   send back to back to catch up
+ *
+ * @return void
+ */
+void pacerInitialize(struct pacer* pacer, double rate, uint64_t burst);
+
+/**
+ * Change the rate
+ *
+ * The new schedule starts where the old one would have
+ * sent the next token, so the sender neither stalls nor
+ * bursts when the rate changes (e.g. on every batch of
+ * a ramp).
+ *
+ * @param[in,out] pacer Initialized pacer
+ * @param[in]     rate  Tokens per second (0 disables pacing)
+ * @param[in]     burst Maximum number of tokens the pacer may \
+ *                      send back to back to catch up
+ *
+ * @return void
+ */
+void pacerSetRate(struct pacer* pacer, double rate, uint64_t burst);
+
+/**
+ * Wait until \c tokens can be sent
+ *
+ * Blocks the caller until the schedule allows sending
+ * \c tokens more tokens (PDUs or flows, depending on
+ * what the caller counts).
+ *
+ * @param[in,out] pacer  Initialized pacer
+ * @param[in]     tokens Number of tokens to be consumed
+ *
+ * @return void
+ */
+void pacerWait(struct pacer* pacer, unsigned int tokens);
+
+/**
+ * Wait until an absolute deadline
+ *
+ * For senders that follow their own schedule (e.g. replay
+ * of a capture). The wake-up lateness is accounted the
+ * same way as in pacerWait(), the rate of the pacer is
+ * not used.
+ *
+ * @param[in,out] pacer  Initialized pacer
+ * @param[in]     when   CLOCK_MONOTONIC deadline [ns] (@see monotonicTime())
+ * @param[in]     tokens Number of tokens sent at the deadline
+ *
+ * @return void
+ */
+void pacerWaitUntil(struct pacer* pacer, uint64_t when, unsigned int tokens);
+
+/**
+ * Print the rate statistics and start a new window
+ *
+ * Prints the requested rate, the rate achieved since the
+ * last report and the mean, standard deviation and
+ * maximum of the lateness behind the schedule (jitter),
+ * batches that were due before the wait included.
+ *
+ * @param[in,out] pacer  Initialized pacer
+ * @param[in]     stream Where to print the report
+ * @param[in]     unit   Name of the token unit ("PDUs", "flows")
+ *
+ * @return void
+ */
+void pacerReport(struct pacer* pacer, FILE* stream, const char* unit);
+
+/**
+ * Nanoseconds since the report window was started
+ *
+ * @param[in] pacer Initialized pacer
+ *
+ * @return Elapsed time in nanoseconds
+ */
+uint64_t pacerWindowElapsed(const struct pacer* pacer);
+
+#endif
+
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "packetring.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define ETHERNET_HEADER_SIZE 14
+#define IP_HEADER_SIZE       20
+#define UDP_HEADER_SIZE      8
+#define HEADERS_SIZE (ETHERNET_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE)
+
+#define IP_DONT_FRAGMENT 0x4000
+#define DEFAULT_TTL      64
+
+/* Frames of a ring, unless a batch needs more */
+#define MIN_FRAMES 64
+
+/* The packet starts where the kernel expects it without PACKET_TX_HAS_OFF */
+#define FRAME_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+#define NEIGHBOUR_TABLE "/proc/net/arp"
+#define NEIGHBOUR_COMPLETE 0x2  /* ATF_COM */
+
+/** One's complement sum of \c size bytes in native order, 32 bits at a time */
+static uint64_t sumBytes(const unsigned char* data, size_t size, uint64_t sum)
+{
+    uint32_t word;
+
+    for (; size >= sizeof(word); size -= sizeof(word), data += sizeof(word))
+    {
+        memcpy(&word, data, sizeof(word));
+        sum += word;
+    }
+
+    /* The odd tail is padded with zeros at the end */
+    word = 0;
+    memcpy(&word, data, size);
+
+    return sum + word;
+}
+
+/** Fold the sum to 16 bits and complement it, store it with memcpy() */
+static uint16_t foldSum(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+/** Find the MAC addresses of the interface and of the collector */
+static error_t resolveAddresses(struct packetRing* ring, const char* interface, in_addr_t destination)
+{
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface, IFNAMSIZ - 1);
+
+    if (ioctl(ring->fd, SIOCGIFFLAGS, &request) != 0)
+    {
+        return errno;
+    }
+
+    /* Loopback takes any (all-zero) addresses */
+    if (request.ifr_flags & IFF_LOOPBACK)
+    {
+        return EOK;
+    }
+
+    if (ioctl(ring->fd, SIOCGIFHWADDR, &request) != 0)
+    {
+        return errno;
+    }
+    memcpy(ring->sourceMac, request.ifr_hwaddr.sa_data, MAC_ADDRESS_SIZE);
+
+    FILE* table = fopen(NEIGHBOUR_TABLE, "r");
+    if (table == NULL)
+    {
+        return errno;
+    }
+
+    error_t status = EHOSTUNREACH;
+    char line[256];
+    while (status != EOK && fgets(line, sizeof(line), table) != NULL)
+    {
+        char address[64], hardwareAddress[64], mask[64], device[64];
+        unsigned int type, flags;
+        struct in_addr parsed;
+        unsigned int mac[MAC_ADDRESS_SIZE];
+
+        if (sscanf(line, "%63s 0x%x 0x%x %63s %63s %63s", address, &type, &flags,
+                   hardwareAddress, mask, device) != 6 ||
+            inet_pton(AF_INET, address, &parsed) != 1 || parsed.s_addr != destination ||
+            strcmp(device, interface) != 0 || !(flags & NEIGHBOUR_COMPLETE) ||
+            sscanf(hardwareAddress, "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], &mac[2],
+                   &mac[3], &mac[4], &mac[5]) != MAC_ADDRESS_SIZE)
+        {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < MAC_ADDRESS_SIZE; i++)
+        {
+            ring->destinationMac[i] = mac[i];
+        }
+        status = EOK;
+    }
+    fclose(table);
+
+    return status;
+}
+
+error_t initializePacketRing(struct packetRing* ring, const char* interface, in_addr_t destination,
+                             size_t maxDatagram, unsigned int frames)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->map = MAP_FAILED;
+
+    ring->fd = socket(AF_PACKET, SOCK_RAW, 0);  /* Protocol 0: nothing is received */
+    if (ring->fd < 0)
+    {
+        return errno;
+    }
+
+    error_t status = resolveAddresses(ring, interface, destination);
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface, IFNAMSIZ - 1);
+    if (status == EOK && ioctl(ring->fd, SIOCGIFMTU, &request) != 0)
+    {
+        status = errno;
+    }
+    if (status == EOK && maxDatagram + IP_HEADER_SIZE + UDP_HEADER_SIZE > (size_t) request.ifr_mtu)
+    {
+        status = EMSGSIZE;
+    }
+
+    int version = TPACKET_V2;
+    int enable  = 1;
+    if (status == EOK &&
+        (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0 ||
+         setsockopt(ring->fd, SOL_PACKET, PACKET_LOSS, &enable, sizeof(enable)) != 0))
+    {
+        status = errno;
+    }
+
+    /* Not supported before Linux 3.14, the qdisc is only slower */
+    setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &enable, sizeof(enable));
+
+    /* Frames are a power of two, so they tile the blocks */
+    ring->frameSize = TPACKET_ALIGNMENT;
+    while (ring->frameSize < FRAME_DATA_OFFSET + HEADERS_SIZE + maxDatagram)
+    {
+        ring->frameSize *= 2;
+    }
+    ring->maxDatagram = ring->frameSize - FRAME_DATA_OFFSET - HEADERS_SIZE;
+
+    unsigned int blockSize = ring->frameSize > (unsigned int) getpagesize() ? ring->frameSize : getpagesize();
+    unsigned int framesPerBlock = blockSize / ring->frameSize;
+    frames = frames > MIN_FRAMES ? frames : MIN_FRAMES;
+    ring->numberOfFrames = (frames + framesPerBlock - 1) / framesPerBlock * framesPerBlock;
+
+    struct tpacket_req layout;
+    layout.tp_block_size = blockSize;
+    layout.tp_block_nr   = ring->numberOfFrames / framesPerBlock;
+    layout.tp_frame_size = ring->frameSize;
+    layout.tp_frame_nr   = ring->numberOfFrames;
+    if (status == EOK && setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &layout, sizeof(layout)) != 0)
+    {
+        status = errno;
+    }
+
+    struct sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family  = AF_PACKET;
+    address.sll_ifindex = if_nametoindex(interface);
+    if (status == EOK && bind(ring->fd, (const struct sockaddr*) &address, sizeof(address)) != 0)
+    {
+        status = errno;
+    }
+
+    if (status == EOK)
+    {
+        ring->mapSize = (size_t) blockSize * layout.tp_block_nr;
+        ring->map = (char*) mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+        if (ring->map == MAP_FAILED)
+        {
+            status = errno;
+        }
+    }
+
+    if (status != EOK)
+    {
+        freePacketRing(ring);
+    }
+
+    return status;
+}
+
+/** Put Ethernet, IPv4 and UDP headers in front of a payload of \c size */
+static void writeHeaders(const struct packetRing* ring, unsigned char* p, const struct udpEndpoints* endpoints,
+                         in_addr_t source, size_t size, uint16_t ipId)
+{
+    memcpy(p, ring->destinationMac, MAC_ADDRESS_SIZE);
+    memcpy(p + MAC_ADDRESS_SIZE, ring->sourceMac, MAC_ADDRESS_SIZE);
+    uint16_t type = htons(ETH_P_IP);
+    memcpy(p + 2*MAC_ADDRESS_SIZE, &type, sizeof(type));
+
+    unsigned char* ip = p + ETHERNET_HEADER_SIZE;
+    uint16_t fields16[] = {
+        htons(0x4500),                     /* Version 4, 5 words, TOS 0 */
+        htons(IP_HEADER_SIZE + UDP_HEADER_SIZE + size),
+        htons(ipId),
+        htons(IP_DONT_FRAGMENT),
+        htons((DEFAULT_TTL << 8) | IPPROTO_UDP),
+        0                                  /* Checksum */
+    };
+    memcpy(ip, fields16, sizeof(fields16));
+    memcpy(ip + 12, &source, 4);
+    memcpy(ip + 16, &endpoints->destination, 4);
+
+    uint16_t checksum = foldSum(sumBytes(ip, IP_HEADER_SIZE, 0));
+    memcpy(ip + 10, &checksum, sizeof(checksum));
+
+    unsigned char* udp = ip + IP_HEADER_SIZE;
+    uint16_t length = htons(UDP_HEADER_SIZE + size);
+    uint16_t header[] = {
+        endpoints->sourcePort,
+        endpoints->destinationPort,
+        length,
+        0                                  /* Checksum */
+    };
+    memcpy(udp, header, sizeof(header));
+
+    /* Pseudo header: addresses, protocol and UDP length, then the datagram */
+    uint16_t protocol = htons(IPPROTO_UDP);
+    uint64_t sum = sumBytes(ip + 12, 8, 0);
+    sum = sumBytes((const unsigned char*) &protocol, sizeof(protocol), sum);
+    sum = sumBytes((const unsigned char*) &length, sizeof(length), sum);
+    sum = sumBytes(udp, UDP_HEADER_SIZE + size, sum);
+
+    checksum = foldSum(sum);
+    if (checksum == 0)
+    {
+        checksum = 0xffff;  /* 0 means no checksum */
+    }
+    memcpy(udp + 6, &checksum, sizeof(checksum));
+}
+
+unsigned int packetRingSend(struct packetRing* ring, const struct udpEndpoints* endpoints,
+                            char* const* datagrams, const size_t* sizes, const in_addr_t* sources,
+                            unsigned int count)
+{
+    unsigned int first = ring->next;
+    unsigned int queued = 0;
+
+    for (; queued < count && queued < ring->numberOfFrames; queued++)
+    {
+        struct tpacket2_hdr* frame = (struct tpacket2_hdr*) (ring->map + (size_t) ring->next * ring->frameSize);
+
+        /* Frames are handed back before send() returns */
+        if (__atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE ||
+            sizes[queued] > ring->maxDatagram)
+        {
+            break;
+        }
+
+        in_addr_t source = sources != NULL && sources[queued] != htonl(INADDR_ANY) ?
+                           sources[queued] : endpoints->source;
+        unsigned char* data = (unsigned char*) frame + FRAME_DATA_OFFSET;
+
+        memcpy(data + HEADERS_SIZE, datagrams[queued], sizes[queued]);
+        writeHeaders(ring, data, endpoints, source, sizes[queued], ring->ipId++);
+
+        frame->tp_len = HEADERS_SIZE + sizes[queued];
+        __atomic_store_n(&frame->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        ring->next = (ring->next + 1) % ring->numberOfFrames;
+    }
+
+    if (queued == 0)
+    {
+        return 0;
+    }
+
+    /* Blocks until the driver took all requested frames */
+    int result;
+    do
+    {
+        result = send(ring->fd, NULL, 0, 0);
+    }
+    while (result < 0 && errno == EINTR);
+
+    /* Frames the kernel didn't take are withdrawn, the rest counts as
+       sent. The kernel walks the ring in order and stops at the first
+       frame not requested, so the withdrawn frames are reused next. */
+    unsigned int sent = 0;
+    int failed = 0;
+    for (unsigned int i = 0; i < queued; i++)
+    {
+        struct tpacket2_hdr* frame = (struct tpacket2_hdr*)
+            (ring->map + (size_t) ((first + i) % ring->numberOfFrames) * ring->frameSize);
+
+        if (__atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE) == TP_STATUS_SEND_REQUEST)
+        {
+            __atomic_store_n(&frame->tp_status, TP_STATUS_AVAILABLE, __ATOMIC_RELEASE);
+            failed = 1;
+        }
+        else if (!failed)
+        {
+            sent++;
+        }
+    }
+
+    if (failed)
+    {
+        ring->next = (first + sent) % ring->numberOfFrames;
+    }
+
+    return sent;
+}
+
+void freePacketRing(struct packetRing* ring)
+{
+    if (ring->map != MAP_FAILED && ring->map != NULL)
+    {
+        munmap(ring->map, ring->mapSize);
+    }
+    ring->map = NULL;
+
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    ring->fd = -1;
+}
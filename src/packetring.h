@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PACKETRING__H_
+#define _PACKETRING__H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+#include "binaryoutput.h"
+
+#define MAC_ADDRESS_SIZE 6
+
+/** PACKET_MMAP transmit ring of one interface
+ *
+ * Datagrams bypass the UDP socket layer: every PDU is
+ * copied into a frame of a ring shared with the kernel,
+ * behind Ethernet, IPv4 and UDP headers built here (with
+ * both checksums), and a single send() hands all filled
+ * frames to the driver. The qdisc is bypassed as well.
+ *
+ * Since the headers are crafted, the source address of
+ * every datagram can be anything, e.g. the address of a
+ * simulated exporter, no local address is needed.
+ *
+ * The collector must be on the link (or on loopback):
+ * the destination MAC address is looked up in the
+ * neighbour table, the routing table is not consulted.
+ */
+struct packetRing
+{
+    int            fd;             /* AF_PACKET socket */
+    char*          map;            /* Frames shared with the kernel */
+    size_t         mapSize;
+    unsigned int   frameSize;
+    unsigned int   numberOfFrames;
+    unsigned int   next;           /* Next frame to be filled */
+    unsigned int   maxDatagram;    /* Largest UDP payload of a frame */
+    unsigned char  sourceMac[MAC_ADDRESS_SIZE];
+    unsigned char  destinationMac[MAC_ADDRESS_SIZE];
+    uint16_t       ipId;
+};
+
+/**
+ * Map a transmit ring on \c interface
+ *
+ * Needs CAP_NET_RAW.
+ *
+ * @param[out] ring        Ring to be initialized
+ * @param[in]  interface   Interface name, e.g. "lo" or "eth0"
+ * @param[in]  destination Collector address (network order), used to find its MAC address
+ * @param[in]  maxDatagram Largest UDP payload to be sent
+ * @param[in]  frames      Minimum number of frames (PDUs sent by one packetRingSend())
+ *
+ * @return EOK on success, errno code otherwise (EHOSTUNREACH \
+ *         if the collector's MAC address is unknown)
+ */
+error_t initializePacketRing(struct packetRing* ring, const char* interface, in_addr_t destination,
+                             size_t maxDatagram, unsigned int frames);
+
+/**
+ * Send datagrams through the ring
+ *
+ * Each datagram gets IP/UDP headers with the addresses
+ * of \c endpoints, its source address may be overridden
+ * by \c sources. Blocks until the kernel took all frames.
+ *
+ * @param[in,out] ring      Initialized ring
+ * @param[in]     endpoints Addresses and ports (network order)
+ * @param[in]     datagrams UDP payloads
+ * @param[in]     sizes     Size of each payload
+ * @param[in]     sources   Source address of each datagram, INADDR_ANY for \
+ *                          the one of \c endpoints; may be NULL
+ * @param[in]     count     Number of datagrams, at most the number of frames
+ *
+ * @return Number of datagrams sent, counted from the start
+ */
+unsigned int packetRingSend(struct packetRing* ring, const struct udpEndpoints* endpoints,
+                            char* const* datagrams, const size_t* sizes, const in_addr_t* sources,
+                            unsigned int count);
+
+/**
+ * Unmap the ring and close its socket
+ *
+ * @param[in,out] ring Initialized ring
+ *
+ * @return void
+ */
+void freePacketRing(struct packetRing* ring);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pcap.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+#define PCAP_MAGIC               0xa1b2c3d4
+#define PCAP_MAGIC_NSEC          0xa1b23c4d
+
+#define LINKTYPE_ETHERNET  1
+#define LINKTYPE_RAW       101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4      228
+#define LINKTYPE_IPV6      229
+
+#define ETHERNET_HEADER_SIZE  14
+#define LINUX_SLL_HEADER_SIZE 16
+#define VLAN_TAG_SIZE         4
+#define ETHERTYPE_IPV4        0x0800
+#define ETHERTYPE_IPV6        0x86dd
+#define ETHERTYPE_VLAN        0x8100
+#define ETHERTYPE_QINQ        0x88a8
+#define IPV4_MIN_HEADER_SIZE  20
+#define IPV6_HEADER_SIZE      40
+#define IP_FRAGMENT_MASK      0x3fff  /* More fragments flag and offset */
+
+/** Read a pcap header field stored in the byte order of the capturing host */
+static inline uint32_t getPcap32(const unsigned char* p, int swapped)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? __builtin_bswap32(value) : value;
+}
+
+error_t pcapReadHeader(const unsigned char* header, size_t size, struct pcapFormat* format)
+{
+    uint32_t magic;
+
+    if (size < PCAP_FILE_HEADER_SIZE)
+    {
+        return EINVAL;
+    }
+
+    memcpy(&magic, header, sizeof(magic));
+    format->swapped = (magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+
+    magic = getPcap32(header, format->swapped);
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+    {
+        return EINVAL;
+    }
+
+    format->nanoseconds = (magic == PCAP_MAGIC_NSEC);
+    format->linkType = getPcap32(header + 20, format->swapped) & 0xffff;
+
+    return EOK;
+}
+
+size_t pcapReadRecord(const struct pcapFormat* format, const unsigned char* record, uint64_t* time)
+{
+    uint64_t seconds  = getPcap32(record, format->swapped);
+    uint64_t fraction = getPcap32(record + 4, format->swapped);
+
+    *time = seconds * NSECS_PER_SEC + (format->nanoseconds ? fraction : fraction * 1000);
+
+    return getPcap32(record + 8, format->swapped);
+}
+
+int pcapFindPacket(const struct pcapFormat* format, const unsigned char* frame, size_t captured,
+                   struct capturedPacket* packet)
+{
+    const unsigned char* end = frame + captured;
+    const unsigned char* ip = frame;
+    uint32_t linkType = format->linkType;
+
+    if (linkType == LINKTYPE_ETHERNET || linkType == LINKTYPE_LINUX_SLL)
+    {
+        size_t offset = (linkType == LINKTYPE_ETHERNET) ? ETHERNET_HEADER_SIZE - 2 : LINUX_SLL_HEADER_SIZE - 2;
+        if (offset + 2 > captured)
+        {
+            return 0;
+        }
+
+        uint16_t etherType = getNet16(frame + offset);
+        while ((etherType == ETHERTYPE_VLAN || etherType == ETHERTYPE_QINQ) &&
+               offset + VLAN_TAG_SIZE + 2 <= captured)
+        {
+            offset += VLAN_TAG_SIZE;
+            etherType = getNet16(frame + offset);
+        }
+
+        if (etherType != ETHERTYPE_IPV4 && etherType != ETHERTYPE_IPV6)
+        {
+            return 0;
+        }
+        ip = frame + offset + 2;
+    }
+    else if (linkType != LINKTYPE_RAW && linkType != LINKTYPE_IPV4 && linkType != LINKTYPE_IPV6)
+    {
+        return 0;
+    }
+
+    if (ip >= end)
+    {
+        return 0;
+    }
+
+    packet->ip      = ip;
+    packet->end     = end;
+    packet->version = ip[0] >> 4;
+
+    if (packet->version == 4)
+    {
+        size_t headerLength = (ip[0] & 0x0f) * 4;
+        if (ip + IPV4_MIN_HEADER_SIZE > end || headerLength < IPV4_MIN_HEADER_SIZE || ip + headerLength > end)
+        {
+            return 0;
+        }
+
+        packet->transport = ip + headerLength;
+        packet->protocol  = ip[9];
+        packet->fragment  = getNet16(ip + 6) & IP_FRAGMENT_MASK;
+        packet->length    = getNet16(ip + 2);
+    }
+    else if (packet->version == 6)
+    {
+        if (ip + IPV6_HEADER_SIZE > end)
+        {
+            return 0;
+        }
+
+        packet->transport = ip + IPV6_HEADER_SIZE;
+        packet->protocol  = ip[6];
+        packet->fragment  = 0;
+        packet->length    = getNet16(ip + 4) + IPV6_HEADER_SIZE;
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
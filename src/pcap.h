@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PCAP__H_
+#define _PCAP__H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "errors.h"
+
+#define PCAP_FILE_HEADER_SIZE    24
+#define PCAP_RECORD_HEADER_SIZE  16
+
+/** Classic pcap capture format, from the file header */
+struct pcapFormat
+{
+    int      swapped;       /* Written by a host of the other byte order */
+    int      nanoseconds;   /* Time stamp fractions are ns, not us */
+    uint32_t linkType;
+};
+
+/** IP packet found in a captured frame
+ *
+ * The pointers point into the frame. The IP header is
+ * complete, the transport header may be cut off by the
+ * snap length.
+ */
+struct capturedPacket
+{
+    const unsigned char* ip;          /* IP header */
+    const unsigned char* transport;   /* After the IP header (IPv6 extension headers not skipped) */
+    const unsigned char* end;         /* End of the captured bytes */
+    unsigned int         version;     /* 4 or 6 */
+    uint8_t              protocol;    /* IPv4 protocol, IPv6 next header */
+    uint16_t             fragment;    /* IPv4 more fragments flag and offset, 0 for IPv6 */
+    uint32_t             length;      /* IPv4 total length, IPv6 payload length + header */
+};
+
+/** Read a 16-bit field in network byte order */
+static inline uint16_t getNet16(const unsigned char* p)
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohs(value);
+}
+
+/**
+ * Parse the pcap file header
+ *
+ * Accepts us and ns time stamps in either byte order.
+ *
+ * @param[in]  header File header
+ * @param[in]  size   Bytes available at \c header
+ * @param[out] format Format of the records
+ *
+ * @return EOK on success, EINVAL if it's not a pcap file
+ */
+error_t pcapReadHeader(const unsigned char* header, size_t size, struct pcapFormat* format);
+
+/**
+ * Parse a record header
+ *
+ * @param[in]  format Format of the capture
+ * @param[in]  record Record header (PCAP_RECORD_HEADER_SIZE bytes)
+ * @param[out] time   Capture time [ns since the epoch]
+ *
+ * @return Number of captured bytes following the header
+ */
+size_t pcapReadRecord(const struct pcapFormat* format, const unsigned char* record, uint64_t* time);
+
+/**
+ * Find the IP packet in a captured frame
+ *
+ * Handles Ethernet (with VLAN and QinQ tags), Linux cooked
+ * and raw IP link types.
+ *
+ * @param[in]  format   Format of the capture
+ * @param[in]  frame    Captured bytes
+ * @param[in]  captured Number of captured bytes
+ * @param[out] packet   Headers of the packet
+ *
+ * @return Non-zero if there is an IPv4 or IPv6 packet, 0 otherwise
+ */
+int pcapFindPacket(const struct pcapFormat* format, const unsigned char* frame, size_t captured,
+                   struct capturedPacket* packet);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+error_t initializePool(struct pduPool* pool, struct netflowExporter* exporter, unsigned int size, uint64_t now)
+{
+    pool->buffers = (char*) malloc((size_t) size * MAX_NETFLOW_PDU_SIZE);
+    pool->sizes   = (size_t*) calloc(size, sizeof(size_t));
+    pool->flows   = (unsigned int*) calloc(size, sizeof(unsigned int));
+    pool->size    = size;
+    pool->next    = 0;
+
+    if (pool->buffers == NULL || pool->sizes == NULL || pool->flows == NULL)
+    {
+        freePool(pool);
+        return ENOMEM;
+    }
+
+    uint32_t flowSequence = exporter->flowSequence;
+
+    for (unsigned int i = 0; i < size; i++)
+    {
+        pool->flows[i] = randomNumberOfFlows(exporter);
+        pool->sizes[i] = makeRandomNetflowPacket(pool->buffers + (size_t) i * MAX_NETFLOW_PDU_SIZE,
+                                                 exporter, pool->flows[i], now);
+    }
+
+    /* Nothing was sent yet */
+    exporter->flowSequence = flowSequence;
+
+    return EOK;
+}
+
+char* nextPoolPdu(struct pduPool* pool, struct netflowExporter* exporter, uint64_t now,
+                  size_t* pduSize, unsigned int* numberOfFlows)
+{
+    unsigned int index = pool->next;
+    char* pdu = pool->buffers + (size_t) index * MAX_NETFLOW_PDU_SIZE;
+
+    pool->next = (index + 1 == pool->size) ? 0 : index + 1;
+
+    patchNetflowHeader(pdu, exporter, now);
+
+    *pduSize       = pool->sizes[index];
+    *numberOfFlows = pool->flows[index];
+
+    return pdu;
+}
+
+void freePool(struct pduPool* pool)
+{
+    free(pool->buffers);
+    free(pool->sizes);
+    free(pool->flows);
+
+    pool->buffers = NULL;
+    pool->sizes   = NULL;
+    pool->flows   = NULL;
+    pool->size    = 0;
+    pool->next    = 0;
+}
+
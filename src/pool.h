@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _POOL__H_
+#define _POOL__H_
+
+#include <stddef.h>
+
+#include "errors.h"
+#include "netflow.h"
+
+/** Pre-generated PDUs.
+ *
+ * The pool is filled once by makeRandomNetflowPacket()
+ * and then sent round-robin. Only the header fields that
+ * change with every packet (time stamps and the flow
+ * sequence) are rewritten before a PDU is sent again, so
+ * the records repeat every \c size PDUs.
+ *
+ * PDUs are patched in place, so a pool must not be
+ * shared between exporters.
+ */
+struct pduPool
+{
+    char*         buffers;  /* size * MAX_NETFLOW_PDU_SIZE bytes */
+    size_t*       sizes;
+    unsigned int* flows;
+    unsigned int  size;     /* Number of PDUs in the pool */
+    unsigned int  next;     /* Index of the next PDU to be sent */
+};
+
+/**
+ * Pre-generate PDUs of \c exporter
+ *
+ * The exporter's generator is advanced, its flow
+ * sequence counter is left untouched.
+ *
+ * @param[out]    pool     Pool to be filled
+ * @param[in,out] exporter Exporter the PDUs belong to
+ * @param[in]     size     Number of PDUs to generate
+ * @param[in]     now      Time of the generation [ns since the epoch]
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t initializePool(struct pduPool* pool, struct netflowExporter* exporter, unsigned int size, uint64_t now);
+
+/**
+ * Take the next PDU from the pool
+ *
+ * The header of the PDU is patched for \c exporter
+ * (@see patchNetflowHeader()). The returned buffer stays
+ * valid until the pool wraps around.
+ *
+ * @param[in,out] pool          Initialized pool
+ * @param[in,out] exporter      Exporter that sends the PDU
+ * @param[in]     now           Time of the export [ns since the epoch]
+ * @param[out]    pduSize       Size of the PDU
+ * @param[out]    numberOfFlows Number of records in the PDU
+ *
+ * @return PDU buffer
+ */
+char* nextPoolPdu(struct pduPool* pool, struct netflowExporter* exporter, uint64_t now,
+                  size_t* pduSize, unsigned int* numberOfFlows);
+
+/**
+ * Free the memory allocated by initializePool()
+ *
+ * @param[in,out] pool Pool to be released
+ *
+ * @return void
+ */
+void freePool(struct pduPool* pool);
+
+#endif
+
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "profile.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+/* How often the control thread checks whether to stop [ms] */
+#define CONTROL_POLL_INTERVAL 100
+
+/* How long a control connection may stay silent [s] */
+#define CONTROL_TIMEOUT 1
+
+#define CONTROL_LINE_SIZE 256
+
+/** Name and number of parameters of every shape */
+static const struct
+{
+    const char*  name;
+    unsigned int parameters;
+} shapes[] =
+{
+    [PROFILE_CONSTANT] = {"constant", 1},
+    [PROFILE_RAMP]     = {"ramp",     2},
+    [PROFILE_STEPS]    = {"steps",    3},
+    [PROFILE_SINE]     = {"sine",     3},
+    [PROFILE_BURST]    = {"burst",    4}
+};
+
+#define NUMBER_OF_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+/** Parse one non-empty line into \c segment. */
+static error_t parseSegment(char* line, struct profileSegment* segment)
+{
+    char* save;
+    char* token = strtok_r(line, " \t", &save);
+    char* end;
+
+    /* Shorter than 1 ns is 0 and would break the walk over the segments */
+    double duration = strtod(token, &end);
+    if (*end != '\0' || !(duration * NSECS_PER_SEC >= 1))
+    {
+        return EINVAL;
+    }
+    segment->duration = (uint64_t) (duration * NSECS_PER_SEC);
+
+    token = strtok_r(NULL, " \t", &save);
+    if (token == NULL)
+    {
+        return EINVAL;
+    }
+
+    size_t shape = 0;
+    while (shape < NUMBER_OF_SHAPES && strcmp(token, shapes[shape].name) != 0)
+    {
+        shape++;
+    }
+    if (shape == NUMBER_OF_SHAPES)
+    {
+        return EINVAL;
+    }
+    segment->shape = (enum profileShape) shape;
+
+    unsigned int count = 0;
+    while ((token = strtok_r(NULL, " \t", &save)) != NULL)
+    {
+        if (count == shapes[shape].parameters)
+        {
+            return EINVAL;
+        }
+
+        segment->parameters[count] = strtod(token, &end);
+        if (*end != '\0' || segment->parameters[count] < 0)
+        {
+            return EINVAL;
+        }
+        count++;
+    }
+
+    if (count != shapes[shape].parameters)
+    {
+        return EINVAL;
+    }
+
+    /* Steps need a whole positive count, periods must be positive */
+    if ((segment->shape == PROFILE_STEPS && (segment->parameters[2] < 1 ||
+                                             segment->parameters[2] != floor(segment->parameters[2]))) ||
+        (segment->shape == PROFILE_SINE && segment->parameters[2] == 0) ||
+        (segment->shape == PROFILE_BURST && segment->parameters[3] == 0))
+    {
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+error_t loadProfile(struct loadProfile* profile, const char* path, unsigned int* line)
+{
+    memset(profile, 0, sizeof(*profile));
+    *line = 0;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return errno;
+    }
+
+    error_t status = EOK;
+    size_t size = 0;
+    char* text = NULL;
+    size_t textSize = 0;
+
+    while (status == EOK && getline(&text, &textSize, file) >= 0)
+    {
+        (*line)++;
+
+        char* comment = strchr(text, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        text[strcspn(text, "\r\n")] = '\0';
+        if (text[strspn(text, " \t")] == '\0')
+        {
+            continue;
+        }
+
+        if (profile->numberOfSegments == size)
+        {
+            size = size > 0 ? 2*size : 16;
+            struct profileSegment* segments = (struct profileSegment*) realloc(profile->segments,
+                                                                              size * sizeof(*segments));
+            if (segments == NULL)
+            {
+                status = ENOMEM;
+                break;
+            }
+            profile->segments = segments;
+        }
+
+        struct profileSegment* segment = &profile->segments[profile->numberOfSegments];
+        status = parseSegment(text, segment);
+        if (status == EOK)
+        {
+            profile->length += segment->duration;
+            profile->numberOfSegments++;
+        }
+    }
+
+    if (status == EOK && ferror(file))
+    {
+        status = EIO;
+    }
+    if (status == EOK && profile->numberOfSegments == 0)
+    {
+        status = EINVAL;
+    }
+
+    free(text);
+    fclose(file);
+
+    if (status != EOK)
+    {
+        freeProfile(profile);
+    }
+
+    return status;
+}
+
+double profileFactor(const struct loadProfile* profile, uint64_t elapsed)
+{
+    uint64_t time = elapsed % profile->length;
+    const struct profileSegment* segment = profile->segments;
+
+    while (time >= segment->duration)
+    {
+        time -= segment->duration;
+        segment++;
+    }
+
+    const double* p = segment->parameters;
+    double position = (double) time / segment->duration;
+    double seconds = (double) time / NSECS_PER_SEC;
+    double factor;
+
+    switch (segment->shape)
+    {
+    case PROFILE_RAMP:
+        factor = p[0] + (p[1] - p[0]) * position;
+        break;
+    case PROFILE_STEPS:
+        factor = p[2] > 1 ? p[0] + (p[1] - p[0]) * floor(position * p[2]) / (p[2] - 1) : p[0];
+        break;
+    case PROFILE_SINE:
+        factor = p[0] + p[1] * sin(2 * M_PI * seconds / p[2]);
+        break;
+    case PROFILE_BURST:
+        factor = fmod(seconds, p[3]) < p[2] ? p[1] : p[0];
+        break;
+    default:
+        factor = p[0];
+        break;
+    }
+
+    return factor > 0 ? factor : 0;
+}
+
+void freeProfile(struct loadProfile* profile)
+{
+    free(profile->segments);
+    profile->segments = NULL;
+    profile->numberOfSegments = 0;
+}
+
+double controlRate(const struct rateControl* control, uint64_t elapsed)
+{
+    double rate;
+    __atomic_load(&control->rate, &rate, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&control->paused, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    return control->profile != NULL ? rate * profileFactor(control->profile, elapsed) : rate;
+}
+
+/** Execute one command line, write the answer into \c reply. */
+static void executeCommand(struct rateControl* control, char* command, char* reply, size_t replySize)
+{
+    char* save;
+    char* name = strtok_r(command, " \t", &save);
+    char* argument = name != NULL ? strtok_r(NULL, " \t", &save) : NULL;
+    double rate;
+
+    __atomic_load(&control->rate, &rate, __ATOMIC_RELAXED);
+
+    if (name == NULL || strcmp(name, "status") == 0)
+    {
+        /* Just the answer */
+    }
+    else if (strcmp(name, "rate") == 0 && argument != NULL)
+    {
+        char* end;
+        double value = strtod(argument, &end);
+        if (*end != '\0' || !(value > 0))
+        {
+            snprintf(reply, replySize, "error invalid rate\n");
+            return;
+        }
+
+        rate = value;
+        __atomic_store(&control->rate, &rate, __ATOMIC_RELAXED);
+        fprintf(stderr, "Rate control: rate set to %.0f %s/s\n", rate, control->unit);
+    }
+    else if (strcmp(name, "pause") == 0 || strcmp(name, "resume") == 0)
+    {
+        int paused = name[0] == 'p';
+        __atomic_store_n(&control->paused, paused, __ATOMIC_RELAXED);
+        fprintf(stderr, "Rate control: %s\n", paused ? "paused" : "resumed");
+    }
+    else
+    {
+        snprintf(reply, replySize, "error unknown command\n");
+        return;
+    }
+
+    snprintf(reply, replySize, "rate %.0f %s/s%s%s\n", rate, control->unit,
+             control->profile != NULL ? " profile" : "",
+             __atomic_load_n(&control->paused, __ATOMIC_RELAXED) ? " paused" : "");
+}
+
+/** Serve one control connection until the peer closes it or goes silent. */
+static void serveConnection(struct rateControl* control, int connection)
+{
+    struct timeval timeout = {CONTROL_TIMEOUT, 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char line[CONTROL_LINE_SIZE];
+    size_t length = 0;
+    ssize_t received;
+
+    while ((received = recv(connection, line + length, sizeof(line) - 1 - length, 0)) > 0)
+    {
+        length += received;
+        line[length] = '\0';
+
+        /* Execute every complete line, an overlong one is dropped */
+        char* newline;
+        while ((newline = strchr(line, '\n')) != NULL || length == sizeof(line) - 1)
+        {
+            char reply[CONTROL_LINE_SIZE];
+
+            if (newline == NULL)
+            {
+                snprintf(reply, sizeof(reply), "error line too long\n");
+                length = 0;
+            }
+            else
+            {
+                *newline = '\0';
+                if (newline > line && newline[-1] == '\r')
+                {
+                    newline[-1] = '\0';
+                }
+                executeCommand(control, line, reply, sizeof(reply));
+
+                length -= newline + 1 - line;
+                memmove(line, newline + 1, length + 1);
+            }
+
+            if (send(connection, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+            {
+                return;
+            }
+        }
+    }
+}
+
+static void* runRateControl(void* argument)
+{
+    struct rateControl* control = (struct rateControl*) argument;
+    struct pollfd listening = {control->socket, POLLIN, 0};
+
+    while (!__atomic_load_n(&control->stop, __ATOMIC_RELAXED))
+    {
+        if (poll(&listening, 1, CONTROL_POLL_INTERVAL) <= 0)
+        {
+            continue;
+        }
+
+        int connection = accept(control->socket, NULL, NULL);
+        if (connection >= 0)
+        {
+            serveConnection(control, connection);
+            close(connection);
+        }
+    }
+
+    return NULL;
+}
+
+error_t startRateControl(struct rateControl* control, double rate, const char* unit,
+                         const struct loadProfile* profile, const char* path)
+{
+    memset(control, 0, sizeof(*control));
+    control->rate    = rate;
+    control->unit    = unit;
+    control->profile = profile;
+    control->path    = path;
+    control->socket  = -1;
+
+    if (path == NULL)
+    {
+        return EOK;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        return ENAMETOOLONG;
+    }
+    strcpy(address.sun_path, path);
+
+    /* Replace a socket left behind by an earlier run, but nothing else */
+    struct stat status;
+    if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+    {
+        unlink(path);
+    }
+
+    control->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control->socket < 0)
+    {
+        return errno;
+    }
+
+    if (bind(control->socket, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+        listen(control->socket, SOMAXCONN) != 0)
+    {
+        error_t error = errno;
+        close(control->socket);
+        return error;
+    }
+
+    error_t error = pthread_create(&control->thread, NULL, runRateControl, control);
+    if (error != 0)
+    {
+        close(control->socket);
+        unlink(path);
+    }
+
+    return error;
+}
+
+void stopRateControl(struct rateControl* control)
+{
+    if (control->socket < 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&control->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(control->thread, NULL);
+
+    close(control->socket);
+    unlink(control->path);
+}
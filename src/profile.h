@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILE__H_
+#define _PROFILE__H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "errors.h"
+
+/* Shapes of the load profile segments */
+enum profileShape
+{
+    PROFILE_CONSTANT,   /* factor */
+    PROFILE_RAMP,       /* from, to */
+    PROFILE_STEPS,      /* from, to, number of steps */
+    PROFILE_SINE,       /* mean, amplitude, period [s] */
+    PROFILE_BURST       /* base, peak, burst length [s], period [s] */
+};
+
+#define PROFILE_MAX_PARAMETERS 4
+
+/** One segment of a load profile */
+struct profileSegment
+{
+    enum profileShape shape;
+    uint64_t          duration;     /* [ns] */
+    double            parameters[PROFILE_MAX_PARAMETERS];
+};
+
+/** Rate over time
+ *
+ * A profile is a list of segments, each one gives the rate
+ * factor as a function of the time since the segment start.
+ * The factors multiply the rate given by -r or -f. After the
+ * last segment the profile starts over.
+ */
+struct loadProfile
+{
+    struct profileSegment* segments;
+    size_t                 numberOfSegments;
+    uint64_t               length;      /* Sum of the durations [ns] */
+};
+
+/**
+ * Load a profile from a file
+ *
+ * One segment per line: the duration in seconds, the shape
+ * name and its parameters, '#' starts a comment. E.g.
+ *
+ *     60   ramp   0.1 2
+ *     300  sine   1 0.5 60
+ *
+ * @param[out] profile Loaded profile
+ * @param[in]  path    Path to the profile file
+ * @param[out] line    Line of the first invalid segment (on EINVAL)
+ *
+ * @return EOK on success, EINVAL on a syntax error, errno code otherwise
+ */
+error_t loadProfile(struct loadProfile* profile, const char* path, unsigned int* line);
+
+/**
+ * Rate factor at a point of the profile
+ *
+ * @param[in] profile Loaded profile
+ * @param[in] elapsed Time since the profile start [ns]
+ *
+ * @return Non-negative factor of the base rate
+ */
+double profileFactor(const struct loadProfile* profile, uint64_t elapsed);
+
+/**
+ * Free a loaded profile
+ *
+ * @param[in,out] profile Loaded profile
+ *
+ * @return void
+ */
+void freeProfile(struct loadProfile* profile);
+
+/** Rate shared by all workers, changed at run time
+ *
+ * The base rate (-r or -f) can be changed and the sending
+ * paused through a local control socket (SOCK_STREAM, one
+ * command per line): "rate <per second>", "pause", "resume"
+ * and "status". Every command is answered with the current
+ * state. The workers read the state with relaxed atomic loads
+ * before every batch, so a change takes effect within one
+ * batch and the exporters keep their flow sequences.
+ */
+struct rateControl
+{
+    double   rate;        /* Base rate of all workers together */
+    int      paused;
+    const struct loadProfile* profile;  /* May be NULL */
+    const char* unit;     /* "PDUs" or "flows" */
+
+    int       socket;     /* Listening socket, -1 without one */
+    const char* path;
+    pthread_t thread;
+    int       stop;
+};
+
+/**
+ * Start the rate control
+ *
+ * @param[out] control Rate control to be started
+ * @param[in]  rate    Initial base rate (> 0)
+ * @param[in]  unit    Unit of the rate ("PDUs" or "flows")
+ * @param[in]  profile Load profile or NULL for a constant rate
+ * @param[in]  path    Path of the control socket or NULL
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t startRateControl(struct rateControl* control, double rate, const char* unit,
+                         const struct loadProfile* profile, const char* path);
+
+/**
+ * Current rate
+ *
+ * @param[in] control Started rate control
+ * @param[in] elapsed Time since the start of the caller [ns]
+ *
+ * @return Total rate of all workers, 0 when paused
+ */
+double controlRate(const struct rateControl* control, uint64_t elapsed);
+
+/**
+ * Stop the control thread and remove its socket
+ *
+ * @param[in,out] control Started rate control
+ *
+ * @return void
+ */
+void stopRateControl(struct rateControl* control);
+
+#endif
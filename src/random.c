@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "random.h"
+
+/** splitmix64, used only to expand the seed. */
+static uint64_t splitmix64(uint64_t* x)
+{
+    return mixBits(*x += 0x9e3779b97f4a7c15ULL);
+}
+
+void randomSeed(struct randomState* state, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        state->s[i] = splitmix64(&seed);
+    }
+}
+
+/** Advance the state by the jump polynomial \c jump. */
+static void jumpAhead(struct randomState* state, const uint64_t jump[4])
+{
+    uint64_t s[4] = {0, 0, 0, 0};
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (jump[i] & (1ULL << b))
+            {
+                s[0] ^= state->s[0];
+                s[1] ^= state->s[1];
+                s[2] ^= state->s[2];
+                s[3] ^= state->s[3];
+            }
+            randomNext(state);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        state->s[i] = s[i];
+    }
+}
+
+void randomJump(struct randomState* state)
+{
+    static const uint64_t JUMP[] =
+    {
+        0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+    };
+
+    jumpAhead(state, JUMP);
+}
+
+void randomLongJump(struct randomState* state)
+{
+    static const uint64_t LONG_JUMP[] =
+    {
+        0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+        0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+    };
+
+    jumpAhead(state, LONG_JUMP);
+}
+
+void randomFill(struct randomState* state, uint32_t* values, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < count; i += 2)
+    {
+        uint64_t value = randomNext(state);
+
+        values[i]     = value >> 32;
+        values[i + 1] = (uint32_t) value;
+    }
+
+    if (i < count)
+    {
+        values[i] = randomNext(state) >> 32;
+    }
+}
+
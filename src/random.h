@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RANDOM__H_
+#define _RANDOM__H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Pseudo-random generator state.
+ *
+ * xoshiro256** by David Blackman and Sebastiano Vigna
+ * (http://prng.di.unimi.it/). It's fast, has 256 bits of
+ * state and supports jumping 2^128 steps ahead, which is
+ * used to split one seed into non-overlapping streams.
+ *
+ * The state is explicit, so every thread or simulated
+ * exporter can have its own generator.
+ */
+struct randomState
+{
+    uint64_t s[4];
+};
+
+/**
+ * Seed the generator
+ *
+ * The 64-bit seed is expanded into the full state by
+ * the splitmix64 generator, so even similar seeds give
+ * unrelated streams.
+ *
+ * @param[out] state Generator state
+ * @param[in]  seed  Seed value
+ *
+ * @return void
+ */
+void randomSeed(struct randomState* state, uint64_t seed);
+
+/**
+ * Jump 2^128 steps ahead
+ *
+ * Equivalent to 2^128 calls of randomNext(). Use it
+ * to generate non-overlapping streams from one seed.
+ *
+ * @param[in,out] state Seeded generator state
+ *
+ * @return void
+ */
+void randomJump(struct randomState* state);
+
+/**
+ * Jump 2^192 steps ahead
+ *
+ * Makes room for 2^64 streams separated by randomJump()
+ * between two long jumps, e.g. one long jump per thread
+ * and one jump per exporter simulated by the thread.
+ *
+ * @param[in,out] state Seeded generator state
+ *
+ * @return void
+ */
+void randomLongJump(struct randomState* state);
+
+/**
+ * Fill \c values with 32-bit random numbers
+ *
+ * Both halves of every 64-bit output are used.
+ *
+ * @param[in,out] state  Seeded generator state
+ * @param[out]    values Output array
+ * @param[in]     count  Number of values to generate
+ *
+ * @return void
+ */
+void randomFill(struct randomState* state, uint32_t* values, size_t count);
+
+/**
+ * Scramble bits of a 64-bit value
+ *
+ * The splitmix64 finalizer. Use it as a hash function
+ * or to derive independent values from counters.
+ *
+ * @param[in] x Value to scramble
+ *
+ * @return Scrambled value
+ */
+static inline uint64_t mixBits(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t rotateLeft(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * Next 64-bit random number
+ *
+ * @param[in,out] state Seeded generator state
+ *
+ * @return Random number
+ */
+static inline uint64_t randomNext(struct randomState* state)
+{
+    uint64_t* s = state->s;
+    uint64_t result = rotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotateLeft(s[3], 45);
+
+    return result;
+}
+
+/**
+ * Scale 32-bit random number into [0, range)
+ *
+ * Uses multiplication instead of modulo (Lemire's method
+ * without the rejection step). It's branch-free, vectorizes
+ * well and the bias is at most range/2^32, i.e. negligible
+ * for the ranges used by the generator.
+ *
+ * @param[in] value Uniformly distributed 32-bit number
+ * @param[in] range Size of the output range
+ *
+ * @return Number in [0, range)
+ */
+static inline uint32_t randomScale(uint32_t value, uint32_t range)
+{
+    return ((uint64_t) value * range) >> 32;
+}
+
+/**
+ * Random number in [0, range)
+ *
+ * @param[in,out] state Seeded generator state
+ * @param[in]     range Size of the output range
+ *
+ * @return Number in [0, range)
+ */
+static inline uint32_t randomBounded(struct randomState* state, uint32_t range)
+{
+    return randomScale(randomNext(state) >> 32, range);
+}
+
+#endif
+
@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "replay.h"
+#include "pacing.h"
+#include "template.h"
+#include "pcap.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+/* How often is the rate report printed [ns] */
+#define RATE_REPORT_INTERVAL 1000000000ULL
+
+#define V5_HEADER_SIZE    24
+#define V5_RECORD_SIZE    48
+#define V9_HEADER_SIZE    20
+#define IPFIX_HEADER_SIZE 16
+#define SET_HEADER_SIZE   4
+
+/* NetFlow v9 and IPFIX set IDs */
+#define V9_TEMPLATE_SET      0
+#define V9_OPTIONS_SET       1
+#define IPFIX_TEMPLATE_SET   2
+#define MIN_DATA_SET         256
+#define VARIABLE_LENGTH      65535
+#define ENTERPRISE_BIT       0x8000
+
+#define UDP_HEADER_SIZE 8
+
+static inline uint32_t get32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+static inline void put32(unsigned char* p, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+/** Index of the import, freed once the file is indexed */
+struct indexer
+{
+    size_t    capacity;
+    uint16_t* templateLengths;  /* IPFIX data record length by template ID, 0 = unknown */
+    size_t    skipped;
+};
+
+/** Count the IPFIX data records, sequence numbers count them. */
+static uint32_t ipfixRecords(struct indexer* indexer, const unsigned char* pdu, size_t size)
+{
+    uint32_t records = 0;
+    size_t offset = IPFIX_HEADER_SIZE;
+
+    while (offset + SET_HEADER_SIZE <= size)
+    {
+        uint16_t id     = getNet16(pdu + offset);
+        uint16_t length = getNet16(pdu + offset + 2);
+        if (length < SET_HEADER_SIZE || offset + length > size)
+        {
+            break;
+        }
+
+        const unsigned char* p   = pdu + offset + SET_HEADER_SIZE;
+        const unsigned char* end = pdu + offset + length;
+
+        if (id == IPFIX_TEMPLATE_SET)
+        {
+            while (p + 4 <= end)
+            {
+                uint16_t templateId     = getNet16(p);
+                uint16_t numberOfFields = getNet16(p + 2);
+                unsigned int recordLength = 0;
+                p += 4;
+
+                for (unsigned int i = 0; i < numberOfFields && p + 4 <= end; i++)
+                {
+                    uint16_t element = getNet16(p);
+                    uint16_t fieldLength = getNet16(p + 2);
+                    p += (element & ENTERPRISE_BIT) ? 8 : 4;
+
+                    /* Records with variable length fields can't be counted */
+                    recordLength = (fieldLength == VARIABLE_LENGTH || recordLength == UINT16_MAX) ?
+                                   UINT16_MAX : recordLength + fieldLength;
+                }
+
+                indexer->templateLengths[templateId] = recordLength < UINT16_MAX ? recordLength : 0;
+            }
+        }
+        else if (id >= MIN_DATA_SET && indexer->templateLengths[id] > 0)
+        {
+            records += (length - SET_HEADER_SIZE) / indexer->templateLengths[id];
+        }
+
+        offset += length;
+    }
+
+    return records;
+}
+
+/** Size of the raw PDU at \c pdu, 0 if it isn't a valid PDU */
+static size_t rawPduSize(const unsigned char* pdu, size_t remaining)
+{
+    size_t size = 0;
+
+    if (remaining < IPFIX_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    switch (getNet16(pdu))
+    {
+    case NETFLOW_V5:
+        size = V5_HEADER_SIZE + (size_t) getNet16(pdu + 2) * V5_RECORD_SIZE;
+        break;
+    case NETFLOW_V9:
+        /* v9 has no length field. Walk the flowsets until the version
+           of the next PDU, which is a reserved flowset ID. */
+        size = V9_HEADER_SIZE;
+        while (size + SET_HEADER_SIZE <= remaining)
+        {
+            uint16_t id = getNet16(pdu + size);
+            uint16_t length = getNet16(pdu + size + 2);
+            if (id == NETFLOW_V9 || (id > V9_OPTIONS_SET && id < MIN_DATA_SET))
+            {
+                break;
+            }
+            if (length < SET_HEADER_SIZE)
+            {
+                return 0;
+            }
+            size += length;
+        }
+        break;
+    case IPFIX:
+        size = getNet16(pdu + 2);
+        break;
+    }
+
+    return size <= remaining ? size : 0;
+}
+
+/** Export time of the PDU from its header [ns] */
+static uint64_t headerTime(const unsigned char* pdu)
+{
+    switch (getNet16(pdu))
+    {
+    case NETFLOW_V5:
+        return get32(pdu + 8) * NSECS_PER_SEC + get32(pdu + 12);
+    case NETFLOW_V9:
+        return get32(pdu + 8) * NSECS_PER_SEC;
+    default:
+        return get32(pdu + 4) * NSECS_PER_SEC;
+    }
+}
+
+/** Append the PDU to the index. Non-NetFlow payloads are skipped. */
+static error_t addPdu(struct replay* replay, struct indexer* indexer, unsigned char* pdu,
+                      size_t size, uint64_t time)
+{
+    uint16_t version = size >= IPFIX_HEADER_SIZE ? getNet16(pdu) : 0;
+    uint32_t records, flows;
+
+    if (version == NETFLOW_V5 && size >= V5_HEADER_SIZE)
+    {
+        records = flows = getNet16(pdu + 2);
+    }
+    else if (version == NETFLOW_V9 && size >= V9_HEADER_SIZE)
+    {
+        records = 1;                 /* v9 counts PDUs */
+        flows   = getNet16(pdu + 2);    /* Template records included */
+    }
+    else if (version == IPFIX)
+    {
+        records = flows = ipfixRecords(indexer, pdu, size);
+    }
+    else
+    {
+        indexer->skipped++;
+        return EOK;
+    }
+
+    if (replay->numberOfPdus == indexer->capacity)
+    {
+        size_t capacity = indexer->capacity > 0 ? 2 * indexer->capacity : 1024;
+        struct replayPdu* pdus = (struct replayPdu*) realloc(replay->pdus, capacity * sizeof(struct replayPdu));
+        if (pdus == NULL)
+        {
+            return ENOMEM;
+        }
+
+        replay->pdus = pdus;
+        indexer->capacity = capacity;
+    }
+
+    struct replayPdu* entry = &replay->pdus[replay->numberOfPdus++];
+    entry->data    = pdu;
+    entry->size    = size;
+    entry->records = records;
+    entry->flows   = flows;
+    entry->time    = time;
+
+    return EOK;
+}
+
+static error_t indexRaw(struct replay* replay, struct indexer* indexer)
+{
+    size_t offset = 0;
+
+    while (offset < replay->mapSize)
+    {
+        size_t size = rawPduSize(replay->map + offset, replay->mapSize - offset);
+        if (size == 0)
+        {
+            fprintf(stderr, "Replay: no valid PDU at offset %zu, ignoring the rest of the file.\n", offset);
+            break;
+        }
+
+        error_t status = addPdu(replay, indexer, replay->map + offset, size, headerTime(replay->map + offset));
+        if (status != EOK)
+        {
+            return status;
+        }
+
+        offset += size;
+    }
+
+    return EOK;
+}
+
+/** Find the UDP payload in a captured frame, NULL if there is none */
+static unsigned char* udpPayload(const struct pcapFormat* format, unsigned char* frame, size_t captured,
+                                 size_t* size)
+{
+    struct capturedPacket packet;
+
+    /* IPv6 extension headers are not supported */
+    if (!pcapFindPacket(format, frame, captured, &packet) || packet.protocol != IPPROTO_UDP ||
+        packet.fragment != 0)
+    {
+        return NULL;
+    }
+
+    /* The packet points into the frame, which is writable */
+    unsigned char* udp = (unsigned char*) packet.transport;
+    unsigned char* end = frame + captured;
+
+    if (udp + UDP_HEADER_SIZE > end || getNet16(udp + 4) < UDP_HEADER_SIZE)
+    {
+        return NULL;
+    }
+
+    *size = getNet16(udp + 4) - UDP_HEADER_SIZE;
+    if (udp + UDP_HEADER_SIZE + *size > end)
+    {
+        return NULL;  /* Truncated by the snap length */
+    }
+
+    return udp + UDP_HEADER_SIZE;
+}
+
+static error_t indexPcap(struct replay* replay, struct indexer* indexer, const struct pcapFormat* format)
+{
+    size_t offset = PCAP_FILE_HEADER_SIZE;
+    while (offset + PCAP_RECORD_HEADER_SIZE <= replay->mapSize)
+    {
+        uint64_t time;
+        size_t captured = pcapReadRecord(format, replay->map + offset, &time);
+
+        offset += PCAP_RECORD_HEADER_SIZE;
+        if (offset + captured > replay->mapSize)
+        {
+            fprintf(stderr, "Replay: the capture is truncated.\n");
+            break;
+        }
+
+        size_t size;
+        unsigned char* payload = udpPayload(format, replay->map + offset, captured, &size);
+        if (payload != NULL)
+        {
+            error_t status = addPdu(replay, indexer, payload, size, time);
+            if (status != EOK)
+            {
+                return status;
+            }
+        }
+        else
+        {
+            indexer->skipped++;
+        }
+
+        offset += captured;
+    }
+
+    return EOK;
+}
+
+error_t openReplay(struct replay* replay, const char* path, double speed, unsigned int loops, int rewrite)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->speed   = speed;
+    replay->loops   = loops;
+    replay->rewrite = rewrite;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        error_t status = errno;
+        close(fd);
+        return status;
+    }
+
+    if (fileStat.st_size == 0)
+    {
+        close(fd);
+        return EINVAL;
+    }
+
+    /* Rewritten headers go to private copies of the pages */
+    replay->mapSize = fileStat.st_size;
+    replay->map = (unsigned char*) mmap(NULL, replay->mapSize, rewrite ? PROT_READ | PROT_WRITE : PROT_READ,
+                                        MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (replay->map == MAP_FAILED)
+    {
+        replay->map = NULL;
+        return errno;
+    }
+
+    struct indexer indexer;
+    indexer.capacity = 0;
+    indexer.skipped  = 0;
+    indexer.templateLengths = (uint16_t*) calloc(UINT16_MAX + 1, sizeof(uint16_t));
+    if (indexer.templateLengths == NULL)
+    {
+        closeReplay(replay);
+        return ENOMEM;
+    }
+
+    struct pcapFormat format;
+    error_t status = pcapReadHeader(replay->map, replay->mapSize, &format) == EOK ?
+                     indexPcap(replay, &indexer, &format) : indexRaw(replay, &indexer);
+    free(indexer.templateLengths);
+
+    if (status == EOK && replay->numberOfPdus == 0)
+    {
+        status = EINVAL;
+    }
+
+    if (status != EOK)
+    {
+        closeReplay(replay);
+        return status;
+    }
+
+    fprintf(stderr, "Replay: %zu PDUs loaded", replay->numberOfPdus);
+    if (indexer.skipped > 0)
+    {
+        fprintf(stderr, ", %zu other packets skipped", indexer.skipped);
+    }
+    fprintf(stderr, ".\n");
+
+    return EOK;
+}
+
+/** Sequence counter of the exporter, NULL if there are too many exporters */
+static uint32_t* streamSequence(struct replay* replay, uint64_t key, uint32_t initial)
+{
+    unsigned int index = (key * 0x9e3779b97f4a7c15ULL) >> 54;  /* log2(REPLAY_STREAMS) bits */
+
+    for (unsigned int i = 0; i < REPLAY_STREAMS; i++)
+    {
+        struct replayStream* stream = &replay->streams[(index + i) % REPLAY_STREAMS];
+
+        if (!stream->used)
+        {
+            stream->used     = 1;
+            stream->key      = key;
+            stream->sequence = initial;
+        }
+
+        if (stream->key == key)
+        {
+            return &stream->sequence;
+        }
+    }
+
+    return NULL;
+}
+
+/** Set export time to \c now and continue the exporter's sequence */
+static void rewriteHeader(struct replay* replay, const struct replayPdu* pdu, const struct timespec* now)
+{
+    unsigned char* data = pdu->data;
+    uint16_t version = getNet16(data);
+    unsigned int sequenceOffset;
+    uint64_t key;
+
+    switch (version)
+    {
+    case NETFLOW_V5:
+        put32(data + 8, now->tv_sec);
+        put32(data + 12, now->tv_nsec);
+        key = getNet16(data + 20);         /* Engine type and ID */
+        sequenceOffset = 16;
+        break;
+    case NETFLOW_V9:
+        put32(data + 8, now->tv_sec);
+        key = get32(data + 16);         /* Source ID */
+        sequenceOffset = 12;
+        break;
+    default:
+        put32(data + 4, now->tv_sec);
+        key = get32(data + 12);         /* Observation domain */
+        sequenceOffset = 8;
+        break;
+    }
+
+    uint32_t* sequence = streamSequence(replay, ((uint64_t) version << 32) | key, get32(data + sequenceOffset));
+    if (sequence != NULL)
+    {
+        put32(data + sequenceOffset, *sequence);
+        *sequence += pdu->records;
+    }
+}
+
+void runReplay(struct replay* replay, struct worker* worker)
+{
+    const struct cliArguments* arguments = worker->arguments;
+    unsigned int batchSize = arguments->batchSize;
+
+    /* A rate given on the command line overrides the capture timing */
+    struct pacer pacer;
+    pacerInitialize(&pacer, worker->rate > 0 ? worker->rate : 0, (uint64_t) (worker->rate / 100) + 1);
+    int captureTiming = worker->rate < 0 && replay->speed > 0;
+
+    /* Recorded PDUs can't be cut, --flow-count stops after the PDU reaching it */
+    struct runBudget budget;
+    initializeBudget(&budget, worker);
+
+    for (unsigned int loop = 0; (replay->loops == 0 || loop < replay->loops) && budgetLeft(&budget); loop++)
+    {
+        uint64_t start = monotonicTime();
+        uint64_t firstTime = replay->pdus[0].time;
+        uint64_t lastTime  = firstTime;
+
+        for (size_t i = 0; i < replay->numberOfPdus && budgetLeft(&budget); i += batchSize)
+        {
+            unsigned int count = replay->numberOfPdus - i < batchSize ? replay->numberOfPdus - i : batchSize;
+            const struct replayPdu* first = &replay->pdus[i];
+            unsigned int flows = 0;
+
+            count = budget.pdus < count ? budget.pdus : count;
+            for (unsigned int j = 0; j < count && flows < budget.flows; j++)
+            {
+                flows += first[j].flows;
+                if (flows >= budget.flows)
+                {
+                    count = j + 1;
+                }
+            }
+            budgetSpend(&budget, count, flows);
+
+            if (captureTiming)
+            {
+                /* A batch leaves at the time of its last PDU. Time going
+                   backwards (e.g. merged captures) doesn't delay anything. */
+                uint64_t time = first[count - 1].time;
+                lastTime = time > lastTime ? time : lastTime;
+                pacerWaitUntil(&pacer, start + (uint64_t) ((lastTime - firstTime) / replay->speed), count);
+            }
+            else
+            {
+                pacerWait(&pacer, arguments->rateInFlows ? flows : count);
+            }
+
+            if (replay->rewrite)
+            {
+                struct timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+
+                for (unsigned int j = 0; j < count; j++)
+                {
+                    rewriteHeader(replay, &first[j], &now);
+                }
+            }
+
+            for (unsigned int j = 0; j < count; j++)
+            {
+                senderAdd(&worker->sender, (char*) first[j].data, first[j].size, first[j].flows);
+            }
+
+            flushBatch(worker);
+
+            if (pacerWindowElapsed(&pacer) >= RATE_REPORT_INTERVAL)
+            {
+                pacerReport(&pacer, stderr, arguments->rateInFlows ? "flows" : "PDUs");
+            }
+        }
+    }
+}
+
+void closeReplay(struct replay* replay)
+{
+    if (replay->map != NULL)
+    {
+        munmap(replay->map, replay->mapSize);
+    }
+
+    free(replay->pdus);
+
+    replay->map          = NULL;
+    replay->pdus         = NULL;
+    replay->numberOfPdus = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REPLAY__H_
+#define _REPLAY__H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "errors.h"
+#include "worker.h"
+
+/* Maximum number of exporters whose sequence numbers are rewritten */
+#define REPLAY_STREAMS 1024
+
+/** One PDU of the replayed capture */
+struct replayPdu
+{
+    unsigned char* data;     /* Points into the mapped file */
+    uint32_t       size;
+    uint32_t       records;  /* Sequence number increment */
+    uint32_t       flows;    /* Number of records */
+    uint64_t       time;     /* Capture or export time [ns] */
+};
+
+/** Sequence counter of one exporter (version, engine/source/domain) */
+struct replayStream
+{
+    uint64_t key;
+    uint32_t sequence;
+    int      used;
+};
+
+/** Recorded PDUs sent again
+ *
+ * The file is mapped into memory and indexed once. The
+ * PDUs are then sent straight from the mapping. When the
+ * headers are rewritten, the mapping is private and
+ * writable, so the patched pages are copied on write and
+ * the file stays intact.
+ */
+struct replay
+{
+    unsigned char*    map;
+    size_t            mapSize;
+    struct replayPdu* pdus;
+    size_t            numberOfPdus;
+
+    double            speed;     /* Capture timing multiplier, 0 = as fast as possible */
+    unsigned int      loops;     /* 0 = forever */
+    int               rewrite;   /* Set time stamps and sequence numbers on send */
+
+    struct replayStream streams[REPLAY_STREAMS];
+};
+
+/**
+ * Map and index a recorded file
+ *
+ * Accepts files written by -o in raw format (v5, v9 and
+ * IPFIX PDUs back to back) and pcap captures of NetFlow
+ * over UDP (Ethernet, Linux cooked or raw IP link types).
+ * Packets that are not NetFlow/IPFIX are skipped.
+ *
+ * @param[out] replay  Replay to be initialized
+ * @param[in]  path    Recorded file
+ * @param[in]  speed   Capture timing multiplier, 0 = as fast as possible
+ * @param[in]  loops   How many times the file is sent, 0 = forever
+ * @param[in]  rewrite Update header time stamps and sequence numbers
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t openReplay(struct replay* replay, const char* path, double speed, unsigned int loops, int rewrite);
+
+/**
+ * Send the recorded PDUs
+ *
+ * Uses the sender, batch size, output file and rate of
+ * the worker. With a rate (-r/-f) set, the PDUs are paced
+ * by it instead of the capture timing. Returns when all
+ * loops are done.
+ *
+ * @param[in,out] replay Open replay (@see openReplay())
+ * @param[in,out] worker Initialized worker
+ *
+ * @return void
+ */
+void runReplay(struct replay* replay, struct worker* worker);
+
+/**
+ * Unmap the file and free the index
+ *
+ * @param[in,out] replay Open replay
+ *
+ * @return void
+ */
+void closeReplay(struct replay* replay);
+
+#endif
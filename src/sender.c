@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sender.h"
+
+error_t initializeSender(struct sender* sender, const struct destination* destinations,
+                         unsigned int numberOfDestinations, int mode, unsigned int batchSize,
+                         const struct transmitMode* transmit)
+{
+    sender->numberOfDestinations = 0;
+    sender->mode = mode;
+    sender->next = 0;
+
+    sender->destinations = (struct senderDestination*) calloc(numberOfDestinations, sizeof(struct senderDestination));
+    if (sender->destinations == NULL)
+    {
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < numberOfDestinations; i++)
+    {
+        struct senderDestination* destination = &sender->destinations[i];
+        const struct destination* address = &destinations[i];
+        error_t status;
+
+        destination->destination = *address;
+        destination->udpSocket = address->family == AF_INET6 ? udpInitialize6() : udpInitialize();
+        sender->numberOfDestinations++;
+
+        destination->pdus  = (char**) calloc(batchSize, sizeof(char*));
+        destination->sizes = (size_t*) calloc(batchSize, sizeof(size_t));
+        destination->flows = (unsigned int*) calloc(batchSize, sizeof(unsigned int));
+        destination->sources = (in_addr_t*) calloc(batchSize, sizeof(in_addr_t));
+        destination->times = (uint64_t*) calloc(batchSize, sizeof(uint64_t));
+        if (destination->pdus == NULL || destination->sizes == NULL || destination->flows == NULL ||
+            destination->sources == NULL || destination->times == NULL)
+        {
+            freeSender(sender);
+            return ENOMEM;
+        }
+
+        status = address->family == AF_INET6 ?
+                 udpConnect6(destination->udpSocket, &address->address6, address->port) :
+                 udpConnect(destination->udpSocket, address->address, address->port);
+        if (status == EOK)
+        {
+            status = udpInitializeBatch(&destination->batch, batchSize);
+        }
+        if (status == EOK)
+        {
+            udpEnableOffload(destination->udpSocket, &destination->batch, transmit->offload);
+        }
+        /* The endpoints frame IPv4 packets only (pcap output, TX ring) */
+        if (status == EOK && address->family != AF_INET6)
+        {
+            destination->endpoints.destination     = address->address;
+            destination->endpoints.destinationPort = htons(address->port);
+            status = udpLocalEndpoint(destination->udpSocket, address->address, address->port,
+                                      &destination->endpoints.source, &destination->endpoints.sourcePort);
+        }
+
+        if (status == EOK && transmit->interface != NULL)
+        {
+            destination->ring = (struct packetRing*) malloc(sizeof(struct packetRing));
+            status = destination->ring == NULL ? ENOMEM :
+                     initializePacketRing(destination->ring, transmit->interface, address->address,
+                                          transmit->maxDatagram, batchSize);
+            if (status != EOK)
+            {
+                free(destination->ring);
+                destination->ring = NULL;
+            }
+        }
+
+        if (status != EOK)
+        {
+            freeSender(sender);
+            return status;
+        }
+    }
+
+    return EOK;
+}
+
+static void addToDestination(struct senderDestination* destination, char* pdu, size_t size,
+                             unsigned int flows, in_addr_t source, uint64_t time)
+{
+    unsigned int index = destination->batch.count;
+
+    destination->pdus[index]    = pdu;
+    destination->sizes[index]   = size;
+    destination->flows[index]   = flows;
+    destination->sources[index] = source;
+    destination->times[index]   = time;
+
+    udpAddToBatchFrom(&destination->batch, pdu, size, source);
+}
+
+void senderAdd(struct sender* sender, char* pdu, size_t size, unsigned int flows)
+{
+    senderAddFrom(sender, pdu, size, flows, htonl(INADDR_ANY), 0);
+}
+
+void senderAddFrom(struct sender* sender, char* pdu, size_t size, unsigned int flows, in_addr_t source,
+                   uint64_t time)
+{
+    if (sender->mode == FANOUT_SHARD)
+    {
+        addToDestination(&sender->destinations[sender->next], pdu, size, flows, source, time);
+        sender->next = (sender->next + 1) % sender->numberOfDestinations;
+        return;
+    }
+
+    for (unsigned int i = 0; i < sender->numberOfDestinations; i++)
+    {
+        addToDestination(&sender->destinations[i], pdu, size, flows, source, time);
+    }
+}
+
+struct senderResult senderFlush(struct sender* sender)
+{
+    struct senderResult result;
+    memset(&result, 0, sizeof(result));
+
+    for (unsigned int i = 0; i < sender->numberOfDestinations; i++)
+    {
+        struct senderDestination* destination = &sender->destinations[i];
+        unsigned int count = destination->batch.count;
+
+        if (count == 0)
+        {
+            destination->sent = 0;
+            continue;
+        }
+
+        if (destination->ring != NULL)
+        {
+            destination->sent = packetRingSend(destination->ring, &destination->endpoints, destination->pdus,
+                                               destination->sizes, destination->sources, count);
+            destination->batch.count = 0;
+        }
+        else
+        {
+            destination->sent = udpSendBatch(destination->udpSocket, &destination->batch);
+        }
+        if (destination->sent < count)
+        {
+            result.failed += count - destination->sent;
+            result.errorNumber = errno;
+        }
+
+        for (unsigned int j = 0; j < destination->sent; j++)
+        {
+            result.flows += destination->flows[j];
+            result.bytes += destination->sizes[j];
+        }
+        result.sent += destination->sent;
+    }
+
+    return result;
+}
+
+void senderWriteOutput(struct sender* sender, struct outputFile* output)
+{
+    unsigned int numberOfDestinations = sender->mode == FANOUT_SHARD ? sender->numberOfDestinations : 1;
+
+    for (unsigned int i = 0; i < numberOfDestinations; i++)
+    {
+        struct senderDestination* destination = &sender->destinations[i];
+        struct udpEndpoints endpoints = destination->endpoints;
+
+        /* Runs of PDUs with the same source address are written at once */
+        for (unsigned int start = 0, end; start < destination->sent; start = end)
+        {
+            in_addr_t source = destination->sources[start];
+
+            for (end = start + 1; end < destination->sent && destination->sources[end] == source; end++)
+            {
+                /* Extend the run */
+            }
+
+            endpoints.source = source == htonl(INADDR_ANY) ? destination->endpoints.source : source;
+            writeToOutputFile(output, &endpoints, destination->pdus + start, destination->sizes + start,
+                              destination->times + start, end - start);
+        }
+    }
+}
+
+void freeSender(struct sender* sender)
+{
+    for (unsigned int i = 0; i < sender->numberOfDestinations; i++)
+    {
+        struct senderDestination* destination = &sender->destinations[i];
+
+        udpClose(destination->udpSocket);
+        udpFreeBatch(&destination->batch);
+        if (destination->ring != NULL)
+        {
+            freePacketRing(destination->ring);
+            free(destination->ring);
+        }
+        free(destination->pdus);
+        free(destination->sizes);
+        free(destination->flows);
+        free(destination->sources);
+        free(destination->times);
+    }
+
+    free(sender->destinations);
+    sender->destinations = NULL;
+    sender->numberOfDestinations = 0;
+}
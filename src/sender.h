@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SENDER__H_
+#define _SENDER__H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "errors.h"
+#include "udp.h"
+#include "binaryoutput.h"
+#include "packetring.h"
+
+/* How PDUs are spread over the destinations */
+#define FANOUT_MIRROR 0  /* Every destination gets every PDU */
+#define FANOUT_SHARD  1  /* Round robin, every PDU goes to one destination */
+
+/* Maximum number of destinations */
+#define MAX_DESTINATIONS 1024
+
+/** Collector address */
+struct destination
+{
+    int             family;     /* AF_INET or AF_INET6 */
+    in_addr_t       address;
+    struct in6_addr address6;
+    in_port_t       port;
+};
+
+/** How the PDUs leave */
+struct transmitMode
+{
+    int         offload;      /* UDP_OFFLOAD_* flags, unsupported ones are left off */
+    const char* interface;    /* Send through a TX ring of this interface, NULL for the UDP socket */
+    size_t      maxDatagram;  /* Largest PDU, sizes the ring frames */
+};
+
+/** Socket and pending batch of one destination */
+struct senderDestination
+{
+    struct destination  destination;
+    int                 udpSocket;       /* Connected to the destination */
+    struct packetRing*  ring;            /* NULL = send through udpSocket */
+    struct udpBatch     batch;
+    char**              pdus;            /* PDUs of the batch */
+    size_t*             sizes;
+    unsigned int*       flows;
+    in_addr_t*          sources;         /* Source address of every PDU */
+    uint64_t*           times;           /* Export time of every PDU, 0 = unknown */
+    unsigned int        sent;            /* PDUs sent by the last flush */
+    struct udpEndpoints endpoints;       /* For pcap output */
+};
+
+/** Result of senderFlush() */
+struct senderResult
+{
+    unsigned int sent;        /* Datagrams sent */
+    unsigned int failed;      /* Datagrams not sent */
+    uint64_t     flows;       /* Records in the sent datagrams */
+    uint64_t     bytes;
+    int          errorNumber; /* errno of the last failure */
+};
+
+/** PDU distribution over a set of collectors
+ *
+ * PDUs are queued by reference, so a mirrored PDU is
+ * generated once and only its pointer is added to the
+ * batch of every destination.
+ */
+struct sender
+{
+    struct senderDestination* destinations;
+    unsigned int numberOfDestinations;
+    int          mode;        /* FANOUT_MIRROR or FANOUT_SHARD */
+    unsigned int next;        /* Next shard */
+};
+
+/**
+ * Connect a socket to every destination
+ *
+ * The socket is connected even with a TX ring, it sets
+ * the source address and port of the crafted datagrams.
+ *
+ * @param[out] sender               Sender to be initialized
+ * @param[in]  destinations         Collectors
+ * @param[in]  numberOfDestinations Number of collectors
+ * @param[in]  mode                 FANOUT_MIRROR or FANOUT_SHARD
+ * @param[in]  batchSize            Maximum PDUs per flush
+ * @param[in]  transmit             Offloads or TX ring
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t initializeSender(struct sender* sender, const struct destination* destinations,
+                         unsigned int numberOfDestinations, int mode, unsigned int batchSize,
+                         const struct transmitMode* transmit);
+
+/**
+ * Queue a PDU
+ *
+ * The PDU is not copied, it must stay valid until the
+ * batch is flushed and written to the output file.
+ *
+ * @param[in,out] sender Initialized sender
+ * @param[in]     pdu    PDU content
+ * @param[in]     size   PDU size
+ * @param[in]     flows  Number of records in the PDU
+ *
+ * @return void
+ */
+void senderAdd(struct sender* sender, char* pdu, size_t size, unsigned int flows);
+
+/**
+ * Queue a PDU sent from its own source address
+ *
+ * The same as senderAdd(), but the datagram (and its copy
+ * in a pcap output) gets \c source as the source address.
+ * @see udpAddToBatchFrom()
+ *
+ * @param[in,out] sender Initialized sender
+ * @param[in]     pdu    PDU content
+ * @param[in]     size   PDU size
+ * @param[in]     flows  Number of records in the PDU
+ * @param[in]     source Source address (network order), INADDR_ANY for the default
+ * @param[in]     time   Export time for pcap output [ns since the epoch], \
+ *                       0 for the time of writing
+ *
+ * @return void
+ */
+void senderAddFrom(struct sender* sender, char* pdu, size_t size, unsigned int flows, in_addr_t source,
+                   uint64_t time);
+
+/**
+ * Send the queued PDUs to all destinations
+ *
+ * @param[in,out] sender Initialized sender
+ *
+ * @return What was sent
+ */
+struct senderResult senderFlush(struct sender* sender);
+
+/**
+ * Store the PDUs sent by the last flush
+ *
+ * Mirrored PDUs are stored once, with the addresses of
+ * the first destination.
+ *
+ * @param[in] sender Sender after senderFlush()
+ * @param[in] output Open output file
+ *
+ * @return void
+ */
+void senderWriteOutput(struct sender* sender, struct outputFile* output);
+
+/**
+ * Close the sockets and free the batches
+ *
+ * @param[in,out] sender Initialized sender
+ *
+ * @return void
+ */
+void freeSender(struct sender* sender);
+
+#endif
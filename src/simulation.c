@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "simulation.h"
+#include "random.h"
+
+#define NSECS_PER_MSEC 1000000ULL
+#define NSECS_PER_SEC  1000000000ULL
+
+/* The whole cache is checked for timed out flows once per simulated second */
+#define SWEEP_PERIOD NSECS_PER_SEC
+
+/* Flow lifetimes [ms] */
+#define MIN_FLOW_LIFETIME 1000
+#define MAX_FLOW_LIFETIME 120000
+
+#define MIN_PACKET_SIZE 40
+#define MAX_PACKET_SIZE 1500
+
+/** Move an expired flow to the export queue. */
+static void queueFlow(void* context, const struct flowEntry* flow)
+{
+    struct flowSimulation* simulation = (struct flowSimulation*) context;
+
+    flowToRecord(flow, &simulation->pending[simulation->pendingCount++]);
+}
+
+/** Generate one packet and account it in the cache. */
+static void simulatePacket(struct flowSimulation* simulation, struct randomState* random)
+{
+    uint32_t now = simulation->now / NSECS_PER_MSEC;
+    uint32_t values[3];
+
+    randomFill(random, values, 3);
+
+    /* The 5-tuple of a slot changes after the slot's lifetime */
+    uint32_t slot = randomScale(values[0], simulation->concurrentFlows);
+    uint64_t slotHash = mixBits(simulation->flowSalt ^ slot);
+    uint32_t lifetime = MIN_FLOW_LIFETIME + slotHash % (MAX_FLOW_LIFETIME - MIN_FLOW_LIFETIME);
+    uint64_t generation = (now + (slotHash >> 32) % lifetime) / lifetime;
+
+    uint64_t addresses = mixBits(slotHash + generation * 0x9e3779b97f4a7c15ULL);
+    uint64_t ports = mixBits(addresses);
+
+    struct flowEntry packet;
+    packet.srcAddr  = netflowHost(addresses);
+    packet.dstAddr  = netflowHost(addresses >> 32);
+    packet.srcPort  = ports;
+    packet.dstPort  = ports >> 16;
+    packet.prot     = (ports >> 32) & 1 ? IPPROTO_TCP : IPPROTO_UDP;
+    packet.tos      = 0;
+    packet.pad      = 0;
+    packet.tcpFlags = packet.prot == IPPROTO_TCP ? values[1] & 0x3f : 0;
+    packet.dOctets  = MIN_PACKET_SIZE + randomScale(values[2], MAX_PACKET_SIZE - MIN_PACKET_SIZE + 1);
+
+    updateFlow(&simulation->cache, &packet, now);
+    expireFlows(&simulation->cache, now, simulation->sweepSlots);
+
+    simulation->now += simulation->packetInterval;
+}
+
+error_t initializeSimulation(struct flowSimulation* simulation, struct netflowExporter* exporter,
+                             size_t cacheSize, uint32_t concurrentFlows,
+                             uint32_t activeTimeout, uint32_t inactiveTimeout, double packetRate,
+                             unsigned int maxRecords)
+{
+    error_t status = initializeFlowCache(&simulation->cache, cacheSize, activeTimeout, inactiveTimeout,
+                                         queueFlow, simulation);
+    if (status != EOK)
+    {
+        return status;
+    }
+
+    double packetsPerSweep = packetRate * SWEEP_PERIOD / NSECS_PER_SEC;
+
+    simulation->now             = 0;
+    simulation->packetInterval  = NSECS_PER_SEC / packetRate;
+    simulation->concurrentFlows = concurrentFlows > 0 ? concurrentFlows : 1;
+    simulation->sweepSlots      = flowCacheSlots(&simulation->cache) / packetsPerSweep + 1;
+    simulation->flowSalt        = randomNext(&exporter->random);
+    simulation->pendingCount    = 0;
+
+    /* Packets are simulated until maxRecords flows are pending, the
+       last one can evict one flow and expire up to sweepSlots flows */
+    simulation->pending = (struct netflowRecord*) calloc(maxRecords + simulation->sweepSlots + 1,
+                                                         sizeof(struct netflowRecord));
+    if (simulation->pending == NULL)
+    {
+        freeFlowCache(&simulation->cache);
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+unsigned int takeSimulatedRecords(struct flowSimulation* simulation, struct netflowExporter* exporter,
+                                  struct netflowRecord* records, unsigned int numberOfFlows,
+                                  uint32_t* sysUpTime)
+{
+    while (simulation->pendingCount < numberOfFlows)
+    {
+        simulatePacket(simulation, &exporter->random);
+    }
+
+    memcpy(records, simulation->pending, numberOfFlows * sizeof(struct netflowRecord));
+
+    simulation->pendingCount -= numberOfFlows;
+    memmove(simulation->pending, simulation->pending + numberOfFlows,
+            simulation->pendingCount * sizeof(struct netflowRecord));
+
+    *sysUpTime = simulation->now / NSECS_PER_MSEC;
+
+    return numberOfFlows;
+}
+
+size_t makeSimulatedNetflowPacket(char* buffer, struct flowSimulation* simulation,
+                                  struct netflowExporter* exporter, unsigned int maxRecords,
+                                  unsigned int* numberOfFlows)
+{
+    struct netflowRecord records[MAX_NETFLOW_RECORDS];
+    uint32_t sysUpTime;
+
+    *numberOfFlows = takeSimulatedRecords(simulation, exporter, records, maxRecords, &sysUpTime);
+
+    return makeNetflowPacket(buffer, exporter, records, *numberOfFlows, sysUpTime);
+}
+
+void freeSimulation(struct flowSimulation* simulation)
+{
+    freeFlowCache(&simulation->cache);
+    free(simulation->pending);
+
+    simulation->pending = NULL;
+    simulation->pendingCount = 0;
+}
+
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIMULATION__H_
+#define _SIMULATION__H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+#include "netflow.h"
+#include "flowcache.h"
+
+/** Simulated router.
+ *
+ * Instead of inventing records, the simulation generates
+ * packets and accounts them in a flow cache, the way a
+ * router does. Records are made of the flows expired
+ * from the cache.
+ *
+ * Packets belong to \c concurrentFlows flow "slots". Each
+ * slot carries a flow with a random 5-tuple for a random
+ * lifetime (1-120 s), then it switches to a new 5-tuple and
+ * the old flow goes idle and times out.
+ *
+ * Time is simulated, it advances by 1/packetRate with
+ * every packet. Time stamps of the records and of the
+ * PDU headers follow this clock.
+ */
+struct flowSimulation
+{
+    struct flowCache      cache;
+    struct netflowRecord* pending;        /* Expired flows waiting for export */
+    unsigned int          pendingCount;
+
+    uint64_t now;              /* Simulated uptime [ns] */
+    uint64_t packetInterval;   /* [ns] */
+    uint32_t concurrentFlows;
+    size_t   sweepSlots;       /* Cache slots checked per packet */
+    uint64_t flowSalt;         /* Makes 5-tuples depend on the seed */
+};
+
+/**
+ * Initialize the simulation
+ *
+ * @param[out]    simulation      Simulation to be initialized
+ * @param[in,out] exporter        Exporter that sends the records \
+ *                                (its generator is used)
+ * @param[in]     cacheSize       Maximum number of flows in the cache
+ * @param[in]     concurrentFlows Number of flows receiving packets at once
+ * @param[in]     activeTimeout   Active timeout [ms]
+ * @param[in]     inactiveTimeout Inactive timeout [ms]
+ * @param[in]     packetRate      Simulated packets per second
+ * @param[in]     maxRecords      Most records taken at once (MAX_NETFLOW_RECORDS \
+ *                                for v5, templateMaxCapacity() for v9/IPFIX)
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t initializeSimulation(struct flowSimulation* simulation, struct netflowExporter* exporter,
+                             size_t cacheSize, uint32_t concurrentFlows,
+                             uint32_t activeTimeout, uint32_t inactiveTimeout, double packetRate,
+                             unsigned int maxRecords);
+
+/**
+ * Simulate packets until \c numberOfFlows flows are exported
+ *
+ * @param[in,out] simulation    Initialized simulation
+ * @param[in,out] exporter      Exporter that sends the records
+ * @param[out]    records       Exported flows (host byte order, @see makeNetflowPacket())
+ * @param[in]     numberOfFlows Number of flows to take (<= maxRecords of initializeSimulation())
+ * @param[out]    sysUpTime     Simulated time of the export [ms]
+ *
+ * @return Number of records stored in \c records
+ */
+unsigned int takeSimulatedRecords(struct flowSimulation* simulation, struct netflowExporter* exporter,
+                                  struct netflowRecord* records, unsigned int numberOfFlows,
+                                  uint32_t* sysUpTime);
+
+/**
+ * Simulate packets until a PDU full of records is exported
+ *
+ * @param[out]    buffer        Buffer for NetFlow PDU (>= MAX_NETFLOW_PDU_SIZE)
+ * @param[in,out] simulation    Initialized simulation
+ * @param[in,out] exporter      Exporter that sends the PDU
+ * @param[in]     maxRecords    Records of a full PDU (<= MAX_NETFLOW_RECORDS)
+ * @param[out]    numberOfFlows Number of records in the PDU
+ *
+ * @return Final PDU size stored in \c buffer
+ */
+size_t makeSimulatedNetflowPacket(char* buffer, struct flowSimulation* simulation,
+                                  struct netflowExporter* exporter, unsigned int maxRecords,
+                                  unsigned int* numberOfFlows);
+
+/**
+ * Free the memory allocated by initializeSimulation()
+ *
+ * @param[in,out] simulation Simulation to be released
+ *
+ * @return void
+ */
+void freeSimulation(struct flowSimulation* simulation);
+
+#endif
+
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "worker.h"
+#include "binaryoutput.h"
+#include "pacing.h"
+
+#define NSECS_PER_SEC 1000000000ULL
+
+static const char* stageNames[NUMBER_OF_STAGES] = { "generate", "send", "write" };
+
+/** Sum the counters of all workers */
+static void collect(const struct worker* workers, unsigned int numberOfWorkers, struct workerStats* total)
+{
+    memset(total, 0, sizeof(*total));
+
+    for (unsigned int i = 0; i < numberOfWorkers; i++)
+    {
+        const struct workerStats* stats = &workers[i].stats;
+
+        total->pdus     += statsRead(&stats->pdus);
+        total->flows    += statsRead(&stats->flows);
+        total->bytes    += statsRead(&stats->bytes);
+        total->failures += statsRead(&stats->failures);
+
+        for (unsigned int e = 0; e < STATS_ERRNOS; e++)
+        {
+            total->errors[e] += statsRead(&stats->errors[e]);
+        }
+
+        for (unsigned int s = 0; s < NUMBER_OF_STAGES; s++)
+        {
+            for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+            {
+                total->latency[s].buckets[b] += statsRead(&stats->latency[s].buckets[b]);
+            }
+        }
+    }
+}
+
+/** Upper bound of the bucket holding quantile \c q [ns], 0 if empty */
+static uint64_t quantile(const struct statsHistogram* histogram, double q)
+{
+    uint64_t count = 0;
+    for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+    {
+        count += histogram->buckets[b];
+    }
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+    {
+        seen += histogram->buckets[b];
+        if (seen >= rank)
+        {
+            return b < 63 ? 1ULL << b : UINT64_MAX;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+static uint64_t outputDropped(const struct statsReporter* reporter)
+{
+    return reporter->outputFile != NULL ? statsRead(&reporter->outputFile->dropped) : 0;
+}
+
+static const char* errorName(int errorNumber)
+{
+    if (errorNumber == STATS_ERRNOS - 1)
+    {
+        return "other";
+    }
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 32)
+    const char* name = strerrorname_np(errorNumber);
+    if (name != NULL)
+    {
+        return name;
+    }
+#endif
+
+    return NULL;
+}
+
+/** Print rates and latencies since the previous summary */
+static void printSummary(struct statsReporter* reporter, const struct workerStats* total, uint64_t now)
+{
+    const struct workerStats* previous = &reporter->previous;
+    double elapsed = (double) (now - reporter->previousTime) / NSECS_PER_SEC;
+
+    if (elapsed <= 0)
+    {
+        return;
+    }
+
+    struct statsHistogram interval[NUMBER_OF_STAGES];
+    for (unsigned int s = 0; s < NUMBER_OF_STAGES; s++)
+    {
+        for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+        {
+            interval[s].buckets[b] = total->latency[s].buckets[b] - previous->latency[s].buckets[b];
+        }
+    }
+
+    flockfile(stderr);
+    fprintf(stderr, "Stats: %.0f PDUs/s, %.0f flows/s, %.1f Mbit/s, %llu failed; batch us p50/p99:",
+            (total->pdus - previous->pdus) / elapsed,
+            (total->flows - previous->flows) / elapsed,
+            (total->bytes - previous->bytes) * 8 / elapsed / 1e6,
+            (unsigned long long) (total->failures - previous->failures));
+    for (unsigned int s = 0; s < NUMBER_OF_STAGES; s++)
+    {
+        fprintf(stderr, " %s %.1f/%.1f", stageNames[s],
+                quantile(&interval[s], 0.5) / 1000.0, quantile(&interval[s], 0.99) / 1000.0);
+    }
+    fprintf(stderr, "\n");
+    funlockfile(stderr);
+}
+
+static void writeCounters(FILE* file, const struct workerStats* stats)
+{
+    fprintf(file, "\"pdus\": %llu, \"flows\": %llu, \"bytes\": %llu, \"failures\": %llu",
+            (unsigned long long) stats->pdus, (unsigned long long) stats->flows,
+            (unsigned long long) stats->bytes, (unsigned long long) stats->failures);
+}
+
+/** Store the JSON snapshot of the totals */
+static void writeSnapshot(struct statsReporter* reporter, const struct workerStats* total, uint64_t now)
+{
+    size_t length = strlen(reporter->path);
+    char* temporary = (char*) malloc(length + sizeof(".tmp"));
+    if (temporary == NULL)
+    {
+        return;
+    }
+    sprintf(temporary, "%s.tmp", reporter->path);
+
+    FILE* file = fopen(temporary, "w");
+    if (file == NULL)
+    {
+        free(temporary);
+        return;
+    }
+
+    fprintf(file, "{\n  \"time\": %lld,\n  \"uptime\": %.3f,\n  ",
+            (long long) time(NULL), (double) (now - reporter->start) / NSECS_PER_SEC);
+    writeCounters(file, total);
+    fprintf(file, ",\n  \"output_dropped\": %llu,\n  \"errors\": {", (unsigned long long) outputDropped(reporter));
+
+    const char* separator = "";
+    for (int e = 0; e < STATS_ERRNOS; e++)
+    {
+        if (total->errors[e] > 0)
+        {
+            const char* name = errorName(e);
+            if (name != NULL)
+            {
+                fprintf(file, "%s\"%s\": %llu", separator, name, (unsigned long long) total->errors[e]);
+            }
+            else
+            {
+                fprintf(file, "%s\"%d\": %llu", separator, e, (unsigned long long) total->errors[e]);
+            }
+            separator = ", ";
+        }
+    }
+
+    fprintf(file, "},\n  \"latency_ns\": {");
+    for (unsigned int s = 0; s < NUMBER_OF_STAGES; s++)
+    {
+        const struct statsHistogram* histogram = &total->latency[s];
+        fprintf(file, "%s\n    \"%s\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"buckets\": [",
+                s > 0 ? "," : "", stageNames[s],
+                (unsigned long long) quantile(histogram, 0.5), (unsigned long long) quantile(histogram, 0.9),
+                (unsigned long long) quantile(histogram, 0.99), (unsigned long long) quantile(histogram, 0.999));
+        for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+        {
+            fprintf(file, "%s%llu", b > 0 ? ", " : "", (unsigned long long) histogram->buckets[b]);
+        }
+        fprintf(file, "]}");
+    }
+
+    fprintf(file, "\n  },\n  \"workers\": [");
+    for (unsigned int i = 0; i < reporter->numberOfWorkers; i++)
+    {
+        const struct workerStats* stats = &reporter->workers[i].stats;
+        struct workerStats counters;
+
+        counters.pdus     = statsRead(&stats->pdus);
+        counters.flows    = statsRead(&stats->flows);
+        counters.bytes    = statsRead(&stats->bytes);
+        counters.failures = statsRead(&stats->failures);
+
+        fprintf(file, "%s\n    {\"id\": %u, ", i > 0 ? "," : "", reporter->workers[i].id);
+        writeCounters(file, &counters);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    if (fclose(file) == 0)
+    {
+        rename(temporary, reporter->path);
+    }
+    else
+    {
+        remove(temporary);
+    }
+
+    free(temporary);
+}
+
+static void publish(struct statsReporter* reporter)
+{
+    struct workerStats total;
+    uint64_t now = monotonicTime();
+
+    collect(reporter->workers, reporter->numberOfWorkers, &total);
+    printSummary(reporter, &total, now);
+
+    if (reporter->path != NULL)
+    {
+        writeSnapshot(reporter, &total, now);
+    }
+
+    reporter->previous     = total;
+    reporter->previousTime = now;
+}
+
+static void* runStatsReporter(void* argument)
+{
+    struct statsReporter* reporter = (struct statsReporter*) argument;
+    uint64_t next = reporter->start + reporter->interval;
+
+    pthread_mutex_lock(&reporter->lock);
+    while (!reporter->stop)
+    {
+        struct timespec deadline;
+        deadline.tv_sec  = next / NSECS_PER_SEC;
+        deadline.tv_nsec = next % NSECS_PER_SEC;
+
+        if (pthread_cond_timedwait(&reporter->wakeUp, &reporter->lock, &deadline) == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&reporter->lock);
+            publish(reporter);
+            pthread_mutex_lock(&reporter->lock);
+
+            next += reporter->interval;
+        }
+    }
+    pthread_mutex_unlock(&reporter->lock);
+
+    return NULL;
+}
+
+error_t startStatsReporter(struct statsReporter* reporter, const struct worker* workers,
+                           unsigned int numberOfWorkers, struct outputFile* outputFile,
+                           uint64_t interval, const char* path)
+{
+    memset(reporter, 0, sizeof(*reporter));
+
+    reporter->workers         = workers;
+    reporter->numberOfWorkers = numberOfWorkers;
+    reporter->outputFile      = outputFile;
+    reporter->interval        = interval;
+    reporter->path            = path;
+    reporter->start           = monotonicTime();
+    reporter->previousTime    = reporter->start;
+
+    /* Deadlines are on the monotonic clock, like the rest of the timing */
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&reporter->wakeUp, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&reporter->lock, NULL);
+
+    error_t status = pthread_create(&reporter->thread, NULL, runStatsReporter, reporter);
+    if (status != 0)
+    {
+        pthread_cond_destroy(&reporter->wakeUp);
+        pthread_mutex_destroy(&reporter->lock);
+    }
+
+    return status;
+}
+
+void stopStatsReporter(struct statsReporter* reporter)
+{
+    pthread_mutex_lock(&reporter->lock);
+    reporter->stop = 1;
+    pthread_cond_signal(&reporter->wakeUp);
+    pthread_mutex_unlock(&reporter->lock);
+
+    pthread_join(reporter->thread, NULL);
+
+    publish(reporter);
+
+    pthread_cond_destroy(&reporter->wakeUp);
+    pthread_mutex_destroy(&reporter->lock);
+}
+
+void printTotals(const struct worker* workers, unsigned int numberOfWorkers, uint64_t duration, FILE* stream)
+{
+    struct workerStats total;
+    collect(workers, numberOfWorkers, &total);
+
+    double elapsed = (double) duration / NSECS_PER_SEC;
+    if (elapsed <= 0)
+    {
+        elapsed = 1e-9;
+    }
+
+    fprintf(stream, "Total: %llu PDUs, %llu flows, %llu bytes, %llu failed in %.3f s; "
+                    "%.0f PDUs/s, %.0f flows/s, %.1f Mbit/s\n",
+            (unsigned long long) total.pdus, (unsigned long long) total.flows,
+            (unsigned long long) total.bytes, (unsigned long long) total.failures, elapsed,
+            total.pdus / elapsed, total.flows / elapsed, total.bytes * 8 / elapsed / 1e6);
+}
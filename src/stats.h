@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STATS__H_
+#define _STATS__H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "errors.h"
+
+/* errno values counted separately, larger ones share the last slot */
+#define STATS_ERRNOS 134
+
+/* Power of two latency buckets, bucket i holds [2^(i-1), 2^i) ns */
+#define STATS_BUCKETS 64
+
+/* Timed stages of the send loop */
+enum statsStage
+{
+    STAGE_GENERATE,
+    STAGE_SEND,
+    STAGE_WRITE,
+    NUMBER_OF_STAGES
+};
+
+/** Latency histogram with power of two buckets */
+struct statsHistogram
+{
+    uint64_t buckets[STATS_BUCKETS];
+};
+
+/** Counters of one worker
+ *
+ * Only the owning worker writes them, with relaxed atomic
+ * stores, so counting costs no more than a plain increment.
+ * The reporter thread reads them with relaxed atomic loads
+ * at any time. Counters only grow.
+ */
+struct workerStats
+{
+    uint64_t pdus;
+    uint64_t flows;
+    uint64_t bytes;
+    uint64_t failures;               /* PDUs that couldn't be sent */
+    uint64_t errors[STATS_ERRNOS];   /* Failed send calls by errno */
+    struct statsHistogram latency[NUMBER_OF_STAGES];  /* Per batch */
+};
+
+/** Single writer counter increment */
+static inline void statsAdd(uint64_t* counter, uint64_t value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t statsRead(const uint64_t* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count sent PDUs
+ *
+ * @param[in,out] stats Worker's counters
+ * @param[in]     pdus  Number of PDUs sent
+ * @param[in]     flows Number of flow records in them
+ * @param[in]     bytes Total size of the PDUs
+ *
+ * @return void
+ */
+static inline void statsSent(struct workerStats* stats, uint64_t pdus, uint64_t flows, uint64_t bytes)
+{
+    statsAdd(&stats->pdus, pdus);
+    statsAdd(&stats->flows, flows);
+    statsAdd(&stats->bytes, bytes);
+}
+
+/**
+ * Count PDUs that failed to be sent
+ *
+ * @param[in,out] stats       Worker's counters
+ * @param[in]     pdus        Number of PDUs not sent
+ * @param[in]     errorNumber errno of the failed call
+ *
+ * @return void
+ */
+static inline void statsFailed(struct workerStats* stats, uint64_t pdus, int errorNumber)
+{
+    statsAdd(&stats->failures, pdus);
+    statsAdd(&stats->errors[errorNumber > 0 && errorNumber < STATS_ERRNOS ? errorNumber : STATS_ERRNOS - 1], 1);
+}
+
+/**
+ * Account the duration of a stage
+ *
+ * @param[in,out] stats    Worker's counters
+ * @param[in]     stage    Timed stage
+ * @param[in]     duration Duration [ns]
+ *
+ * @return void
+ */
+static inline void statsLatency(struct workerStats* stats, enum statsStage stage, uint64_t duration)
+{
+    statsAdd(&stats->latency[stage].buckets[64 - __builtin_clzll(duration | 1)], 1);
+}
+
+struct worker;
+struct outputFile;
+
+/** Thread publishing the statistics of all workers
+ *
+ * Every interval it prints a summary line with the rates
+ * and latencies of the last interval to stderr and stores
+ * a JSON snapshot of the totals. The snapshot is written
+ * to a temporary file and renamed, so readers never see
+ * a partial one.
+ */
+struct statsReporter
+{
+    pthread_t             thread;
+    pthread_mutex_t       lock;
+    pthread_cond_t        wakeUp;
+    int                   stop;
+
+    const struct worker*  workers;
+    unsigned int          numberOfWorkers;
+    struct outputFile*    outputFile;      /* May be NULL */
+    uint64_t              interval;        /* [ns], 0 = no summary line */
+    const char*           path;            /* JSON snapshot, may be NULL */
+
+    uint64_t              start;           /* [ns] */
+    struct workerStats    previous;        /* Totals at the last report */
+    uint64_t              previousTime;
+};
+
+/**
+ * Start the reporter thread
+ *
+ * @param[out] reporter        Reporter to be started
+ * @param[in]  workers         Workers whose stats are published
+ * @param[in]  numberOfWorkers Number of workers
+ * @param[in]  outputFile      Output file (for its drop count) or NULL
+ * @param[in]  interval        Report interval [ns]
+ * @param[in]  path            JSON snapshot file or NULL
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t startStatsReporter(struct statsReporter* reporter, const struct worker* workers,
+                       unsigned int numberOfWorkers, struct outputFile* outputFile,
+                       uint64_t interval, const char* path);
+
+/**
+ * Stop the reporter thread
+ *
+ * Publishes the final summary and snapshot.
+ *
+ * @param[in,out] reporter Running reporter
+ *
+ * @return void
+ */
+void stopStatsReporter(struct statsReporter* reporter);
+
+/**
+ * Print the totals of a finished run
+ *
+ * @param[in] workers         Workers of the run
+ * @param[in] numberOfWorkers Number of workers
+ * @param[in] duration        Length of the run [ns]
+ * @param[in] stream          Where to print the totals
+ *
+ * @return void
+ */
+void printTotals(const struct worker* workers, unsigned int numberOfWorkers, uint64_t duration, FILE* stream);
+
+#endif
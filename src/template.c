@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "template.h"
+
+#define V9_HEADER_SIZE    20
+#define IPFIX_HEADER_SIZE 16
+#define SET_HEADER_SIZE   4
+
+#define V9_TEMPLATE_SET_ID    0
+#define IPFIX_TEMPLATE_SET_ID 2
+#define DATA_TEMPLATE_ID      256
+
+static inline unsigned char* put8(unsigned char* p, uint8_t value)
+{
+    *p = value;
+    return p + 1;
+}
+
+static inline unsigned char* put16(unsigned char* p, uint16_t value)
+{
+    value = htons(value);
+    memcpy(p, &value, 2);
+    return p + 2;
+}
+
+static inline unsigned char* put32(unsigned char* p, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(p, &value, 4);
+    return p + 4;
+}
+
+static inline unsigned char* put64(unsigned char* p, uint64_t value)
+{
+    value = htobe64(value);
+    memcpy(p, &value, 8);
+    return p + 8;
+}
+
+/* Addresses are already in network byte order */
+static inline unsigned char* putAddress(unsigned char* p, uint32_t address)
+{
+    memcpy(p, &address, 4);
+    return p + 4;
+}
+
+/* IPv6 records hold indexes into the encoder's host table */
+static inline unsigned char* putAddress6(unsigned char* p, const struct in6_addr* hosts, uint32_t index)
+{
+    memcpy(p, &hosts[index], 16);
+    return p + 16;
+}
+
+static inline unsigned char* putZeros(unsigned char* p, size_t length)
+{
+    memset(p, 0, length);
+    return p + length;
+}
+
+/* Supported fields: name, information element ID, length, writer.
+   The IDs are shared by NetFlow v9 and IPFIX. */
+#define TEMPLATE_FIELDS(X) \
+    X(SRC_ADDR,  "srcaddr",    8, 4, putAddress(p, r->srcAddr)) \
+    X(DST_ADDR,  "dstaddr",   12, 4, putAddress(p, r->dstAddr)) \
+    X(NEXT_HOP,  "nexthop",   15, 4, putAddress(p, r->nextHop)) \
+    X(INPUT,     "input",     10, 2, put16(p, r->input)) \
+    X(OUTPUT,    "output",    14, 2, put16(p, r->output)) \
+    X(PACKETS,   "packets",    2, 4, put32(p, r->dPkts)) \
+    X(BYTES,     "bytes",      1, 4, put32(p, r->dOctets)) \
+    X(FIRST,     "first",     22, 4, put32(p, r->first)) \
+    X(LAST,      "last",      21, 4, put32(p, r->last)) \
+    X(START,     "start",    152, 8, put64(p, start + r->first)) \
+    X(END,       "end",      153, 8, put64(p, start + r->last)) \
+    X(SRC_PORT,  "srcport",    7, 2, put16(p, r->srcPort)) \
+    X(DST_PORT,  "dstport",   11, 2, put16(p, r->dstPort)) \
+    X(TCP_FLAGS, "tcpflags",   6, 1, put8(p, r->tcpFlags)) \
+    X(PROTOCOL,  "proto",      4, 1, put8(p, r->prot)) \
+    X(TOS,       "tos",        5, 1, put8(p, r->tos)) \
+    X(SRC_AS,    "srcas",     16, 2, put16(p, r->srcAs)) \
+    X(DST_AS,    "dstas",     17, 2, put16(p, r->dstAs)) \
+    X(SRC_MASK,  "srcmask",    9, 1, put8(p, r->srcMask)) \
+    X(DST_MASK,  "dstmask",   13, 1, put8(p, r->dstMask)) \
+    X(SRC_ADDR6, "srcaddr6",  27, 16, putAddress6(p, e->hosts6, r->srcAddr)) \
+    X(DST_ADDR6, "dstaddr6",  28, 16, putAddress6(p, e->hosts6, r->dstAddr)) \
+    X(NEXT_HOP6, "nexthop6",  62, 16, putZeros(p, 16)) \
+    X(SRC_MASK6, "srcmask6",  29, 1, put8(p, r->srcMask)) \
+    X(DST_MASK6, "dstmask6",  30, 1, put8(p, r->dstMask))
+
+/* Built-in field sets. TIME_START and TIME_END are the time stamp
+   fields, uptime (FIRST, LAST) or absolute (START, END). */
+#define FULL_FIELDS(F, TIME_START, TIME_END) \
+    F(SRC_ADDR) F(DST_ADDR) F(NEXT_HOP) F(INPUT) F(OUTPUT) F(PACKETS) F(BYTES) \
+    F(TIME_START) F(TIME_END) F(SRC_PORT) F(DST_PORT) F(TCP_FLAGS) F(PROTOCOL) F(TOS) \
+    F(SRC_AS) F(DST_AS) F(SRC_MASK) F(DST_MASK)
+
+#define BASIC_FIELDS(F, TIME_START, TIME_END) \
+    F(SRC_ADDR) F(DST_ADDR) F(SRC_PORT) F(DST_PORT) F(PROTOCOL) \
+    F(PACKETS) F(BYTES) F(TIME_START) F(TIME_END)
+
+/* The same with IPv6 addresses and masks */
+#define FULL6_FIELDS(F, TIME_START, TIME_END) \
+    F(SRC_ADDR6) F(DST_ADDR6) F(NEXT_HOP6) F(INPUT) F(OUTPUT) F(PACKETS) F(BYTES) \
+    F(TIME_START) F(TIME_END) F(SRC_PORT) F(DST_PORT) F(TCP_FLAGS) F(PROTOCOL) F(TOS) \
+    F(SRC_AS) F(DST_AS) F(SRC_MASK6) F(DST_MASK6)
+
+#define BASIC6_FIELDS(F, TIME_START, TIME_END) \
+    F(SRC_ADDR6) F(DST_ADDR6) F(SRC_PORT) F(DST_PORT) F(PROTOCOL) \
+    F(PACKETS) F(BYTES) F(TIME_START) F(TIME_END)
+
+#define FIELD_ENUM(field, name, id, length, writer) FIELD_##field,
+enum templateField
+{
+    TEMPLATE_FIELDS(FIELD_ENUM)
+    NUMBER_OF_TEMPLATE_FIELDS
+};
+
+struct fieldDescriptor
+{
+    const char* name;
+    uint16_t    id;
+    uint16_t    length;
+};
+
+#define FIELD_DESCRIPTOR(field, name, id, length, writer) { name, id, length },
+static const struct fieldDescriptor fieldDescriptors[NUMBER_OF_TEMPLATE_FIELDS] =
+{
+    TEMPLATE_FIELDS(FIELD_DESCRIPTOR)
+};
+
+/* One writer function per field */
+#define FIELD_WRITER(field, name, id, length, writer) \
+    static inline unsigned char* write##field(const struct templateEncoder* e, unsigned char* p, \
+                                              const struct netflowRecord* r, uint64_t start) \
+    { \
+        (void) e; \
+        (void) start; \
+        return writer; \
+    }
+TEMPLATE_FIELDS(FIELD_WRITER)
+
+/* One column writer per field, for the field lists that are not built in */
+#define FIELD_COLUMN_WRITER(field, name, id, length, writer) \
+    static void writeColumn##field(const struct templateEncoder* e, unsigned char* p, size_t stride, \
+                                   const struct netflowRecord* r, unsigned int n, uint64_t start) \
+    { \
+        for (const struct netflowRecord* last = r + n; r < last; r++, p += stride) \
+        { \
+            write##field(e, p, r, start); \
+        } \
+    }
+TEMPLATE_FIELDS(FIELD_COLUMN_WRITER)
+
+#define FIELD_COLUMN_ENTRY(field, name, id, length, writer) writeColumn##field,
+static const fieldColumnWriter columnWriters[NUMBER_OF_TEMPLATE_FIELDS] =
+{
+    TEMPLATE_FIELDS(FIELD_COLUMN_ENTRY)
+};
+
+/* Specialized serializers of the built-in sets. The field
+   sequence is fixed at compile time, so the compiler turns
+   each of them into straight-line code. */
+#define CALL_WRITER(field) p = write##field(encoder, p, r, start);
+#define DEFINE_SERIALIZER(function, FIELDS, TIME_START, TIME_END) \
+    static unsigned char* function(const struct templateEncoder* encoder, unsigned char* p, \
+                                   const struct netflowRecord* r, uint64_t start) \
+    { \
+        FIELDS(CALL_WRITER, TIME_START, TIME_END) \
+        return p; \
+    }
+
+#define LIST_FIELD(field) FIELD_##field,
+#define DEFINE_FIELD_LIST(array, FIELDS, TIME_START, TIME_END) \
+    static const uint8_t array[] = { FIELDS(LIST_FIELD, TIME_START, TIME_END) };
+
+DEFINE_SERIALIZER(serializeFullUptime,  FULL_FIELDS,  FIRST, LAST)
+DEFINE_SERIALIZER(serializeFullMillis,  FULL_FIELDS,  START, END)
+DEFINE_SERIALIZER(serializeBasicUptime, BASIC_FIELDS, FIRST, LAST)
+DEFINE_SERIALIZER(serializeBasicMillis, BASIC_FIELDS, START, END)
+DEFINE_SERIALIZER(serializeFullUptime6,  FULL6_FIELDS,  FIRST, LAST)
+DEFINE_SERIALIZER(serializeFullMillis6,  FULL6_FIELDS,  START, END)
+DEFINE_SERIALIZER(serializeBasicUptime6, BASIC6_FIELDS, FIRST, LAST)
+DEFINE_SERIALIZER(serializeBasicMillis6, BASIC6_FIELDS, START, END)
+
+DEFINE_FIELD_LIST(fullUptimeFields,  FULL_FIELDS,  FIRST, LAST)
+DEFINE_FIELD_LIST(fullMillisFields,  FULL_FIELDS,  START, END)
+DEFINE_FIELD_LIST(basicUptimeFields, BASIC_FIELDS, FIRST, LAST)
+DEFINE_FIELD_LIST(basicMillisFields, BASIC_FIELDS, START, END)
+DEFINE_FIELD_LIST(fullUptime6Fields,  FULL6_FIELDS,  FIRST, LAST)
+DEFINE_FIELD_LIST(fullMillis6Fields,  FULL6_FIELDS,  START, END)
+DEFINE_FIELD_LIST(basicUptime6Fields, BASIC6_FIELDS, FIRST, LAST)
+DEFINE_FIELD_LIST(basicMillis6Fields, BASIC6_FIELDS, START, END)
+
+struct builtinTemplate
+{
+    const uint8_t*   fields;
+    unsigned int     numberOfFields;
+    recordSerializer serialize;
+};
+
+#define BUILTIN(fields, serializer) { fields, sizeof(fields), serializer }
+static const struct builtinTemplate builtinTemplates[] =
+{
+    BUILTIN(fullUptimeFields,  serializeFullUptime),
+    BUILTIN(fullMillisFields,  serializeFullMillis),
+    BUILTIN(basicUptimeFields, serializeBasicUptime),
+    BUILTIN(basicMillisFields, serializeBasicMillis),
+    BUILTIN(fullUptime6Fields,  serializeFullUptime6),
+    BUILTIN(fullMillis6Fields,  serializeFullMillis6),
+    BUILTIN(basicUptime6Fields, serializeBasicUptime6),
+    BUILTIN(basicMillis6Fields, serializeBasicMillis6)
+};
+
+/* Names of the built-in sets, each has an uptime and a millisecond variant */
+static const char* const builtinNames[] = { "full", "basic", "full6", "basic6" };
+
+#define NUMBER_OF_BUILTIN_TEMPLATES (sizeof(builtinTemplates) / sizeof(builtinTemplates[0]))
+
+/** Write the records of a field list that is not built in, column by column. */
+static unsigned char* serializeColumns(const struct templateEncoder* encoder, unsigned char* p,
+                                       const struct netflowRecord* records, unsigned int numberOfFlows,
+                                       uint64_t start)
+{
+    for (unsigned int i = 0; i < encoder->numberOfFields; i++)
+    {
+        encoder->columns[i](encoder, p + encoder->offsets[i], encoder->recordLength, records, numberOfFlows, start);
+    }
+
+    return p + numberOfFlows * encoder->recordLength;
+}
+
+static void setFields(struct templateEncoder* encoder, const uint8_t* fields, unsigned int numberOfFields)
+{
+    memcpy(encoder->fields, fields, numberOfFields);
+    encoder->numberOfFields = numberOfFields;
+}
+
+/** Parse comma separated field names. */
+static error_t parseFieldList(struct templateEncoder* encoder, const char* fieldList)
+{
+    const char* name = fieldList;
+
+    encoder->numberOfFields = 0;
+
+    while (*name != '\0')
+    {
+        size_t length = strcspn(name, ",");
+        int field;
+
+        for (field = 0; field < NUMBER_OF_TEMPLATE_FIELDS; field++)
+        {
+            if (strlen(fieldDescriptors[field].name) == length &&
+                strncmp(fieldDescriptors[field].name, name, length) == 0)
+            {
+                break;
+            }
+        }
+
+        if (field == NUMBER_OF_TEMPLATE_FIELDS || encoder->numberOfFields == MAX_TEMPLATE_FIELDS)
+        {
+            return EINVAL;
+        }
+
+        encoder->fields[encoder->numberOfFields++] = field;
+
+        name += length;
+        if (*name == ',')
+        {
+            name++;
+        }
+    }
+
+    return encoder->numberOfFields > 0 ? EOK : EINVAL;
+}
+
+/** Set the fields of a built-in set or a field list, NULL selects "full". */
+static error_t selectFields(struct templateEncoder* encoder, int protocol, const char* fieldList)
+{
+    const int millis = protocol == IPFIX;
+
+    if (fieldList == NULL)
+    {
+        fieldList = builtinNames[0];
+    }
+
+    for (unsigned int i = 0; i < sizeof(builtinNames) / sizeof(builtinNames[0]); i++)
+    {
+        if (strcmp(fieldList, builtinNames[i]) == 0)
+        {
+            const struct builtinTemplate* builtin = &builtinTemplates[2*i + millis];
+            setFields(encoder, builtin->fields, builtin->numberOfFields);
+            return EOK;
+        }
+    }
+
+    return parseFieldList(encoder, fieldList);
+}
+
+/** Address family of the fields: AF_INET, AF_INET6, AF_UNSPEC without addresses, -1 if mixed */
+static int fieldsFamily(const struct templateEncoder* encoder)
+{
+    int family = AF_UNSPEC;
+
+    for (unsigned int i = 0; i < encoder->numberOfFields; i++)
+    {
+        int fieldFamily;
+
+        switch (encoder->fields[i])
+        {
+        case FIELD_SRC_ADDR:
+        case FIELD_DST_ADDR:
+        case FIELD_NEXT_HOP:
+            fieldFamily = AF_INET;
+            break;
+        case FIELD_SRC_ADDR6:
+        case FIELD_DST_ADDR6:
+        case FIELD_NEXT_HOP6:
+            fieldFamily = AF_INET6;
+            break;
+        default:
+            continue;
+        }
+
+        if (family != AF_UNSPEC && family != fieldFamily)
+        {
+            return -1;
+        }
+        family = fieldFamily;
+    }
+
+    return family;
+}
+
+int templateFieldsIpv6(const char* fieldList)
+{
+    struct templateEncoder encoder;
+
+    return selectFields(&encoder, IPFIX, fieldList) == EOK && fieldsFamily(&encoder) == AF_INET6;
+}
+
+static size_t headerSize(const struct templateEncoder* encoder)
+{
+    return encoder->protocol == IPFIX ? IPFIX_HEADER_SIZE : V9_HEADER_SIZE;
+}
+
+static size_t templateSetSize(const struct templateEncoder* encoder)
+{
+    return SET_HEADER_SIZE + 4 + 4*encoder->numberOfFields;
+}
+
+static int templateDue(const struct templateEncoder* encoder, uint32_t sysUpTime)
+{
+    return !encoder->templateSent ||
+           encoder->packetsSinceTemplate >= encoder->refreshPackets ||
+           sysUpTime - encoder->lastTemplate >= encoder->refreshInterval;
+}
+
+error_t initializeTemplateEncoder(struct templateEncoder* encoder, int protocol, const char* fieldList,
+                                  size_t maxPduSize, unsigned int refreshPackets, uint32_t refreshInterval)
+{
+    if (protocol != NETFLOW_V9 && protocol != IPFIX)
+    {
+        return EINVAL;
+    }
+
+    if (selectFields(encoder, protocol, fieldList) != EOK)
+    {
+        return EINVAL;
+    }
+
+    /* IPv6 addresses come from the host table of the records */
+    int family = fieldsFamily(encoder);
+    encoder->hosts6 = netflowHosts6();
+    if (family == -1 || (family == AF_INET6 && encoder->hosts6 == NULL))
+    {
+        return EINVAL;
+    }
+
+    /* Use a specialized serializer if the list matches a built-in one */
+    encoder->serialize = NULL;
+    for (unsigned int i = 0; i < NUMBER_OF_BUILTIN_TEMPLATES; i++)
+    {
+        if (builtinTemplates[i].numberOfFields == encoder->numberOfFields &&
+            memcmp(builtinTemplates[i].fields, encoder->fields, encoder->numberOfFields) == 0)
+        {
+            encoder->serialize = builtinTemplates[i].serialize;
+        }
+    }
+
+    encoder->recordLength = 0;
+    for (unsigned int i = 0; i < encoder->numberOfFields; i++)
+    {
+        encoder->columns[i] = columnWriters[encoder->fields[i]];
+        encoder->offsets[i] = encoder->recordLength;
+        encoder->recordLength += fieldDescriptors[encoder->fields[i]].length;
+    }
+
+    encoder->protocol             = protocol;
+    encoder->templateId           = DATA_TEMPLATE_ID;
+    encoder->maxPduSize           = maxPduSize;
+    encoder->refreshPackets       = refreshPackets > 0 ? refreshPackets : 1;
+    encoder->refreshInterval      = refreshInterval;
+    encoder->templateSent         = 0;
+    encoder->packetsSinceTemplate = 0;
+    encoder->lastTemplate         = 0;
+    encoder->packetSequence       = 0;
+
+    /* Template and at least one record must fit */
+    if (templateCapacity(encoder, 0) == 0)
+    {
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+unsigned int templateCapacity(const struct templateEncoder* encoder, uint32_t sysUpTime)
+{
+    size_t overhead = headerSize(encoder) + SET_HEADER_SIZE + 3 /* padding */;
+
+    if (templateDue(encoder, sysUpTime))
+    {
+        overhead += templateSetSize(encoder);
+    }
+
+    if (overhead >= encoder->maxPduSize)
+    {
+        return 0;
+    }
+
+    return (encoder->maxPduSize - overhead) / encoder->recordLength;
+}
+
+unsigned int templateMaxCapacity(const struct templateEncoder* encoder)
+{
+    size_t overhead = headerSize(encoder) + SET_HEADER_SIZE + 3 /* padding */;
+
+    return (encoder->maxPduSize - overhead) / encoder->recordLength;
+}
+
+static unsigned char* writeTemplateSet(const struct templateEncoder* encoder, unsigned char* p)
+{
+    p = put16(p, encoder->protocol == IPFIX ? IPFIX_TEMPLATE_SET_ID : V9_TEMPLATE_SET_ID);
+    p = put16(p, templateSetSize(encoder));
+    p = put16(p, encoder->templateId);
+    p = put16(p, encoder->numberOfFields);
+
+    for (unsigned int i = 0; i < encoder->numberOfFields; i++)
+    {
+        const struct fieldDescriptor* field = &fieldDescriptors[encoder->fields[i]];
+
+        p = put16(p, field->id);
+        p = put16(p, field->length);
+    }
+
+    return p;
+}
+
+size_t makeTemplatePacket(char* buffer, struct templateEncoder* encoder, struct netflowExporter* exporter,
+                          const struct netflowRecord* records, unsigned int numberOfFlows, uint32_t sysUpTime)
+{
+    unsigned char* start = (unsigned char*) buffer;
+    unsigned char* p = start + headerSize(encoder);
+    uint64_t startMillis = (uint64_t) exporter->systemStartTime * 1000;
+    unsigned int templates = 0;
+
+    /* If the template is due but doesn't fit, it goes into the next PDU */
+    size_t dataSize = SET_HEADER_SIZE + numberOfFlows*encoder->recordLength + 3;
+    if (templateDue(encoder, sysUpTime) &&
+        headerSize(encoder) + templateSetSize(encoder) + dataSize <= encoder->maxPduSize)
+    {
+        p = writeTemplateSet(encoder, p);
+
+        encoder->templateSent = 1;
+        encoder->packetsSinceTemplate = 0;
+        encoder->lastTemplate = sysUpTime;
+        templates = 1;
+    }
+
+    if (numberOfFlows > 0)
+    {
+        unsigned char* set = p;
+        p += SET_HEADER_SIZE;
+
+        if (encoder->serialize != NULL)
+        {
+            for (unsigned int flow = 0; flow < numberOfFlows; flow++)
+            {
+                p = encoder->serialize(encoder, p, &records[flow], startMillis);
+            }
+        }
+        else
+        {
+            p = serializeColumns(encoder, p, records, numberOfFlows, startMillis);
+        }
+
+        /* v9 requires sets padded to 32 bits, IPFIX allows it */
+        while ((p - set) % 4 != 0)
+        {
+            *p++ = 0;
+        }
+
+        put16(set, encoder->templateId);
+        put16(set + 2, p - set);
+    }
+
+    /* Header */
+    uint32_t unixSecs = exporter->systemStartTime + sysUpTime / 1000;
+    uint32_t sourceId = ((uint32_t) exporter->engineType << 8) | exporter->engineId;
+    unsigned char* h = start;
+
+    if (encoder->protocol == IPFIX)
+    {
+        h = put16(h, IPFIX);
+        h = put16(h, p - start);
+        h = put32(h, unixSecs);
+        h = put32(h, exporter->flowSequence);  /* Data records sent before this message */
+        h = put32(h, sourceId);
+    }
+    else
+    {
+        h = put16(h, NETFLOW_V9);
+        h = put16(h, templates + numberOfFlows);
+        h = put32(h, sysUpTime);
+        h = put32(h, unixSecs);
+        h = put32(h, encoder->packetSequence);
+        h = put32(h, sourceId);
+    }
+
+    encoder->packetSequence++;
+    encoder->packetsSinceTemplate++;
+    exporter->flowSequence += numberOfFlows;
+
+    return p - start;
+}
+
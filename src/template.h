@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEMPLATE__H_
+#define _TEMPLATE__H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+#include "netflow.h"
+
+/* Export protocol versions */
+#define NETFLOW_V5 5
+#define NETFLOW_V9 9
+#define IPFIX      10
+
+#define MAX_TEMPLATE_FIELDS 32
+
+struct templateEncoder;
+
+/** Writes one record in the wire format of the template. */
+typedef unsigned char* (*recordSerializer)(const struct templateEncoder* encoder, unsigned char* buffer,
+                                           const struct netflowRecord* record, uint64_t startMillis);
+
+/** Writes one field of \c numberOfRecords records, \c stride bytes apart. */
+typedef void (*fieldColumnWriter)(const struct templateEncoder* encoder, unsigned char* buffer, size_t stride,
+                                  const struct netflowRecord* records, unsigned int numberOfRecords,
+                                  uint64_t startMillis);
+
+/** Template-based exporter (NetFlow v9 or IPFIX).
+ *
+ * The encoder exports records with one data template.
+ * The template is sent in the first PDU and then again
+ * every \c refreshPackets PDUs or \c refreshInterval ms,
+ * whichever comes first, so collectors that start later
+ * can decode the stream.
+ *
+ * Built-in field sets ("full", "basic" and their IPv6
+ * variants "full6", "basic6") have serializers
+ * generated at compile time, which write the fields one
+ * after another with no per-field decisions. For any
+ * other field list the column writer of every field is
+ * looked up once, when the encoder is initialized. A PDU
+ * is then written field by field, each writer filling its
+ * field in all the records with a loop compiled for it.
+ */
+struct templateEncoder
+{
+    int          protocol;        /* NETFLOW_V9 or IPFIX */
+    uint16_t     templateId;
+    uint8_t      fields[MAX_TEMPLATE_FIELDS];
+    unsigned int numberOfFields;
+    size_t       recordLength;
+    recordSerializer serialize;                    /* Built-in sets, NULL for custom lists */
+    fieldColumnWriter columns[MAX_TEMPLATE_FIELDS]; /* Custom lists, per field */
+    uint16_t     offsets[MAX_TEMPLATE_FIELDS];       /* Of the fields in a record */
+    const struct in6_addr* hosts6; /* Addresses of IPv6 records (@see setNetflowHosts6()) */
+
+    size_t       maxPduSize;
+    unsigned int refreshPackets;
+    uint32_t     refreshInterval; /* [ms] */
+
+    int          templateSent;
+    unsigned int packetsSinceTemplate;
+    uint32_t     lastTemplate;    /* sysUpTime of the last template [ms] */
+    uint32_t     packetSequence;  /* Export packets sent (v9 header) */
+};
+
+/**
+ * Initialize template encoder
+ *
+ * The field list is a comma separated list of field names
+ * (srcaddr, dstaddr, nexthop, input, output, packets, bytes,
+ * first, last, start, end, srcport, dstport, tcpflags, proto,
+ * tos, srcas, dstas, srcmask, dstmask, srcaddr6, dstaddr6,
+ * nexthop6, srcmask6, dstmask6) or the name of a built-in
+ * set: "full" (all v5 fields), "basic" (5-tuple, counters
+ * and time stamps) or "full6" and "basic6", the same with
+ * IPv6 addresses and masks. NULL selects "full".
+ *
+ * IPv4 and IPv6 address fields can't be mixed. IPv6 fields
+ * take the addresses from netflowHosts6(), so the records
+ * must be generated after setNetflowHosts6().
+ *
+ * Built-in sets carry uptime time stamps (first, last) in
+ * NetFlow v9 and absolute milliseconds (start, end) in IPFIX,
+ * because IPFIX headers have no sysUpTime.
+ *
+ * @param[out] encoder         Encoder to be initialized
+ * @param[in]  protocol        NETFLOW_V9 or IPFIX
+ * @param[in]  fieldList       Fields of the template (see above)
+ * @param[in]  maxPduSize      Maximum size of a PDU (UDP payload)
+ * @param[in]  refreshPackets  Resend the template after this many PDUs
+ * @param[in]  refreshInterval Resend the template after this many ms
+ *
+ * @return EOK on success, EINVAL on bad field list, mixed \
+ *         address families, IPv6 fields without an IPv6 \
+ *         host table or a PDU size too small for the template
+ */
+error_t initializeTemplateEncoder(struct templateEncoder* encoder, int protocol, const char* fieldList,
+                                  size_t maxPduSize, unsigned int refreshPackets, uint32_t refreshInterval);
+
+/**
+ * Check whether a field list carries IPv6 addresses
+ *
+ * @param[in] fieldList Fields of a template (@see initializeTemplateEncoder())
+ *
+ * @return Non-zero if the list is valid and has IPv6 address fields
+ */
+int templateFieldsIpv6(const char* fieldList);
+
+/**
+ * Maximum number of records in the next PDU
+ *
+ * The capacity is lower when the template is due to be
+ * sent in the PDU.
+ *
+ * @param[in] encoder   Initialized encoder
+ * @param[in] sysUpTime Exporter's uptime of the next PDU [ms]
+ *
+ * @return Number of records that fit into the PDU
+ */
+unsigned int templateCapacity(const struct templateEncoder* encoder, uint32_t sysUpTime);
+
+/**
+ * Maximum number of records in any PDU
+ *
+ * Use it to size record buffers, it's the capacity of a
+ * PDU without the template.
+ *
+ * @param[in] encoder Initialized encoder
+ *
+ * @return Upper bound of templateCapacity()
+ */
+unsigned int templateMaxCapacity(const struct templateEncoder* encoder);
+
+/**
+ * Make v9/IPFIX PDU from given records
+ *
+ * Records are in host byte order (@see makeNetflowPacket()).
+ * No more than templateCapacity() records may be passed.
+ * The PDU starts with the template set when it's due and
+ * there's enough space left for it.
+ *
+ * @param[out]    buffer        Buffer for the PDU (>= maxPduSize)
+ * @param[in,out] encoder       Initialized encoder
+ * @param[in,out] exporter      Exporter that sends the PDU
+ * @param[in]     records       Records to be encoded
+ * @param[in]     numberOfFlows Number of records
+ * @param[in]     sysUpTime     Exporter's uptime at the time of export [ms]
+ *
+ * @return Final PDU size stored in \c buffer
+ */
+size_t makeTemplatePacket(char* buffer, struct templateEncoder* encoder, struct netflowExporter* exporter,
+                          const struct netflowRecord* records, unsigned int numberOfFlows, uint32_t sysUpTime);
+
+#endif
+
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+
+#include "timerwheel.h"
+
+error_t initializeTimerWheel(struct timerWheel* wheel, uint32_t numberOfTimers, uint32_t numberOfSlots,
+                             uint64_t tick, uint64_t now)
+{
+    uint32_t size = 1;
+    while (size < numberOfSlots)
+    {
+        size <<= 1;
+    }
+
+    wheel->slots     = (uint32_t*) malloc(size * sizeof(uint32_t));
+    wheel->next      = (uint32_t*) malloc(numberOfTimers * sizeof(uint32_t));
+    wheel->deadlines = (uint64_t*) malloc(numberOfTimers * sizeof(uint64_t));
+    if (wheel->slots == NULL || wheel->next == NULL || wheel->deadlines == NULL)
+    {
+        freeTimerWheel(wheel);
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        wheel->slots[i] = TIMER_NONE;
+    }
+
+    wheel->numberOfTimers = numberOfTimers;
+    wheel->mask    = size - 1;
+    wheel->tick    = tick;
+    wheel->current = now / tick;
+
+    return EOK;
+}
+
+void timerSchedule(struct timerWheel* wheel, uint32_t timer, uint64_t when)
+{
+    uint64_t deadline = when / wheel->tick;
+    if (deadline < wheel->current)
+    {
+        deadline = wheel->current;
+    }
+
+    uint32_t* slot = &wheel->slots[deadline & wheel->mask];
+
+    wheel->deadlines[timer] = deadline;
+    wheel->next[timer] = *slot;
+    *slot = timer;
+}
+
+unsigned int timerExpire(struct timerWheel* wheel, uint64_t now, uint32_t* expired, unsigned int maxExpired)
+{
+    uint64_t last = now / wheel->tick;
+    unsigned int count = 0;
+
+    while (wheel->current <= last)
+    {
+        uint32_t* slot = &wheel->slots[wheel->current & wheel->mask];
+        uint32_t timer = *slot;
+
+        /* Unlink the whole slot and put back what stays */
+        *slot = TIMER_NONE;
+        while (timer != TIMER_NONE)
+        {
+            uint32_t next = wheel->next[timer];
+
+            if (wheel->deadlines[timer] <= wheel->current && count < maxExpired)
+            {
+                expired[count++] = timer;
+            }
+            else
+            {
+                wheel->next[timer] = *slot;
+                *slot = timer;
+            }
+
+            timer = next;
+        }
+
+        /* The slot may still hold due timers, don't move past it */
+        if (count == maxExpired)
+        {
+            break;
+        }
+
+        wheel->current++;
+    }
+
+    return count;
+}
+
+uint64_t timerNextTick(const struct timerWheel* wheel)
+{
+    return wheel->current * wheel->tick;
+}
+
+void freeTimerWheel(struct timerWheel* wheel)
+{
+    free(wheel->slots);
+    free(wheel->next);
+    free(wheel->deadlines);
+
+    wheel->slots     = NULL;
+    wheel->next      = NULL;
+    wheel->deadlines = NULL;
+}
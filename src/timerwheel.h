@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TIMERWHEEL__H_
+#define _TIMERWHEEL__H_
+
+#include <stdint.h>
+
+#include "errors.h"
+
+/* Marks the end of a slot list */
+#define TIMER_NONE UINT32_MAX
+
+/** Hashed timer wheel.
+ *
+ * Timers are identified by their index (0 .. number of
+ * timers - 1), the caller keeps whatever state belongs to
+ * them in its own arrays. Every slot of the wheel is a
+ * singly linked list of the timers that expire in one tick
+ * (modulo the wheel size), the links are stored in an array
+ * indexed by the timer, so the wheel doesn't allocate
+ * anything after initialization.
+ *
+ * Scheduling a timer is O(1). Expiring is O(1) per timer
+ * as long as the timeouts are shorter than one revolution
+ * of the wheel (slots * tick), longer timers are visited
+ * once per revolution until they're due.
+ */
+struct timerWheel
+{
+    uint32_t* slots;          /* First timer of every slot */
+    uint32_t* next;           /* Next timer in the same slot */
+    uint64_t* deadlines;      /* Expiry tick of every timer */
+    uint32_t  numberOfTimers;
+    uint32_t  mask;           /* Number of slots - 1 */
+    uint64_t  tick;           /* Tick length [ns] */
+    uint64_t  current;        /* First tick not processed yet */
+};
+
+/**
+ * Allocate the wheel
+ *
+ * No timer is scheduled initially.
+ *
+ * @param[out] wheel          Wheel to be initialized
+ * @param[in]  numberOfTimers Number of timers
+ * @param[in]  numberOfSlots  Size of the wheel, rounded up to a power of two
+ * @param[in]  tick           Resolution of the timers [ns]
+ * @param[in]  now            Current time [ns]
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t initializeTimerWheel(struct timerWheel* wheel, uint32_t numberOfTimers, uint32_t numberOfSlots,
+                             uint64_t tick, uint64_t now);
+
+/**
+ * Schedule a timer
+ *
+ * The timer must not be scheduled already. Deadlines in
+ * the past expire on the next timerExpire() call.
+ *
+ * @param[in,out] wheel Initialized wheel
+ * @param[in]     timer Timer index
+ * @param[in]     when  Deadline [ns], same clock as \c now of initializeTimerWheel()
+ *
+ * @return void
+ */
+void timerSchedule(struct timerWheel* wheel, uint32_t timer, uint64_t when);
+
+/**
+ * Collect the timers due at \c now
+ *
+ * Expired timers are removed from the wheel, schedule them
+ * again to make them periodic. At most \c maxExpired timers
+ * are returned, the rest is returned by the next call.
+ *
+ * @param[in,out] wheel      Initialized wheel
+ * @param[in]     now        Current time [ns]
+ * @param[out]    expired    Indexes of the expired timers
+ * @param[in]     maxExpired Capacity of \c expired
+ *
+ * @return Number of timers stored in \c expired
+ */
+unsigned int timerExpire(struct timerWheel* wheel, uint64_t now, uint32_t* expired, unsigned int maxExpired);
+
+/**
+ * When should timerExpire() be called next
+ *
+ * @param[in] wheel Initialized wheel
+ *
+ * @return Start of the first unprocessed tick [ns]
+ */
+uint64_t timerNextTick(const struct timerWheel* wheel);
+
+/**
+ * Free the memory allocated by initializeTimerWheel()
+ *
+ * @param[in,out] wheel Wheel to be released
+ *
+ * @return void
+ */
+void freeTimerWheel(struct timerWheel* wheel);
+
+#endif
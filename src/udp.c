@@ -21,16 +21,41 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+
+#include <poll.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
-
-#include <sys/stat.h>
+#include <linux/errqueue.h>
 
 #include "udp.h"
 
+/* Limits of one UDP_SEGMENT send: the kernel's segment count
+   and the IPv4 total length minus the IP and UDP headers */
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_SIZE     (65535 - 20 - 8)
+
+/* Pinned datagrams take one or two of the 17 page fragments
+   of an skb each, unless they happen to be adjacent */
+#define ZEROCOPY_MAX_SEGMENTS 8
+
+/* A notification arrives as soon as the NIC (or loopback) is done */
+#define ZEROCOPY_TIMEOUT 1000 /* [ms] */
+
+/* After this many copied sends, zerocopy only costs the notifications */
+#define ZEROCOPY_MAX_COPIED 16
+
+/** Ancillary data of one message: the source address and the GSO segment size */
+union udpControl
+{
+    struct cmsghdr header;
+    char           buffer[CMSG_SPACE(sizeof(struct in_pktinfo)) + CMSG_SPACE(sizeof(uint16_t))];
+};
+
 int udpInitialize()
 {
     int udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
@@ -44,15 +69,21 @@ int udpInitialize()
     return udpSocket;
 }
 
-size_t udpSend(int udpSocket, in_addr_t address, in_port_t port, void *message, size_t messageSize)
+int udpInitialize6()
 {
-    struct stat info;
-    if (fstat(udpSocket, &info) != 0)
+    int udpSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+
+    if (udpSocket <= 0)
     {
-        perror("Descriptor is invalid.");
+        perror("Unable to create socket.");
         exit(EXIT_FAILURE);
     }
 
+    return udpSocket;
+}
+
+size_t udpSend(int udpSocket, in_addr_t address, in_port_t port, void *message, size_t messageSize)
+{
     struct sockaddr_in remoteAddress;
     memset(&remoteAddress, 0, sizeof(remoteAddress));
 
@@ -66,6 +97,419 @@ size_t udpSend(int udpSocket, in_addr_t address, in_port_t port, void *message,
     return numberOfBytesSend;
 }
 
+error_t udpConnect(int udpSocket, in_addr_t address, in_port_t port)
+{
+    struct sockaddr_in remoteAddress;
+    memset(&remoteAddress, 0, sizeof(remoteAddress));
+
+    remoteAddress.sin_family = AF_INET;
+    remoteAddress.sin_addr.s_addr = address;
+    remoteAddress.sin_port = htons(port);
+
+    if (connect(udpSocket, (const struct sockaddr *) &remoteAddress, sizeof(remoteAddress)) != 0)
+    {
+        return errno;
+    }
+
+    return EOK;
+}
+
+error_t udpConnect6(int udpSocket, const struct in6_addr* address, in_port_t port)
+{
+    struct sockaddr_in6 remoteAddress;
+    memset(&remoteAddress, 0, sizeof(remoteAddress));
+
+    remoteAddress.sin6_family = AF_INET6;
+    remoteAddress.sin6_addr = *address;
+    remoteAddress.sin6_port = htons(port);
+
+    if (connect(udpSocket, (const struct sockaddr *) &remoteAddress, sizeof(remoteAddress)) != 0)
+    {
+        return errno;
+    }
+
+    return EOK;
+}
+
+error_t udpSourceAddress(in_addr_t address, in_port_t port, in_addr_t* localAddress)
+{
+    struct sockaddr_in local;
+    socklen_t length = sizeof(local);
+
+    /* Connecting a scratch socket makes the kernel pick the source address */
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe < 0)
+    {
+        return errno;
+    }
+
+    memset(&local, 0, sizeof(local));
+    error_t status = udpConnect(probe, address, port);
+    if (status == EOK && getsockname(probe, (struct sockaddr *) &local, &length) != 0)
+    {
+        status = errno;
+    }
+    close(probe);
+
+    *localAddress = local.sin_addr.s_addr;
+
+    return status;
+}
+
+error_t udpLocalEndpoint(int udpSocket, in_addr_t address, in_port_t port,
+                         in_addr_t* localAddress, in_port_t* localPort)
+{
+    struct sockaddr_in local;
+    socklen_t length = sizeof(local);
+
+    if (getsockname(udpSocket, (struct sockaddr *) &local, &length) != 0)
+    {
+        return errno;
+    }
+
+    if (local.sin_port == 0)
+    {
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        length = sizeof(local);
+        if (bind(udpSocket, (const struct sockaddr *) &local, sizeof(local)) != 0 ||
+            getsockname(udpSocket, (struct sockaddr *) &local, &length) != 0)
+        {
+            return errno;
+        }
+    }
+    *localPort = local.sin_port;
+
+    return udpSourceAddress(address, port, localAddress);
+}
+
+error_t udpInitializeBatch(struct udpBatch* batch, unsigned int size)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    batch->messages = (struct mmsghdr*) calloc(size, sizeof(struct mmsghdr));
+    batch->vectors  = (struct iovec*) calloc(size, sizeof(struct iovec));
+    batch->controls = (union udpControl*) calloc(size, sizeof(union udpControl));
+    batch->sources  = (in_addr_t*) calloc(size, sizeof(in_addr_t));
+    batch->superMessages = (struct mmsghdr*) calloc(size, sizeof(struct mmsghdr));
+    batch->superControls = (union udpControl*) calloc(size, sizeof(union udpControl));
+    batch->superCounts   = (unsigned int*) calloc(size, sizeof(unsigned int));
+
+    if (batch->messages == NULL || batch->vectors == NULL || batch->controls == NULL ||
+        batch->sources == NULL || batch->superMessages == NULL || batch->superControls == NULL ||
+        batch->superCounts == NULL)
+    {
+        udpFreeBatch(batch);
+        return ENOMEM;
+    }
+
+    for (unsigned int i = 0; i < size; i++)
+    {
+        batch->messages[i].msg_hdr.msg_iov    = &batch->vectors[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    batch->size  = size;
+    batch->count = 0;
+
+    return EOK;
+}
+
+int udpEnableOffload(int udpSocket, struct udpBatch* batch, int offload)
+{
+    int value = 0;
+
+    batch->offload = 0;
+
+    /* Segment size 0 only asks whether the kernel knows UDP_SEGMENT */
+    if ((offload & UDP_OFFLOAD_GSO) &&
+        setsockopt(udpSocket, SOL_UDP, UDP_SEGMENT, &value, sizeof(value)) == 0)
+    {
+        batch->offload |= UDP_OFFLOAD_GSO;
+    }
+
+    value = 1;
+    if ((offload & UDP_OFFLOAD_ZEROCOPY) &&
+        setsockopt(udpSocket, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == 0)
+    {
+        batch->offload |= UDP_OFFLOAD_ZEROCOPY;
+    }
+
+    return batch->offload;
+}
+
+void udpAddToBatch(struct udpBatch* batch, void* message, size_t messageSize)
+{
+    batch->vectors[batch->count].iov_base = message;
+    batch->vectors[batch->count].iov_len  = messageSize;
+    batch->messages[batch->count].msg_hdr.msg_control    = NULL;
+    batch->messages[batch->count].msg_hdr.msg_controllen = 0;
+    batch->sources[batch->count] = htonl(INADDR_ANY);
+    batch->count++;
+}
+
+void udpAddToBatchFrom(struct udpBatch* batch, void* message, size_t messageSize, in_addr_t source)
+{
+    unsigned int index = batch->count;
+
+    udpAddToBatch(batch, message, messageSize);
+    if (source == htonl(INADDR_ANY))
+    {
+        return;
+    }
+    batch->sources[index] = source;
+
+    struct msghdr* header = &batch->messages[index].msg_hdr;
+    header->msg_control    = batch->controls[index].buffer;
+    header->msg_controllen = sizeof(batch->controls[index].buffer);
+
+    struct cmsghdr* control = CMSG_FIRSTHDR(header);
+    control->cmsg_level = IPPROTO_IP;
+    control->cmsg_type  = IP_PKTINFO;
+    control->cmsg_len   = CMSG_LEN(sizeof(struct in_pktinfo));
+
+    struct in_pktinfo* info = (struct in_pktinfo*) CMSG_DATA(control);
+    memset(info, 0, sizeof(*info));
+    info->ipi_spec_dst.s_addr = source;
+}
+
+/** sendmmsg() of \c count messages, returns the number sent or -1 */
+static int sendMessages(int udpSocket, struct mmsghdr* messages, unsigned int count, int flags)
+{
+    while (1)
+    {
+        int result = sendmmsg(udpSocket, messages, count, flags);
+
+        /* Connected sockets report ICMP errors of previous datagrams
+           (e.g. nobody listens on the collector port). The error is
+           cleared by reporting it, so just try again. */
+        if (result >= 0 || (errno != EINTR && errno != ECONNREFUSED))
+        {
+            return result;
+        }
+    }
+}
+
+/** Append a control message to the ancillary data of \c header */
+static void addControl(struct msghdr* header, int level, int type, const void* data, size_t size)
+{
+    struct cmsghdr* control = (struct cmsghdr*) ((char*) header->msg_control + header->msg_controllen);
+
+    control->cmsg_level = level;
+    control->cmsg_type  = type;
+    control->cmsg_len   = CMSG_LEN(size);
+    memcpy(CMSG_DATA(control), data, size);
+
+    header->msg_controllen += CMSG_SPACE(size);
+}
+
+/** Group datagrams from \c first on into GSO sends, returns their number */
+static unsigned int buildSuperMessages(struct udpBatch* batch, unsigned int first)
+{
+    unsigned int count = 0;
+    unsigned int maxSegments = (batch->offload & UDP_OFFLOAD_ZEROCOPY) ? ZEROCOPY_MAX_SEGMENTS : GSO_MAX_SEGMENTS;
+
+    for (unsigned int start = first, end; start < batch->count; start = end)
+    {
+        size_t segmentSize = batch->vectors[start].iov_len;
+        size_t totalSize = segmentSize;
+        in_addr_t source = batch->sources[start];
+
+        /* A run of equal datagrams, the last one may be shorter */
+        for (end = start + 1; end < batch->count && end - start < maxSegments; end++)
+        {
+            size_t size = batch->vectors[end].iov_len;
+            if (size > segmentSize || totalSize + size > GSO_MAX_SIZE || batch->sources[end] != source)
+            {
+                break;
+            }
+
+            totalSize += size;
+            if (size < segmentSize)
+            {
+                end++;
+                break;
+            }
+        }
+
+        struct msghdr* header = &batch->superMessages[count].msg_hdr;
+        memset(header, 0, sizeof(*header));
+        header->msg_iov    = &batch->vectors[start];
+        header->msg_iovlen = end - start;
+        header->msg_control = batch->superControls[count].buffer;
+
+        if (source != htonl(INADDR_ANY))
+        {
+            struct in_pktinfo info;
+            memset(&info, 0, sizeof(info));
+            info.ipi_spec_dst.s_addr = source;
+            addControl(header, IPPROTO_IP, IP_PKTINFO, &info, sizeof(info));
+        }
+
+        if (end - start > 1)
+        {
+            uint16_t gsoSize = segmentSize;
+            addControl(header, SOL_UDP, UDP_SEGMENT, &gsoSize, sizeof(gsoSize));
+        }
+
+        if (header->msg_controllen == 0)
+        {
+            header->msg_control = NULL;
+        }
+
+        batch->superCounts[count++] = end - start;
+    }
+
+    return count;
+}
+
+/** Wait until the kernel releases the buffers of all zerocopy sends */
+static void waitForZerocopy(int udpSocket, struct udpBatch* batch)
+{
+    while (batch->zerocopyDone != batch->zerocopySends)
+    {
+        struct pollfd descriptor = { udpSocket, 0, 0 };
+        if (poll(&descriptor, 1, ZEROCOPY_TIMEOUT) <= 0)
+        {
+            /* Lost notifications, stop relying on them */
+            batch->offload &= ~UDP_OFFLOAD_ZEROCOPY;
+            batch->zerocopyDone = batch->zerocopySends;
+            return;
+        }
+
+        char controls[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_control    = controls;
+        header.msg_controllen = sizeof(controls);
+
+        if (recvmsg(udpSocket, &header, MSG_ERRQUEUE) < 0)
+        {
+            continue;
+        }
+
+        for (struct cmsghdr* control = CMSG_FIRSTHDR(&header); control != NULL;
+             control = CMSG_NXTHDR(&header, control))
+        {
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(control), sizeof(error));
+
+            /* IPv6 sockets get IPV6_RECVERR */
+            if (!((control->cmsg_level == SOL_IP && control->cmsg_type == IP_RECVERR) ||
+                  (control->cmsg_level == SOL_IPV6 && control->cmsg_type == IPV6_RECVERR)) ||
+                error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            /* Sends ee_info .. ee_data (inclusive) are complete */
+            batch->zerocopyDone += error.ee_data - error.ee_info + 1;
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                batch->zerocopyCopied++;
+            }
+        }
+    }
+
+    /* Loopback and devices without scatter-gather copy the data anyway */
+    if (batch->zerocopyCopied >= ZEROCOPY_MAX_COPIED)
+    {
+        batch->offload &= ~UDP_OFFLOAD_ZEROCOPY;
+    }
+}
+
+/** Send the batch in UDP_SEGMENT super-buffers, returns the datagrams sent */
+static unsigned int sendSegmented(int udpSocket, struct udpBatch* batch)
+{
+    unsigned int sent = 0;
+
+    while (sent < batch->count && (batch->offload & UDP_OFFLOAD_GSO))
+    {
+        unsigned int count = buildSuperMessages(batch, sent);
+        int flags = (batch->offload & UDP_OFFLOAD_ZEROCOPY) ? MSG_ZEROCOPY : 0;
+        int result = sendMessages(udpSocket, batch->superMessages, count, flags);
+
+        if (result < 0)
+        {
+            if ((errno == ENOBUFS || errno == EMSGSIZE) && flags != 0)
+            {
+                /* Pinned pages are over the socket's optmem limit, or
+                   over the fragments of an skb */
+                batch->offload &= ~UDP_OFFLOAD_ZEROCOPY;
+                continue;
+            }
+            if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EMSGSIZE)
+            {
+                /* The device can't segment, send the rest the plain way */
+                batch->offload &= ~UDP_OFFLOAD_GSO;
+            }
+            break;
+        }
+
+        if (flags != 0)
+        {
+            batch->zerocopySends += result;
+            waitForZerocopy(udpSocket, batch);
+        }
+
+        for (int i = 0; i < result; i++)
+        {
+            sent += batch->superCounts[i];
+        }
+    }
+
+    return sent;
+}
+
+unsigned int udpSendBatch(int udpSocket, struct udpBatch* batch)
+{
+    unsigned int sent = 0;
+
+    if (batch->offload & UDP_OFFLOAD_GSO)
+    {
+        sent = sendSegmented(udpSocket, batch);
+    }
+
+    /* Plain datagrams, also the rest of a batch whose GSO failed */
+    while (sent < batch->count && !(batch->offload & UDP_OFFLOAD_GSO))
+    {
+        int result = sendMessages(udpSocket, batch->messages + sent, batch->count - sent, 0);
+        if (result < 0)
+        {
+            break;
+        }
+
+        sent += result;
+    }
+
+    batch->count = 0;
+
+    return sent;
+}
+
+void udpFreeBatch(struct udpBatch* batch)
+{
+    free(batch->messages);
+    free(batch->vectors);
+    free(batch->controls);
+    free(batch->sources);
+    free(batch->superMessages);
+    free(batch->superControls);
+    free(batch->superCounts);
+
+    batch->messages = NULL;
+    batch->vectors  = NULL;
+    batch->controls = NULL;
+    batch->sources  = NULL;
+    batch->superMessages = NULL;
+    batch->superControls = NULL;
+    batch->superCounts   = NULL;
+    batch->size     = 0;
+    batch->count    = 0;
+}
+
 void udpClose(int udpSocket)
 {
     close(udpSocket);
@@ -20,11 +20,49 @@
 #ifndef _UDP__H_
 #define _UDP__H_
 
+#include <stdint.h>
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "errors.h"
+
+/* Transmit offloads (@see udpEnableOffload()) */
+#define UDP_OFFLOAD_GSO      1  /* Runs of equally sized datagrams in one UDP_SEGMENT send */
+#define UDP_OFFLOAD_ZEROCOPY 2  /* MSG_ZEROCOPY, the kernel doesn't copy the data */
+
+/** Batch of datagrams for udpSendBatch().
+ *
+ * The batch doesn't own the message buffers, it only
+ * points to them. The buffers must stay valid until the
+ * batch is sent.
+ *
+ * With GSO, consecutive datagrams of the same size (and
+ * source) are handed to the kernel as one super-buffer,
+ * which is split into datagrams as late as possible, in
+ * the driver or the NIC. The datagrams are referenced by
+ * the iovec array in place, they are not copied.
+ */
+struct udpBatch
+{
+    struct mmsghdr* messages;
+    struct iovec*   vectors;
+    union udpControl* controls; /* IP_PKTINFO of every datagram */
+    in_addr_t*      sources;    /* Source of every datagram, INADDR_ANY = socket's */
+    unsigned int    size;    /* Capacity of the batch */
+    unsigned int    count;   /* Number of queued datagrams */
+
+    int             offload;        /* UDP_OFFLOAD_* in use */
+    struct mmsghdr* superMessages;  /* GSO sends of the batch */
+    union udpControl* superControls;
+    unsigned int*   superCounts;    /* Datagrams in each GSO send */
+    uint32_t        zerocopySends;  /* MSG_ZEROCOPY sends so far */
+    uint32_t        zerocopyDone;   /* Sends whose buffers the kernel released */
+    unsigned int    zerocopyCopied; /* Sends the kernel copied anyway */
+};
+
 /**
  * Initialize socket for UDP communication
  *
@@ -35,6 +73,15 @@
  */
 int udpInitialize(void);
 
+/**
+ * Initialize socket for UDP over IPv6
+ *
+ * The same as udpInitialize(), for IPv6 collectors.
+ *
+ * @return SOCK_DGRAM socket file descriptor.
+ */
+int udpInitialize6(void);
+
 /**
  * Send a datagram using UDP
  *
@@ -52,6 +99,152 @@ int udpInitialize(void);
  */
 size_t udpSend(int udpSocket, in_addr_t address, in_port_t port, void *message, size_t messageSize);
 
+/**
+ * Connect UDP socket to a remote host
+ *
+ * The kernel caches the destination (and the route) of
+ * a connected socket, so the datagrams don't need to carry
+ * the address. Connected sockets are required by
+ * udpSendBatch().
+ *
+ * @param[in] udpSocket Initialized socket file descriptor (@see udpInitialize())
+ * @param[in] address   Remote host IP address
+ * @param[in] port      Remote host port number
+ *
+ * @return EOK on success, errno of connect() otherwise
+ */
+error_t udpConnect(int udpSocket, in_addr_t address, in_port_t port);
+
+/**
+ * Connect UDP socket to a remote IPv6 host
+ *
+ * @see udpConnect()
+ *
+ * @param[in] udpSocket IPv6 socket file descriptor (@see udpInitialize6())
+ * @param[in] address   Remote host IPv6 address
+ * @param[in] port      Remote host port number
+ *
+ * @return EOK on success, errno of connect() otherwise
+ */
+error_t udpConnect6(int udpSocket, const struct in6_addr* address, in_port_t port);
+
+/**
+ * Find out the source address of datagrams sent to a host
+ *
+ * Connects a scratch socket, so the kernel picks the
+ * address by its routing table. Nothing is sent.
+ *
+ * @param[in]  address      Remote host IP address
+ * @param[in]  port         Remote host port number
+ * @param[out] localAddress Local IP address (network order)
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t udpSourceAddress(in_addr_t address, in_port_t port, in_addr_t* localAddress);
+
+/**
+ * Find out the local address and port of a socket
+ *
+ * Binds the socket to an ephemeral port unless it's bound
+ * already. The address is the one the kernel picks for
+ * datagrams sent to \c address.
+ *
+ * @param[in]  udpSocket    Initialized socket file descriptor (@see udpInitialize())
+ * @param[in]  address      Remote host IP address
+ * @param[in]  port         Remote host port number
+ * @param[out] localAddress Local IP address (network order)
+ * @param[out] localPort    Local port number (network order)
+ *
+ * @return EOK on success, errno code otherwise
+ */
+error_t udpLocalEndpoint(int udpSocket, in_addr_t address, in_port_t port,
+                         in_addr_t* localAddress, in_port_t* localPort);
+
+/**
+ * Allocate a datagram batch
+ *
+ * @param[out] batch Batch to be initialized
+ * @param[in]  size  Maximum number of datagrams in the batch
+ *
+ * @return EOK on success, ENOMEM on malloc failure
+ */
+error_t udpInitializeBatch(struct udpBatch* batch, unsigned int size);
+
+/**
+ * Turn on transmit offloads of a batch
+ *
+ * Offloads the kernel doesn't support are left off, the
+ * batch is then sent by plain sendmmsg(). An offload that
+ * fails later, e.g. GSO on a device without checksum
+ * offload, is turned off by udpSendBatch() the same way.
+ *
+ * MSG_ZEROCOPY sends are waited for before udpSendBatch()
+ * returns, so the datagram buffers can be reused right
+ * after it. It pays off only for the large GSO sends.
+ *
+ * @param[in]     udpSocket Socket the batch is sent to (@see udpConnect())
+ * @param[in,out] batch     Initialized batch
+ * @param[in]     offload   UDP_OFFLOAD_* flags
+ *
+ * @return Offloads turned on
+ */
+int udpEnableOffload(int udpSocket, struct udpBatch* batch, int offload);
+
+/**
+ * Queue a datagram into the batch
+ *
+ * The \c message is not copied. The batch must not
+ * be full.
+ *
+ * @param[in,out] batch       Initialized batch
+ * @param[in]     message     Message content buffer
+ * @param[in]     messageSize Size of the message in buffer
+ *
+ * @return void
+ */
+void udpAddToBatch(struct udpBatch* batch, void* message, size_t messageSize);
+
+/**
+ * Queue a datagram with its own source address
+ *
+ * The source address is passed to the kernel as IP_PKTINFO,
+ * so it must be local (e.g. any 127.0.0.0/8 address on
+ * Linux, or an alias of the outgoing interface). The source
+ * port is the socket's.
+ *
+ * @param[in,out] batch       Initialized batch
+ * @param[in]     message     Message content buffer
+ * @param[in]     messageSize Size of the message in buffer
+ * @param[in]     source      Source address (network order), \
+ *                            INADDR_ANY for the socket's one
+ *
+ * @return void
+ */
+void udpAddToBatchFrom(struct udpBatch* batch, void* message, size_t messageSize, in_addr_t source);
+
+/**
+ * Send all queued datagrams
+ *
+ * Datagrams are sent with as few sendmmsg() calls as
+ * possible. The batch is emptied afterwards, even if some
+ * of the datagrams couldn't be sent.
+ *
+ * @param[in]     udpSocket Connected socket (@see udpConnect())
+ * @param[in,out] batch     Batch with queued datagrams
+ *
+ * @return Number of datagrams sent, counted from the start of the batch
+ */
+unsigned int udpSendBatch(int udpSocket, struct udpBatch* batch);
+
+/**
+ * Free the memory allocated by udpInitializeBatch()
+ *
+ * @param[in,out] batch Batch to be released
+ *
+ * @return void
+ */
+void udpFreeBatch(struct udpBatch* batch);
+
 /**
  * Close UDP socket
  *
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WIRE_ORDER_X86
+#endif
+
+#include "wireorder.h"
+
+typedef void (*wireWriter)(unsigned char* buffer, const struct netflowRecord* records, unsigned int numberOfRecords);
+
+static void writeScalar(unsigned char* buffer, const struct netflowRecord* records, unsigned int numberOfRecords)
+{
+    struct netflowRecord record;
+
+    for (unsigned int flow = 0; flow < numberOfRecords; flow++)
+    {
+        const struct netflowRecord* source = &records[flow];
+
+        record.srcAddr  = source->srcAddr;
+        record.dstAddr  = source->dstAddr;
+        record.nextHop  = source->nextHop;
+        record.input    = htons(source->input);
+        record.output   = htons(source->output);
+        record.dPkts    = htonl(source->dPkts);
+        record.dOctets  = htonl(source->dOctets);
+        record.first    = htonl(source->first);
+        record.last     = htonl(source->last);
+        record.srcPort  = htons(source->srcPort);
+        record.dstPort  = htons(source->dstPort);
+        record.pad      = 0;
+        record.tcpFlags = source->tcpFlags;
+        record.prot     = source->prot;
+        record.tos      = source->tos;
+        record.srcAs    = htons(source->srcAs);
+        record.dstAs    = htons(source->dstAs);
+        record.srcMask  = source->srcMask;
+        record.dstMask  = source->dstMask;
+        record.drops    = 0;
+
+        memcpy(buffer + flow*sizeof(struct netflowRecord), &record, sizeof(struct netflowRecord));
+    }
+}
+
+#ifdef WIRE_ORDER_X86
+
+/* Byte shuffles of the three 16 byte parts of a record (a record
+   is 48 bytes). Addresses stay, counters are swapped, 0x80 writes
+   a zero into the padding. */
+#define SHUFFLE_0  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 13, 12, 15, 14
+#define SHUFFLE_1  3,  2,  1,  0,  7,  6,  5,  4, 11, 10,  9,  8, 15, 14, 13, 12
+#define SHUFFLE_2  1,  0,  3,  2, -128, 5,  6,  7,  9,  8, 11, 10, 12, 13, -128, -128
+
+__attribute__((target("ssse3")))
+static void writeSsse3(unsigned char* buffer, const struct netflowRecord* records, unsigned int numberOfRecords)
+{
+    const __m128i shuffles[3] =
+    {
+        _mm_setr_epi8(SHUFFLE_0),
+        _mm_setr_epi8(SHUFFLE_1),
+        _mm_setr_epi8(SHUFFLE_2)
+    };
+    const unsigned char* source = (const unsigned char*) records;
+
+    for (unsigned int flow = 0; flow < numberOfRecords; flow++)
+    {
+        for (int part = 0; part < 3; part++)
+        {
+            __m128i data = _mm_loadu_si128((const __m128i*) (source + 16*part));
+            _mm_storeu_si128((__m128i*) (buffer + 16*part), _mm_shuffle_epi8(data, shuffles[part]));
+        }
+
+        source += sizeof(struct netflowRecord);
+        buffer += sizeof(struct netflowRecord);
+    }
+}
+
+/* Two records are three 32 byte vectors, the shuffles work in 16 byte lanes */
+__attribute__((target("avx2")))
+static void writeAvx2(unsigned char* buffer, const struct netflowRecord* records, unsigned int numberOfRecords)
+{
+    const __m256i shuffles[3] =
+    {
+        _mm256_setr_epi8(SHUFFLE_0, SHUFFLE_1),
+        _mm256_setr_epi8(SHUFFLE_2, SHUFFLE_0),
+        _mm256_setr_epi8(SHUFFLE_1, SHUFFLE_2)
+    };
+    const unsigned char* source = (const unsigned char*) records;
+    unsigned int flow;
+
+    for (flow = 0; flow + 2 <= numberOfRecords; flow += 2)
+    {
+        for (int part = 0; part < 3; part++)
+        {
+            __m256i data = _mm256_loadu_si256((const __m256i*) (source + 32*part));
+            _mm256_storeu_si256((__m256i*) (buffer + 32*part), _mm256_shuffle_epi8(data, shuffles[part]));
+        }
+
+        source += 2*sizeof(struct netflowRecord);
+        buffer += 2*sizeof(struct netflowRecord);
+    }
+
+    if (flow < numberOfRecords)
+    {
+        writeSsse3(buffer, (const struct netflowRecord*) source, 1);
+    }
+}
+
+#endif
+
+static const struct
+{
+    const char* name;
+    wireWriter  write;
+} wireOrders[NUMBER_OF_WIRE_ORDERS] =
+{
+    [WIRE_ORDER_SCALAR] = {"scalar", writeScalar},
+#ifdef WIRE_ORDER_X86
+    [WIRE_ORDER_SSSE3]  = {"ssse3",  writeSsse3},
+    [WIRE_ORDER_AVX2]   = {"avx2",   writeAvx2}
+#else
+    [WIRE_ORDER_SSSE3]  = {"ssse3",  NULL},
+    [WIRE_ORDER_AVX2]   = {"avx2",   NULL}
+#endif
+};
+
+static wireWriter writer = writeScalar;
+static pthread_once_t writerOnce = PTHREAD_ONCE_INIT;
+
+static int supported(enum wireOrder order)
+{
+#ifdef WIRE_ORDER_X86
+    __builtin_cpu_init();
+    switch (order)
+    {
+    case WIRE_ORDER_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+    case WIRE_ORDER_AVX2:
+        return __builtin_cpu_supports("avx2");
+    default:
+        return 1;
+    }
+#else
+    return order == WIRE_ORDER_SCALAR;
+#endif
+}
+
+static enum wireOrder fastestWireOrder(enum wireOrder limit)
+{
+    enum wireOrder order = limit < NUMBER_OF_WIRE_ORDERS ? limit : NUMBER_OF_WIRE_ORDERS - 1;
+
+    while (order > WIRE_ORDER_SCALAR && !supported(order))
+    {
+        order--;
+    }
+
+    return order;
+}
+
+static void selectFastestWireOrder(void)
+{
+    writer = wireOrders[fastestWireOrder(NUMBER_OF_WIRE_ORDERS)].write;
+}
+
+void writeWireRecords(void* buffer, const struct netflowRecord* records, unsigned int numberOfRecords)
+{
+    pthread_once(&writerOnce, selectFastestWireOrder);
+    writer((unsigned char*) buffer, records, numberOfRecords);
+}
+
+enum wireOrder selectWireOrder(enum wireOrder limit)
+{
+    enum wireOrder order = fastestWireOrder(limit);
+
+    pthread_once(&writerOnce, selectFastestWireOrder);
+    writer = wireOrders[order].write;
+
+    return order;
+}
+
+const char* wireOrderName(enum wireOrder order)
+{
+    return order < NUMBER_OF_WIRE_ORDERS ? wireOrders[order].name : "unknown";
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WIREORDER__H_
+#define _WIREORDER__H_
+
+#include "netflow.h"
+
+/* Implementations of writeWireRecords(), from the slowest */
+enum wireOrder
+{
+    WIRE_ORDER_SCALAR,  /* htonl()/htons() field by field */
+    WIRE_ORDER_SSSE3,   /* One byte shuffle per 16 bytes */
+    WIRE_ORDER_AVX2,    /* One byte shuffle per 32 bytes */
+    NUMBER_OF_WIRE_ORDERS
+};
+
+/**
+ * Write host order records in the v5 wire format
+ *
+ * A host order record has the layout of a wire record, only
+ * the 16 and 32-bit counters are swapped (addresses are kept
+ * in network order). So every 16 bytes of a record turn into
+ * the wire format by one fixed byte shuffle, which SSSE3 and
+ * AVX2 do in a single instruction. The fastest implementation
+ * the CPU supports is picked on the first call. The padding
+ * is always written as zeros.
+ *
+ * @param[out] buffer          Space for \c numberOfRecords wire records, any alignment
+ * @param[in]  records         Records in host byte order (@see makeNetflowPacket())
+ * @param[in]  numberOfRecords Number of records
+ *
+ * @return void
+ */
+void writeWireRecords(void* buffer, const struct netflowRecord* records, unsigned int numberOfRecords);
+
+/**
+ * Limit the implementation used by writeWireRecords()
+ *
+ * For comparing the implementations, by default the fastest
+ * supported one is used. Not thread safe, call it before
+ * the records are written by more threads.
+ *
+ * @param[in] limit The fastest implementation allowed
+ *
+ * @return Implementation in use, \c limit or a slower one the CPU supports
+ */
+enum wireOrder selectWireOrder(enum wireOrder limit);
+
+/**
+ * Name of an implementation
+ *
+ * @param[in] order Implementation
+ *
+ * @return "scalar", "ssse3" or "avx2"
+ */
+const char* wireOrderName(enum wireOrder order);
+
+#endif
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "errors.h"
+#include "worker.h"
+#include "udp.h"
+#include "binaryoutput.h"
+#include "pacing.h"
+#include "pool.h"
+#include "simulation.h"
+#include "template.h"
+#include "fleet.h"
+#include "profile.h"
+
+/* How often is the rate report printed [ns] */
+#define RATE_REPORT_INTERVAL 1000000000ULL
+
+/* The pacer may catch up by at most 10 ms worth of tokens */
+#define PACER_BURST(rate) ((uint64_t) ((rate) / 100) + 1)
+
+/* How often a paused worker checks the rate control [ns] */
+#define PAUSE_CHECK_INTERVAL 10000000ULL
+
+/* Set by stopWorkers(), possibly in a signal handler */
+static volatile sig_atomic_t stopping = 0;
+
+void stopWorkers(void)
+{
+    stopping = 1;
+}
+
+/** Share of worker \c id in a limit split between all workers */
+static uint64_t limitShare(uint64_t limit, unsigned int id, unsigned int workers)
+{
+    if (limit == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    return limit / workers + (id < limit % workers ? 1 : 0);
+}
+
+void initializeBudget(struct runBudget* budget, const struct worker* worker)
+{
+    const struct cliArguments* arguments = worker->arguments;
+
+    budget->pdus  = limitShare(arguments->pduLimit, worker->id, arguments->threads);
+    budget->flows = limitShare(arguments->flowLimit, worker->id, arguments->threads);
+    budget->end   = arguments->duration > 0 ? monotonicTime() + (uint64_t) (arguments->duration * NSECS_PER_SEC)
+                                            : UINT64_MAX;
+}
+
+int budgetLeft(const struct runBudget* budget)
+{
+    return !stopping && budget->pdus > 0 && budget->flows > 0 &&
+           (budget->end == UINT64_MAX || monotonicTime() < budget->end);
+}
+
+void initializeWorker(struct worker* worker, unsigned int id, const struct cliArguments* arguments,
+                      struct outputFile* outputFile, const struct rateControl* control,
+                      uint64_t startTime, const struct randomState* random)
+{
+    worker->id         = id;
+    worker->arguments  = arguments;
+    worker->outputFile = outputFile;
+    worker->control    = control;
+    worker->rate       = arguments->rate > 0 ? arguments->rate / arguments->threads : arguments->rate;
+
+    memset(&worker->stats, 0, sizeof(worker->stats));
+
+    initializeClock(&worker->clock, startTime, arguments->fastForward > 0);
+    initializeExporter(&worker->exporter, startTime / NSECS_PER_SEC, id, random);
+
+    struct transmitMode transmit;
+    transmit.offload     = arguments->offload;
+    transmit.interface   = arguments->txRing;
+    transmit.maxDatagram = arguments->protocol == NETFLOW_V5 ? MAX_NETFLOW_PDU_SIZE : arguments->maxPduSize;
+
+    error_t status = initializeSender(&worker->sender, arguments->destinations, arguments->numberOfDestinations,
+                                      arguments->fanout, arguments->batchSize, &transmit);
+    if (status == EHOSTUNREACH && arguments->txRing != NULL)
+    {
+        printError(status, "Collector's MAC address unknown, it must be on the link and in the neighbour table");
+        exit(EXIT_FAILURE);
+    }
+    if (status != EOK)
+    {
+        printError(status, arguments->txRing != NULL ? "Unable to set up the TX ring" :
+                                                       "Unable to connect to the collectors");
+        exit(EXIT_FAILURE);
+    }
+
+    int offload = worker->sender.destinations[0].batch.offload;
+    if (id == 0 && offload != arguments->offload)
+    {
+        fprintf(stderr, "The kernel doesn't support%s%s, sending without it\n",
+                (arguments->offload & ~offload & UDP_OFFLOAD_GSO) ? " UDP_SEGMENT" : "",
+                (arguments->offload & ~offload & UDP_OFFLOAD_ZEROCOPY) ? " MSG_ZEROCOPY" : "");
+    }
+}
+
+/** Where the PDUs of a worker come from */
+struct pduSource
+{
+    struct pduPool         pool;
+    struct flowSimulation  simulation;
+    struct templateEncoder encoder;
+    struct netflowRecord*  records;     /* Records of one v9/IPFIX PDU */
+    size_t                 bufferSize;  /* Size of one PDU buffer */
+};
+
+static void initializePduSource(struct pduSource* source, struct worker* worker)
+{
+    const struct cliArguments* arguments = worker->arguments;
+    struct netflowExporter* exporter = &worker->exporter;
+    error_t status;
+
+    source->records    = NULL;
+    source->bufferSize = MAX_NETFLOW_PDU_SIZE;
+
+    if (arguments->protocol != NETFLOW_V5)
+    {
+        status = initializeTemplateEncoder(&source->encoder, arguments->protocol, arguments->fields,
+                                           arguments->maxPduSize, arguments->templateRefresh,
+                                           arguments->templateTimeout * 1000);
+        if (status != EOK)
+        {
+            printError(status, "Invalid template fields or MTU");
+            exit(EXIT_FAILURE);
+        }
+
+        source->bufferSize = arguments->maxPduSize;
+        source->records = (struct netflowRecord*) calloc(templateMaxCapacity(&source->encoder),
+                                                         sizeof(struct netflowRecord));
+        if (source->records == NULL)
+        {
+            printError(ENOMEM, "Unable to allocate records");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* The flow cache of --meter belongs to the meter */
+    if (arguments->cacheSize > 0 && arguments->meterFile == NULL)
+    {
+        status = initializeSimulation(&source->simulation, exporter, arguments->cacheSize, arguments->concurrentFlows,
+                                      arguments->activeTimeout * 1000, arguments->inactiveTimeout * 1000,
+                                      arguments->packetRate,
+                                      arguments->protocol != NETFLOW_V5 ? templateMaxCapacity(&source->encoder)
+                                                                        : MAX_NETFLOW_RECORDS);
+        if (status != EOK)
+        {
+            printError(status, "Unable to allocate the flow cache");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (arguments->poolSize > 0)
+    {
+        /* The pool must be larger than a batch, PDUs are patched in place */
+        status = initializePool(&source->pool, exporter, arguments->poolSize > arguments->batchSize ?
+                                                         arguments->poolSize : arguments->batchSize,
+                                clockNow(&worker->clock));
+        if (status != EOK)
+        {
+            printError(status, "Unable to pre-generate PDUs");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/** Make the PDU of \c exporter exported at \c now, \c buffer may not be used.
+    Generated and simulated records are cut at \c maxFlows, pooled PDUs are not. */
+static char* nextPdu(struct pduSource* source, struct worker* worker, struct netflowExporter* exporter,
+                     struct templateEncoder* encoder, uint64_t now, uint64_t maxFlows, char* buffer,
+                     size_t* pduSize, unsigned int* numberOfFlows)
+{
+    const struct cliArguments* arguments = worker->arguments;
+
+    if (arguments->protocol != NETFLOW_V5)
+    {
+        uint32_t sysUpTime = netflowUptime(exporter, now);
+        unsigned int capacity = templateCapacity(encoder, sysUpTime);
+
+        if (arguments->cacheSize > 0)
+        {
+            *numberOfFlows = takeSimulatedRecords(&source->simulation, exporter, source->records,
+                                                  capacity < maxFlows ? capacity : maxFlows, &sysUpTime);
+        }
+        else
+        {
+            *numberOfFlows = 1 + randomBounded(&exporter->random, capacity);
+            *numberOfFlows = *numberOfFlows < maxFlows ? *numberOfFlows : maxFlows;
+            makeRandomNetflowRecords(exporter, source->records, *numberOfFlows, sysUpTime);
+        }
+
+        *pduSize = makeTemplatePacket(buffer, encoder, exporter, source->records, *numberOfFlows, sysUpTime);
+        return buffer;
+    }
+
+    if (arguments->cacheSize > 0)
+    {
+        unsigned int maxRecords = arguments->maxV5Records < maxFlows ? arguments->maxV5Records : maxFlows;
+        *pduSize = makeSimulatedNetflowPacket(buffer, &source->simulation, exporter, maxRecords, numberOfFlows);
+        return buffer;
+    }
+
+    if (arguments->poolSize > 0)
+    {
+        return nextPoolPdu(&source->pool, exporter, now, pduSize, numberOfFlows);
+    }
+
+    /* GSO sends runs of equally sized datagrams at once */
+    *numberOfFlows = (arguments->offload & UDP_OFFLOAD_GSO) ? arguments->maxV5Records : randomNumberOfFlows(exporter);
+    *numberOfFlows = *numberOfFlows < maxFlows ? *numberOfFlows : maxFlows;
+    *pduSize = makeRandomNetflowPacket(buffer, exporter, *numberOfFlows, now);
+    return buffer;
+}
+
+static void freePduSource(struct pduSource* source, struct worker* worker)
+{
+    const struct cliArguments* arguments = worker->arguments;
+
+    if (arguments->cacheSize > 0 && arguments->meterFile == NULL)
+    {
+        freeSimulation(&source->simulation);
+    }
+    else if (arguments->poolSize > 0)
+    {
+        freePool(&source->pool);
+    }
+
+    free(source->records);
+}
+
+void flushBatch(struct worker* worker)
+{
+    uint64_t sendStart = monotonicTime();
+    struct senderResult result = senderFlush(&worker->sender);
+    uint64_t sendEnd = monotonicTime();
+    statsLatency(&worker->stats, STAGE_SEND, sendEnd - sendStart);
+
+    statsSent(&worker->stats, result.sent, result.flows, result.bytes);
+    if (result.failed > 0)
+    {
+        statsFailed(&worker->stats, result.failed, result.errorNumber);
+    }
+
+    if (worker->outputFile != NULL)
+    {
+        senderWriteOutput(&worker->sender, worker->outputFile);
+        statsLatency(&worker->stats, STAGE_WRITE, monotonicTime() - sendEnd);
+    }
+}
+
+/** Main loop of a worker simulating a fleet of exporters (--exporters) */
+static void runFleet(struct worker* worker, struct pduSource* source, char* buffers,
+                     char** pdus, size_t* pduSizes, unsigned int* pduFlows)
+{
+    const struct cliArguments* arguments = worker->arguments;
+
+    /* Worker i gets exporters [i*N/T, (i+1)*N/T) */
+    uint32_t first = (uint64_t) worker->id * arguments->exporters / arguments->threads;
+    uint32_t last  = (uint64_t) (worker->id + 1) * arguments->exporters / arguments->threads;
+
+    struct exporterFleet fleet;
+    error_t status = initializeFleet(&fleet, first, last - first,
+                                     arguments->protocol != NETFLOW_V5 ? &source->encoder : NULL,
+                                     (uint64_t) (arguments->exportInterval * 1e9), arguments->exporterSource,
+                                     clockNow(&worker->clock), &worker->exporter.random);
+    if (status != EOK)
+    {
+        printError(status, "Unable to allocate the exporters");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t end = clockNow(&worker->clock) + (uint64_t) (arguments->fastForward * NSECS_PER_SEC);
+
+    uint32_t* due = (uint32_t*) calloc(arguments->batchSize, sizeof(uint32_t));
+    if (due == NULL)
+    {
+        printError(ENOMEM, "Unable to allocate PDU buffers");
+        exit(EXIT_FAILURE);
+    }
+
+    struct runBudget budget;
+    initializeBudget(&budget, worker);
+
+    while (budgetLeft(&budget) && (!worker->clock.simulated || clockNow(&worker->clock) < end))
+    {
+        uint64_t generateStart = monotonicTime();
+        uint64_t now = clockUpdate(&worker->clock);
+        unsigned int count = fleetDue(&fleet, now, due, budget.pdus < arguments->batchSize ?
+                                                        budget.pdus : arguments->batchSize);
+
+        if (count == 0)
+        {
+            clockSleepUntil(&worker->clock, fleetNextCheck(&fleet));
+            continue;
+        }
+
+        for (unsigned int i = 0; i < count && budget.flows > 0; i++)
+        {
+            uint32_t exporter = due[i];
+
+            pdus[i] = nextPdu(source, worker, &fleet.exporters[exporter],
+                              fleet.encoders != NULL ? &fleet.encoders[exporter] : NULL,
+                              now, budget.flows, buffers + i*source->bufferSize, &pduSizes[i], &pduFlows[i]);
+            budgetSpend(&budget, 1, pduFlows[i]);
+
+            senderAddFrom(&worker->sender, pdus[i], pduSizes[i], pduFlows[i],
+                          fleet.sources != NULL ? fleet.sources[exporter] : htonl(INADDR_ANY), now);
+        }
+        statsLatency(&worker->stats, STAGE_GENERATE, monotonicTime() - generateStart);
+
+        flushBatch(worker);
+    }
+
+    free(due);
+    freeFleet(&fleet);
+}
+
+/** Main loop of a worker simulating one exporter */
+static void runExporter(struct worker* worker, struct pduSource* source, char* buffers,
+                        char** pdus, size_t* pduSizes, unsigned int* pduFlows)
+{
+    const struct cliArguments* arguments = worker->arguments;
+    struct netflowExporter* exporter = &worker->exporter;
+    struct virtualClock* clock = &worker->clock;
+
+    unsigned int batchFlows = 0;
+
+    struct pacer pacer;
+    pacerInitialize(&pacer, worker->rate, PACER_BURST(worker->rate));
+
+    /* A simulated clock follows the rate schedule instead of the pacer */
+    uint64_t start = clockNow(clock);
+    uint64_t end = start + (uint64_t) (arguments->fastForward * NSECS_PER_SEC);
+    uint64_t scheduleStart = start;
+    double scheduled = 0;
+
+    struct runBudget budget;
+    initializeBudget(&budget, worker);
+
+    while (budgetLeft(&budget) && (!clock->simulated || clockNow(clock) < end))
+    {
+        if (worker->control != NULL)
+        {
+            double rate = controlRate(worker->control, clockUpdate(clock) - start) / arguments->threads;
+            if (rate == 0)
+            {
+                clockSleepUntil(clock, clockNow(clock) + PAUSE_CHECK_INTERVAL);
+                continue;
+            }
+
+            if (rate != worker->rate)
+            {
+                worker->rate  = rate;
+                scheduleStart = clockNow(clock);
+                scheduled     = 0;
+                pacerSetRate(&pacer, rate, PACER_BURST(rate));
+            }
+        }
+
+        /* Fill the whole batch before sending anything */
+        uint64_t generateStart = monotonicTime();
+        unsigned int count = 0;
+
+        batchFlows = 0;
+        clockUpdate(clock);
+        for (; count < arguments->batchSize && budget.pdus > 0 && budget.flows > 0 &&
+               (!clock->simulated || clockNow(clock) < end); count++)
+        {
+            uint64_t now = clockNow(clock);
+
+            pdus[count] = nextPdu(source, worker, exporter, &source->encoder, now, budget.flows,
+                                  buffers + count*source->bufferSize, &pduSizes[count], &pduFlows[count]);
+            batchFlows += pduFlows[count];
+            budgetSpend(&budget, 1, pduFlows[count]);
+
+            senderAddFrom(&worker->sender, pdus[count], pduSizes[count], pduFlows[count], htonl(INADDR_ANY), now);
+
+            if (clock->simulated)
+            {
+                scheduled += arguments->rateInFlows ? pduFlows[count] : 1;
+                clockSleepUntil(clock, scheduleStart + (uint64_t) (scheduled * NSECS_PER_SEC / worker->rate));
+            }
+        }
+        statsLatency(&worker->stats, STAGE_GENERATE, monotonicTime() - generateStart);
+
+        if (worker->rate >= 0 && !clock->simulated)
+        {
+            pacerWait(&pacer, arguments->rateInFlows ? batchFlows : count);
+        }
+
+        flushBatch(worker);
+
+        if (worker->rate < 0)
+        {
+            sleep(randomBounded(&exporter->random, 3));
+        }
+        else if (!clock->simulated && pacerWindowElapsed(&pacer) >= RATE_REPORT_INTERVAL)
+        {
+            flockfile(stderr);
+            if (arguments->threads > 1)
+            {
+                fprintf(stderr, "Worker %u: ", worker->id);
+            }
+            pacerReport(&pacer, stderr, arguments->rateInFlows ? "flows" : "PDUs");
+            funlockfile(stderr);
+        }
+    }
+}
+
+void* runWorker(void* argument)
+{
+    struct worker* worker = (struct worker*) argument;
+    const struct cliArguments* arguments = worker->arguments;
+
+    struct pduSource source;
+    initializePduSource(&source, worker);
+
+    /* One PDU buffer per batch slot */
+    char* buffers = (char*) calloc(arguments->batchSize, source.bufferSize);
+    char** pdus = (char**) calloc(arguments->batchSize, sizeof(char*));
+    size_t* pduSizes = (size_t*) calloc(arguments->batchSize, sizeof(size_t));
+    unsigned int* pduFlows = (unsigned int*) calloc(arguments->batchSize, sizeof(unsigned int));
+    if (buffers == NULL || pdus == NULL || pduSizes == NULL || pduFlows == NULL)
+    {
+        printError(ENOMEM, "Unable to allocate PDU buffers");
+        exit(EXIT_FAILURE);
+    }
+
+    if (arguments->exporters > 0)
+    {
+        runFleet(worker, &source, buffers, pdus, pduSizes, pduFlows);
+    }
+    else
+    {
+        runExporter(worker, &source, buffers, pdus, pduSizes, pduFlows);
+    }
+
+    freePduSource(&source, worker);
+
+    free(buffers);
+    free(pdus);
+    free(pduSizes);
+    free(pduFlows);
+
+    return NULL;
+}
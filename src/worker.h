@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2010  by Radek Pazdera <radek.pazdera@gmail.com>
+ *
+ * This file is part of nfgen.
+ *
+ * nfgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nfgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nfgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORKER__H_
+#define _WORKER__H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "nfgen.h"
+#include "netflow.h"
+#include "binaryoutput.h"
+#include "stats.h"
+#include "sender.h"
+#include "clock.h"
+#include "profile.h"
+
+/** Generator thread
+ *
+ * Each worker simulates one exporter, or its share of the
+ * exporters given by --exporters (@see struct exporterFleet).
+ * It has its own sockets, generator state and flow sequence
+ * counters, so the workers don't share anything but the
+ * (read-only) command line arguments and the output file.
+ */
+struct worker
+{
+    unsigned int id;
+    pthread_t    thread;
+
+    const struct cliArguments* arguments;
+    struct outputFile* outputFile;  /* Shared by all workers, may be NULL */
+    double       rate;        /* This worker's share of the total rate */
+    const struct rateControl* control;  /* Rate changing at run time, may be NULL */
+
+    struct netflowExporter exporter;
+    struct sender sender;       /* Sockets connected to the collectors */
+    struct virtualClock clock;  /* Time stamps of the PDUs */
+
+    struct workerStats stats;
+};
+
+/** What a worker may still generate
+ *
+ * The --count and --flow-count limits are split between
+ * the workers up front, so the total is exact and every
+ * worker's output depends only on the seed. The budget
+ * also runs out when --duration passes or the workers
+ * are stopped (@see stopWorkers()).
+ */
+struct runBudget
+{
+    uint64_t pdus;      /* UINT64_MAX = unlimited */
+    uint64_t flows;     /* UINT64_MAX = unlimited */
+    uint64_t end;       /* CLOCK_MONOTONIC [ns], UINT64_MAX = unlimited */
+};
+
+/**
+ * Initialize the budget of a worker
+ *
+ * The --duration starts now.
+ *
+ * @param[out] budget Budget to be initialized
+ * @param[in]  worker Initialized worker
+ *
+ * @return void
+ */
+void initializeBudget(struct runBudget* budget, const struct worker* worker);
+
+/**
+ * Check whether a worker may go on
+ *
+ * @param[in] budget Initialized budget
+ *
+ * @return Non-zero while there is something left
+ */
+int budgetLeft(const struct runBudget* budget);
+
+/**
+ * Account generated PDUs
+ *
+ * @param[in,out] budget Initialized budget
+ * @param[in]     pdus   Number of PDUs
+ * @param[in]     flows  Number of flow records in them
+ *
+ * @return void
+ */
+static inline void budgetSpend(struct runBudget* budget, uint64_t pdus, uint64_t flows)
+{
+    if (budget->pdus != UINT64_MAX)
+    {
+        budget->pdus -= pdus < budget->pdus ? pdus : budget->pdus;
+    }
+    if (budget->flows != UINT64_MAX)
+    {
+        budget->flows -= flows < budget->flows ? flows : budget->flows;
+    }
+}
+
+/**
+ * Send the queued batch and store it into the output file
+ *
+ * Flushes the worker's sender (@see senderFlush()) and
+ * accounts the result and the send and write latencies
+ * in the worker's statistics.
+ *
+ * @param[in,out] worker Initialized worker
+ *
+ * @return void
+ */
+void flushBatch(struct worker* worker);
+
+/**
+ * Ask all workers to stop
+ *
+ * The workers send the batch they have generated and
+ * return. Safe to call from a signal handler.
+ *
+ * @return void
+ */
+void stopWorkers(void);
+
+/**
+ * Initialize worker
+ *
+ * The worker's exporter gets \c id as its engine ID and
+ * its own generator stream. Pass a different stream to each
+ * worker (@see randomJump()). The worker's clock starts at
+ * \c startTime, it's simulated with --fast-forward. With
+ * a rate control, the worker sends its share of the rate
+ * it gives instead of the fixed -r/-f rate.
+ *
+ * @param[out] worker     Worker to be initialized
+ * @param[in]  id         Worker index (0 .. number of workers - 1)
+ * @param[in]  arguments  Parsed command line arguments
+ * @param[in]  outputFile Open output file or NULL
+ * @param[in]  control    Started rate control or NULL
+ * @param[in]  startTime  Start of the simulated exporters [ns since the epoch]
+ * @param[in]  random     Generator stream of the worker
+ *
+ * @return void
+ */
+void initializeWorker(struct worker* worker, unsigned int id, const struct cliArguments* arguments,
+                      struct outputFile* outputFile, const struct rateControl* control,
+                      uint64_t startTime, const struct randomState* random);
+
+/**
+ * Generate and send PDUs
+ *
+ * This is the main loop of a worker. It's suitable as
+ * a pthread_create() start routine. It returns after
+ * --fast-forward reached its end, the run budget is spent
+ * (@see struct runBudget) or the workers were stopped.
+ *
+ * @param[in,out] worker Initialized worker (struct worker*)
+ *
+ * @return NULL
+ */
+void* runWorker(void* worker);
+
+#endif
+